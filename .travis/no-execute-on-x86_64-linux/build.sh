@@ -0,0 +1,14 @@
+#!/bin/sh
+
+set -e
+set -x
+
+export CC=gcc-7
+export CXX=g++-7
+export PKG_CONFIG_PATH=$HOME/.local/lib/pkgconfig:$PKG_CONFIG_PATH
+
+mkdir build && cd build
+cmake .. -DBoost_INCLUDE_DIRS=${PWD}/../externals/ext-boost -DCMAKE_BUILD_TYPE=Release -DDYNARMIC_ENABLE_NO_EXECUTE_SUPPORT=1 -G Ninja
+ninja
+
+./tests/dynarmic_tests --durations yes
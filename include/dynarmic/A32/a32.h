@@ -92,6 +92,27 @@ public:
         return is_executing;
     }
 
+    struct FastDispatchStatistics {
+        std::uint64_t hits = 0;
+        std::uint64_t misses = 0;
+    };
+
+    /// Returns the number of fast dispatch table hits and misses since this Jit was created.
+    /// These are only counted if UserConfig::fast_dispatch_statistics is true.
+    FastDispatchStatistics GetFastDispatchStatistics() const;
+
+    enum class CodeCachePageBacking {
+        /// Ordinary pages.
+        Normal,
+        /// Transparent huge pages have been requested. The kernel uses them where it can.
+        TransparentHugePages,
+        /// Explicitly reserved huge pages.
+        HugePages,
+    };
+
+    /// Returns the kind of pages the code cache is backed by. See UserConfig::code_cache_huge_pages.
+    CodeCachePageBacking GetCodeCachePageBacking() const;
+
     /**
      * @param descriptor Basic block descriptor.
      * @return A string containing disassembly of the host machine code produced for the basic block.
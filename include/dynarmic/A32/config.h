@@ -124,6 +124,61 @@ struct UserConfig {
 
     /// This enables the fast dispatcher.
     bool enable_fast_dispatch = true;
+    /// Number of entries in the fast dispatch table. Must be a power of two.
+    std::size_t fast_dispatch_table_size = 0x10000;
+    /// Associativity of the fast dispatch table: 1 (direct-mapped), 2 or 4.
+    /// Higher associativity reduces conflicts between hot targets at the cost of a slightly longer lookup.
+    std::size_t fast_dispatch_table_ways = 1;
+    /// Count fast dispatch table hits and misses. See Jit::GetFastDispatchStatistics.
+    bool fast_dispatch_statistics = false;
+
+    /// Size of the code cache in bytes. The constant pool is allocated out of this space.
+    /// After the constant pool, the dispatcher and the hot region (if any) have been taken out,
+    /// both near code and far code must be at least 2 MiB in size.
+    std::size_t code_cache_size = 128 * 1024 * 1024;
+    /// Offset in bytes of far code from the beginning of near code within the code cache.
+    /// Rarely executed code is placed in far code. This must be less than code_cache_size.
+    std::size_t far_code_offset = 100 * 1024 * 1024;
+    /// Size of the constant pool in bytes.
+    std::size_t constant_pool_size = 2 * 1024 * 1024;
+    /// If this is larger than code_cache_size, the code cache grows on demand up to this
+    /// size instead of evicting code when it fills up. Address space for the maximum size
+    /// is reserved up front, but memory is only committed as required. The code cache grows
+    /// in increments of code_cache_size divided by the number of regions.
+    std::size_t code_cache_max_size = 0;
+    /// Back the code cache with 2 MiB huge pages to reduce iTLB misses in emitted code.
+    /// Explicitly reserved huge pages (hugetlbfs) are used if enough are available and the
+    /// reserved size is a multiple of 2 MiB; otherwise transparent huge pages are requested.
+    /// If neither is available, ordinary pages are used. See Jit::GetCodeCachePageBacking.
+    bool code_cache_huge_pages = false;
+
+    /// The code cache is partitioned into this many regions. When the code cache fills up,
+    /// only one region is evicted, and blocks that were in it are recompiled when they are
+    /// next needed. Links from other blocks into the evicted region are undone. Space freed by
+    /// invalidated blocks is reclaimed first. Otherwise regions whose blocks have not been
+    /// looked up or linked to since the previous eviction are preferred, and of those the region with the least code still
+    /// in use is evicted; ties are broken in favour of the least recently used region.
+    /// A value of 1 results in the entire code cache being flushed when it fills up.
+    /// Each region has at least 2 MiB each of near and far code; if the code cache is too small
+    /// for this many regions, fewer are used.
+    std::size_t code_cache_regions = 8;
+
+    /// If both are non-null, ticks are accounted for in memory instead of by calling
+    /// UserCallbacks::AddTicks and UserCallbacks::GetTicksRemaining, which are then never called.
+    /// Executed ticks are atomically added to *tick_counter, so the embedder may access it from
+    /// other threads. Execution stops soon after *tick_counter reaches *tick_deadline. Both are
+    /// only read when Jit::Run is called and wherever the JIT would otherwise have called
+    /// GetTicksRemaining; in between, a Jit counts down the ticks it had left at that point.
+    /// Each Jit should therefore have its own counter: with a counter shared by N Jits, each of
+    /// them runs until it alone has executed up to the remaining ticks, overshooting the deadline
+    /// by up to N times. Use Jit::HaltExecution to stop sooner.
+    std::uint64_t* tick_counter = nullptr;
+    const std::uint64_t* tick_deadline = nullptr;
+
+    /// Determines whether AddTicks and GetTicksRemaining are called.
+    /// If false, execution will continue until soon after Jit::HaltExecution is called.
+    /// Blocks then no longer count cycles, and tick_counter and tick_deadline are ignored.
+    bool enable_ticks = true;
 
     /// This option relates to the CPSR.E flag. Enabling this option disables modification
     /// of CPSR.E by the emulated program, forcing it to 0.
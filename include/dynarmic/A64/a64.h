@@ -44,11 +44,37 @@ public:
 
     /**
      * Invalidate the code cache at a range of addresses.
+     * If UserConfig::translation_cache is set, translations of this range are also removed from it.
+     * Other Jits sharing that TranslationCache keep the host code they have emitted for this range,
+     * so this must be called on each of them as well.
      * @param start_address The starting address of the range to invalidate.
      * @param length The length (in bytes) of the range to invalidate.
      */
     void InvalidateCacheRange(std::uint64_t start_address, std::size_t length);
 
+    /**
+     * Invalidate cached page_table lookups for a range of addresses.
+     * Must be called after changing page_table when UserConfig::enable_page_table_tlb is set.
+     * Takes effect immediately, so it can also be called from a callback.
+     * @param start_address The starting address of the range to invalidate.
+     * @param length The length (in bytes) of the range to invalidate.
+     */
+    void InvalidateTLBRange(std::uint64_t start_address, std::size_t length);
+
+    /**
+     * Invalidate all cached page_table lookups.
+     * Takes effect immediately, so it can also be called from a callback.
+     */
+    void ClearTLB();
+
+    /**
+     * Re-emit the blocks executed most frequently since the last call contiguously in the hot region
+     * of the code cache. Blocks previously in the hot region are replaced. Does nothing unless
+     * UserConfig::hot_code_size is non-zero.
+     * Can be called at any time. Halts execution if called within a callback.
+     */
+    void OptimizeCodeLayout();
+
     /**
      * Reset CPU state to state at startup. Does not clear code cache.
      * Cannot be called from a callback.
@@ -115,6 +141,40 @@ public:
      */
     bool IsExecuting() const;
 
+    struct FastDispatchStatistics {
+        std::uint64_t hits = 0;
+        std::uint64_t misses = 0;
+    };
+
+    /// Returns the number of fast dispatch table hits and misses since this Jit was created.
+    /// These are only counted if UserConfig::fast_dispatch_statistics is true.
+    FastDispatchStatistics GetFastDispatchStatistics() const;
+
+    enum class CodeCachePageBacking {
+        /// Ordinary pages.
+        Normal,
+        /// Transparent huge pages have been requested. The kernel uses them where it can.
+        TransparentHugePages,
+        /// Explicitly reserved huge pages.
+        HugePages,
+    };
+
+    /// Returns the kind of pages the code cache is backed by. See UserConfig::code_cache_huge_pages.
+    CodeCachePageBacking GetCodeCachePageBacking() const;
+
+    struct CodeCacheStatistics {
+        /// Number of times the code cache grew because it was full.
+        std::uint64_t grows = 0;
+        /// Number of times a region of the code cache was evicted because the code cache was full.
+        std::uint64_t region_evictions = 0;
+        /// Number of times the entire code cache was flushed because it was full.
+        std::uint64_t flushes = 0;
+    };
+
+    /// Returns how often the code cache has filled up since this Jit was created, and what was done about it.
+    /// See UserConfig::code_cache_max_size and UserConfig::code_cache_regions.
+    CodeCacheStatistics GetCodeCacheStatistics() const;
+
     /**
      * Debugging: Disassemble all of compiled code.
      * @return A string containing disassembly of all host machine code produced.
@@ -10,6 +10,7 @@
 #include <cstddef>
 #include <cstdint>
 #include <memory>
+#include <vector>
 
 namespace Dynarmic {
 namespace A64 {
@@ -88,6 +89,8 @@ struct UserCallbacks {
     // return the same value at any point in time for this vaddr. The JIT may use this information
     // in optimizations.
     // A conservative implementation that always returns false is safe.
+    // Values folded in this way are never stored in a TranslationCache. This callback and the
+    // MemoryRead* callbacks are only called on the thread calling Jit::Run.
     virtual bool IsReadOnlyMemory(VAddr /* vaddr */) { return false; }
 
     /// The interpreter must execute exactly num_instructions starting from PC.
@@ -109,6 +112,7 @@ struct UserCallbacks {
 };
 
 class ExclusiveMonitor;
+class TranslationCache;
 
 struct UserConfig {
     UserCallbacks* callbacks;
@@ -116,6 +120,11 @@ struct UserConfig {
     size_t processor_id = 0;
     ExclusiveMonitor* global_monitor = nullptr;
 
+    /// When set, translations of guest code are shared with all other Jits using the same
+    /// TranslationCache. See TranslationCache for the requirements this places on the
+    /// configuration of those Jits.
+    TranslationCache* translation_cache = nullptr;
+
     /// When set to true, UserCallbacks::DataCacheOperationRaised will be called when any
     /// data cache instruction is executed. Notably DC ZVA will not implicitly do anything.
     /// When set to false, UserCallbacks::DataCacheOperationRaised will never be called.
@@ -157,6 +166,17 @@ struct UserConfig {
     /// Determines the size of page_table. Valid values are between 12 and 64 inclusive.
     /// This is only used if page_table is not nullptr.
     size_t page_table_address_space_bits = 36;
+    /// Splits the page table into the levels of a radix tree, so that its size scales with the
+    /// amount of mapped memory rather than with the size of the address space.
+    /// Each entry is the number of virtual address bits that index a level, starting with the
+    /// topmost level. The entries must sum to page_table_address_space_bits - 12, and every level
+    /// other than the topmost must be indexed by fewer than 32 bits.
+    /// page_table then points to the topmost level. Each entry of a level other than the last points
+    /// to a table of the next level, and each entry of the last level is a page pointer as it would be
+    /// in a flat page table. A null entry at any level results in a call to the relevant memory callback.
+    /// If empty, page_table is a single flat table.
+    /// This is only used if page_table is not nullptr.
+    std::vector<std::size_t> page_table_level_bits = {};
     /// Determines what happens if the guest accesses an entry that is off the end of the
     /// page table. If true, Dynarmic will silently mirror page_table's address space. If
     /// false, accessing memory outside of page_table bounds will result in a call to the
@@ -179,7 +199,46 @@ struct UserConfig {
     /// Determines if the above option only triggers when the misalignment straddles a
     /// page boundary.
     bool only_detect_misalignment_via_page_table_on_page_boundary = false;
-
+    /// Caches the results of page_table lookups in a small direct-mapped TLB kept in the JIT
+    /// state, with separate entries for reads and writes. A hit costs a compare and an add
+    /// instead of a page table walk. Misses walk page_table as usual and refill the entry.
+    /// The embedder must call Jit::InvalidateTLBRange or Jit::ClearTLB after changing or
+    /// removing any entry of page_table that may have been accessed.
+    /// This is only used if page_table is not nullptr.
+    bool enable_page_table_tlb = false;
+
+    /// Fastmem Pointer
+    /// This should point to the beginning of a 2^fastmem_address_space_bits bytes
+    /// address space which is in arranged just like what you wish for emulated memory to
+    /// be. If the host page faults on an address, the JIT will fallback to calling the
+    /// MemoryRead*/MemoryWrite* callbacks.
+    void* fastmem_pointer = nullptr;
+    /// Determines if instructions that pagefault should cause recompilation of that block
+    /// with fastmem disabled.
+    bool recompile_on_fastmem_failure = true;
+    /// Declares how many valid address bits are there in virtual addresses.
+    /// Determines the size of fastmem arena. Valid values are between 12 and 64 inclusive.
+    /// This is only used if fastmem_pointer is not nullptr.
+    size_t fastmem_address_space_bits = 36;
+    /// Determines what happens if the guest accesses an entry that is off the end of the
+    /// fastmem arena. If true, Dynarmic will silently mirror fastmem's address space. If
+    /// false, accessing memory outside of fastmem bounds will result in a call to the
+    /// relevant memory callback.
+    /// This is only used if fastmem_pointer is not nullptr.
+    bool silently_mirror_fastmem = true;
+
+    /// Detect guest stores to pages that contain translated code. Stores performed through
+    /// fastmem or page_table are checked against a table of such pages, and a store to one of
+    /// them invalidates exactly the blocks that were translated from the written bytes.
+    /// The table covers fastmem's address space if fastmem_pointer is set, otherwise page_table's
+    /// address space, and only takes up memory for regions that contain translated code.
+    /// Address spaces larger than 48 bits are folded into 48 bits. Pages that share an entry
+    /// stay watched until the cache is cleared, so stores to them may be checked unnecessarily.
+    /// Stores that are performed via the MemoryWrite* callbacks are not detected; the
+    /// embedder remains responsible for calling Jit::InvalidateCacheRange for those.
+    /// Only the Jit that performs a store invalidates its blocks; other Jits running the same
+    /// guest code must be told by the embedder, even if they share a TranslationCache.
+    bool detect_self_modifying_code = false;
 
     /// This option relates to translation. Generally when we run into an unpredictable
     /// instruction the ExceptionRaised callback is called. If this is true, we define
@@ -188,6 +247,93 @@ struct UserConfig {
 
     /// This enables the fast dispatcher.
     bool enable_fast_dispatch = true;
+    /// Number of entries in the fast dispatch table. Must be a power of two.
+    std::size_t fast_dispatch_table_size = 0x100000;
+    /// Associativity of the fast dispatch table: 1 (direct-mapped), 2 or 4.
+    /// Higher associativity reduces conflicts between hot targets at the cost of a slightly longer lookup.
+    std::size_t fast_dispatch_table_ways = 1;
+    /// Count fast dispatch table hits and misses. See Jit::GetFastDispatchStatistics.
+    bool fast_dispatch_statistics = false;
+
+    /// The number of targets remembered by each indirect branch (BR, BLR). Each indirect branch
+    /// checks its most recently seen targets inline before falling back to the fast dispatcher.
+    /// Zero disables inline caches. Has no effect if enable_fast_dispatch is false.
+    std::size_t inline_cache_entries = 0;
+
+    /// The maximum number of guest basic blocks combined into one block. If this is greater
+    /// than 1, translation follows unconditional direct branches (B and BL) so that
+    /// optimizations and register allocation apply across the combined blocks. Cycle counts
+    /// are only checked at the end of a combined block.
+    std::size_t max_blocks_per_trace = 1;
+
+    /// A block that branches back to its own start, such as a small loop, keeps up to this many
+    /// of its most used general-purpose registers in host registers across iterations. They are
+    /// only written back when the loop exits, and each iteration checks the cycle count once.
+    /// Loops that call the supervisor, raise exceptions, hook data cache operations or perform
+    /// exclusive stores are not affected, nor are loops that store to memory if
+    /// detect_self_modifying_code is set. The number of registers cached is also limited by the
+    /// host's callee-saved registers that are not otherwise reserved.
+    /// While such a loop is running, Jit::GetRegister called from a memory callback may return
+    /// stale values. Zero disables this.
+    std::size_t loop_cached_registers = 0;
+
+    /// Size of the code cache in bytes. The constant pool is allocated out of this space.
+    /// After the constant pool, the dispatcher and the hot region (if any) have been taken out,
+    /// both near code and far code must be at least 2 MiB in size.
+    std::size_t code_cache_size = 128 * 1024 * 1024;
+    /// Offset in bytes of far code from the beginning of near code within the code cache.
+    /// Rarely executed code is placed in far code. This must be less than code_cache_size.
+    std::size_t far_code_offset = 100 * 1024 * 1024;
+    /// Size of the constant pool in bytes.
+    std::size_t constant_pool_size = 2 * 1024 * 1024;
+    /// If this is larger than code_cache_size, the code cache grows on demand up to this
+    /// size instead of evicting code when it fills up. Address space for the maximum size
+    /// is reserved up front, but memory is only committed as required. The code cache grows
+    /// in increments of code_cache_size divided by the number of regions.
+    std::size_t code_cache_max_size = 0;
+    /// Back the code cache with 2 MiB huge pages to reduce iTLB misses in emitted code.
+    /// Explicitly reserved huge pages (hugetlbfs) are used if enough are available and the
+    /// reserved size is a multiple of 2 MiB; otherwise transparent huge pages are requested.
+    /// If neither is available, ordinary pages are used. See Jit::GetCodeCachePageBacking.
+    bool code_cache_huge_pages = false;
+
+    /// When non-zero, blocks are first compiled quickly without optimization passes and count
+    /// how many times they are executed. A block that is executed this many times is
+    /// recompiled with all optimizations enabled, and the new code replaces the old.
+    /// This does not apply to blocks compiled by background threads or found in the
+    /// translation cache, which are always fully optimized. Only fully optimized blocks
+    /// are added to the translation cache.
+    std::size_t tiered_compilation_threshold = 0;
+
+    /// When non-zero, guest code is translated and optimized on this many background threads
+    /// instead of on the thread calling Jit::Run. Until a block has been compiled, the guest
+    /// makes progress one instruction at a time through UserCallbacks::InterpreterFallback,
+    /// which must therefore be fully implemented. Finished blocks are linked in as they become
+    /// available. Jit::Step always compiles synchronously.
+    /// UserCallbacks::MemoryReadCode is called from the background threads and must be safe
+    /// to call concurrently with execution. No other callbacks are called from them.
+    std::size_t background_compilation_threads = 0;
+
+    /// The code cache is partitioned into this many regions. When the code cache fills up,
+    /// only one region is evicted, and blocks that were in it are recompiled when they are
+    /// next needed. Links from other blocks into the evicted region are undone. Space freed by
+    /// invalidated blocks is reclaimed first. Otherwise regions whose blocks have not been
+    /// looked up or linked to since the previous eviction are preferred, and of those the region with the least code still
+    /// in use is evicted; ties are broken in favour of the least recently used region.
+    /// A value of 1 results in the entire code cache being flushed when it fills up.
+    /// Each region has at least 2 MiB each of near and far code; if the code cache is too small
+    /// for this many regions, fewer are used.
+    std::size_t code_cache_regions = 8;
+
+    /// When non-zero, this many bytes at the start of the code cache are set aside as a hot region,
+    /// and every block counts how many times it is executed. Jit::OptimizeCodeLayout re-emits the
+    /// most frequently executed blocks contiguously in the hot region, which improves instruction
+    /// cache and iTLB locality. The hot region must leave at least 2 MiB each of near and far code
+    /// for the other regions, and must itself have at least 2 MiB of each.
+    std::size_t hot_code_size = 0;
+    /// When non-zero and hot_code_size is non-zero, the code layout is also optimized automatically
+    /// after this many blocks have been compiled. This is done when Jit::Run or Jit::Step returns.
+    std::size_t code_layout_interval = 0;
 
     // The below options relate to accuracy of floating-point emulation.
 
@@ -201,9 +347,22 @@ struct UserConfig {
         NoChecks,
     } floating_point_nan_accuracy = NaNAccuracy::Accurate;
 
-    // Determines whether AddTicks and GetTicksRemaining are called.
-    // If false, execution will continue until soon after Jit::HaltExecution is called.
-    // bool enable_ticks = true; // TODO
+    /// If both are non-null, ticks are accounted for in memory instead of by calling
+    /// UserCallbacks::AddTicks and UserCallbacks::GetTicksRemaining, which are then never called.
+    /// Executed ticks are atomically added to *tick_counter, so the embedder may access it from
+    /// other threads. Execution stops soon after *tick_counter reaches *tick_deadline. Both are
+    /// only read when Jit::Run is called and wherever the JIT would otherwise have called
+    /// GetTicksRemaining; in between, a Jit counts down the ticks it had left at that point.
+    /// Each Jit should therefore have its own counter: with a counter shared by N Jits, each of
+    /// them runs until it alone has executed up to the remaining ticks, overshooting the deadline
+    /// by up to N times. Use Jit::HaltExecution to stop sooner.
+    std::uint64_t* tick_counter = nullptr;
+    const std::uint64_t* tick_deadline = nullptr;
+
+    /// Determines whether AddTicks and GetTicksRemaining are called.
+    /// If false, execution will continue until soon after Jit::HaltExecution is called.
+    /// Blocks then no longer count cycles, and tick_counter and tick_deadline are ignored.
+    bool enable_ticks = true;
 };
 
 } // namespace A64
@@ -6,6 +6,7 @@
 
 #pragma once
 
+#include <array>
 #include <atomic>
 #include <cstddef>
 #include <cstdint>
@@ -41,7 +42,7 @@ public:
 
         op();
 
-        Unlock();
+        Unlock(address);
         return true;
     }
 
@@ -51,13 +52,30 @@ public:
 private:
     bool CheckAndClear(size_t processor_id, VAddr address, size_t size);
 
-    void Lock();
-    void Unlock();
+    void Lock(VAddr address);
+    void Unlock(VAddr address);
 
     static constexpr VAddr RESERVATION_GRANULE_MASK = 0xFFFF'FFFF'FFFF'FFF0ull;
     static constexpr VAddr INVALID_EXCLUSIVE_ADDRESS = 0xDEAD'DEAD'DEAD'DEADull;
-    std::atomic_flag is_locked;
-    std::vector<VAddr> exclusive_addresses;
+    static constexpr size_t CACHE_LINE_SIZE = 64;
+    static constexpr size_t SHARD_COUNT_BITS = 6;
+
+    /// Each processor's reservation lives on its own cache line so that marking
+    /// an address does not invalidate the lines of other processors.
+    struct alignas(CACHE_LINE_SIZE) Reservation {
+        std::atomic<VAddr> address{INVALID_EXCLUSIVE_ADDRESS};
+    };
+
+    /// Exclusive operations only serialize against others whose reservation
+    /// granule hashes to the same shard.
+    struct alignas(CACHE_LINE_SIZE) Shard {
+        std::atomic_flag is_locked = ATOMIC_FLAG_INIT;
+    };
+
+    static size_t ShardIndex(VAddr address);
+
+    std::array<Shard, size_t{1} << SHARD_COUNT_BITS> shards;
+    std::vector<Reservation> reservations;
 };
 
 } // namespace A64
@@ -0,0 +1,91 @@
+/* This file is part of the dynarmic project.
+ * Copyright (c) 2020 MerryMage
+ * This software may be used and distributed according to the terms of the GNU
+ * General Public License version 2 or any later version.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace Dynarmic {
+namespace A64 {
+
+using VAddr = std::uint64_t;
+
+class Jit;
+
+/**
+ * A cache of translated and optimized guest code that may be shared between multiple Jit
+ * instances, which may be running on different host threads. A Jit that misses in its own
+ * code cache will reuse a translation made by any other Jit sharing this cache, and only
+ * needs to emit host code for it.
+ *
+ * All Jits sharing a TranslationCache must see the same guest code and must have the same
+ * translation-related configuration (callbacks->MemoryReadCode, define_unpredictable_behaviour,
+ * hook_data_cache_operations, dczid_el0 and hook_hint_instructions). Memory access configuration
+ * such as page_table, fastmem_pointer and detect_misaligned_access_via_page_table may differ, as
+ * it is only applied when a Jit emits host code for a translation. Likewise, reads from memory
+ * reported by callbacks->IsReadOnlyMemory are only folded into the code a Jit emits, so guest
+ * data is never part of a cached translation.
+ *
+ * Each Jit still owns the host code it emits. Invalidating guest code through one Jit does not
+ * invalidate it in the others; see InvalidateCacheRange.
+ *
+ * The contents of the cache can be saved to a file and loaded again in a later session to
+ * avoid retranslating guest code at startup.
+ */
+class TranslationCache final {
+public:
+    TranslationCache();
+    ~TranslationCache();
+
+    TranslationCache(const TranslationCache&) = delete;
+    TranslationCache& operator=(const TranslationCache&) = delete;
+
+    /// Invalidates translations of guest code in the range [start_address, start_address + length),
+    /// so that no Jit reuses them. Jit::InvalidateCacheRange on any Jit sharing this cache also does this.
+    /// Host code already emitted by the Jits sharing this cache is not affected: when guest code changes,
+    /// Jit::InvalidateCacheRange must be called on every one of them.
+    void InvalidateCacheRange(VAddr start_address, std::size_t length);
+
+    /// Discards all translations. Jit::ClearCache does not do this.
+    void ClearCache();
+
+    /// Writes all translations to the file at path, replacing its contents.
+    /// @returns false if the file could not be written.
+    bool SaveToFile(const std::string& path) const;
+
+    /// Adds the translations saved in the file at path to this cache.
+    /// A loaded translation is only used once the guest code it was translated from has been
+    /// read through MemoryReadCode and found to be unchanged; otherwise it is discarded.
+    /// The file must have been saved by the same version of dynarmic, and the Jits that use the
+    /// loaded translations must have the same translation-related configuration as the ones
+    /// that made them.
+    /// @returns false if the file could not be read or is invalid. The cache is unchanged in that case.
+    bool LoadFromFile(const std::string& path);
+
+    struct Statistics {
+        /// Lookups by a Jit that found a usable translation.
+        std::uint64_t hits = 0;
+        /// Lookups by a Jit that found no translation.
+        std::uint64_t misses = 0;
+        /// Translations loaded from a file that were discarded because their guest code had changed.
+        std::uint64_t discarded = 0;
+    };
+
+    /// Returns lookup statistics since this cache was created.
+    Statistics GetStatistics() const;
+
+private:
+    friend class Jit;
+
+    struct Impl;
+    std::unique_ptr<Impl> impl;
+};
+
+} // namespace A64
+} // namespace Dynarmic
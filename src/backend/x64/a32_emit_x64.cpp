@@ -68,10 +68,13 @@ FP::FPCR A32EmitContext::FPCR() const {
 
 A32EmitX64::A32EmitX64(BlockOfCode& code, A32::UserConfig config, A32::Jit* jit_interface)
         : EmitX64(code), config(std::move(config)), jit_interface(jit_interface) {
+    if (this->config.enable_fast_dispatch) {
+        InitializeFastDispatchTable(this->config.fast_dispatch_table_size, this->config.fast_dispatch_table_ways, this->config.fast_dispatch_statistics);
+    }
+
     GenFastmemFallbacks();
     GenTerminalHandlers();
     code.PreludeComplete();
-    ClearFastDispatchTable();
 
     exception_handler.SetFastmemCallback([this](u64 rip_){
         return FastmemCallback(rip_);
@@ -161,10 +164,20 @@ void A32EmitX64::InvalidateCacheRanges(const boost::icl::interval_set<u32>& rang
     ClearFastDispatchTable();
 }
 
-void A32EmitX64::ClearFastDispatchTable() {
-    if (config.enable_fast_dispatch) {
-        fast_dispatch_table.fill({0xFFFFFFFFFFFFFFFFull, nullptr});
+std::vector<IR::LocationDescriptor> A32EmitX64::EvictCodeRegion(size_t region) {
+    auto evicted = EmitX64::EvictCodeRegion(region);
+    block_ranges.RemoveBlocks(evicted);
+    ClearFastDispatchTable();
+
+    for (auto iter = fastmem_patch_info.begin(); iter != fastmem_patch_info.end();) {
+        if (code.IsInRegion(Common::BitCast<CodePtr>(iter->first), region)) {
+            iter = fastmem_patch_info.erase(iter);
+        } else {
+            ++iter;
+        }
     }
+
+    return evicted;
 }
 
 void A32EmitX64::GenFastmemFallbacks() {
@@ -239,7 +252,7 @@ void A32EmitX64::GenTerminalHandlers() {
         code.or_(rbx, rcx);
     };
 
-    Xbyak::Label fast_dispatch_cache_miss, rsb_cache_miss;
+    Xbyak::Label fast_dispatch_cache_hit, rsb_cache_miss;
 
     code.align();
     terminal_handler_pop_rsb_hint = code.getCurr<const void*>();
@@ -263,19 +276,10 @@ void A32EmitX64::GenTerminalHandlers() {
         terminal_handler_fast_dispatch_hint = code.getCurr<const void*>();
         calculate_location_descriptor();
         code.L(rsb_cache_miss);
-        code.mov(r12, reinterpret_cast<u64>(fast_dispatch_table.data()));
-        if (code.DoesCpuSupport(Xbyak::util::Cpu::tSSE42)) {
-            code.crc32(ebp, r12d);
-        }
-        code.and_(ebp, fast_dispatch_table_mask);
-        code.lea(rbp, ptr[r12 + rbp]);
-        code.cmp(rbx, qword[rbp + offsetof(FastDispatchEntry, location_descriptor)]);
-        code.jne(fast_dispatch_cache_miss);
-        code.jmp(ptr[rbp + offsetof(FastDispatchEntry, code_ptr)]);
-        code.L(fast_dispatch_cache_miss);
-        code.mov(qword[rbp + offsetof(FastDispatchEntry, location_descriptor)], rbx);
+        EmitFastDispatchTableLookup(fast_dispatch_cache_hit);
         code.LookupBlock();
-        code.mov(ptr[rbp + offsetof(FastDispatchEntry, code_ptr)], rax);
+        EmitFastDispatchTableInsert();
+        code.L(fast_dispatch_cache_hit);
         code.jmp(rax);
         PerfMapRegister(terminal_handler_fast_dispatch_hint, code.getCurr(), "a32_terminal_handler_fast_dispatch_hint");
     }
@@ -704,16 +708,12 @@ void A32EmitX64::EmitA32CallSupervisor(A32EmitContext& ctx, IR::Inst* inst) {
     ctx.reg_alloc.HostCall(nullptr);
 
     code.SwitchMxcsrOnExit();
-    code.mov(code.ABI_PARAM2, qword[r15 + offsetof(A32JitState, cycles_to_run)]);
-    code.sub(code.ABI_PARAM2, qword[r15 + offsetof(A32JitState, cycles_remaining)]);
-    Devirtualize<&A32::UserCallbacks::AddTicks>(config.callbacks).EmitCall(code);
+    code.AddTicks();
     ctx.reg_alloc.EndOfAllocScope();
     auto args = ctx.reg_alloc.GetArgumentInfo(inst);
     ctx.reg_alloc.HostCall(nullptr, {}, args[0]);
     Devirtualize<&A32::UserCallbacks::CallSVC>(config.callbacks).EmitCall(code);
-    Devirtualize<&A32::UserCallbacks::GetTicksRemaining>(config.callbacks).EmitCall(code);
-    code.mov(qword[r15 + offsetof(A32JitState, cycles_to_run)], code.ABI_RETURN);
-    code.mov(qword[r15 + offsetof(A32JitState, cycles_remaining)], code.ABI_RETURN);
+    code.GetTicksRemaining();
     code.SwitchMxcsrOnEntry();
 }
 
@@ -1415,10 +1415,16 @@ void A32EmitX64::EmitSetUpperLocationDescriptor(IR::LocationDescriptor new_locat
 void A32EmitX64::EmitTerminalImpl(IR::Term::LinkBlock terminal, IR::LocationDescriptor initial_location) {
     EmitSetUpperLocationDescriptor(terminal.next, initial_location);
 
-    code.cmp(qword[r15 + offsetof(A32JitState, cycles_remaining)], 0);
+    // Without ticks, links are only broken by a halt request. EmitPatchJg emits the matching jump.
+    if (config.enable_ticks) {
+        code.cmp(qword[r15 + offsetof(A32JitState, cycles_remaining)], 0);
+    } else {
+        code.cmp(code.byte[r15 + offsetof(A32JitState, halt_requested)], u8(0));
+    }
 
     patch_information[terminal.next].jg.emplace_back(code.getCurr());
     if (const auto next_bb = GetBasicBlock(terminal.next)) {
+        code.MarkRegionAccessed(next_bb->entrypoint);
         EmitPatchJg(terminal.next, next_bb->entrypoint);
     } else {
         EmitPatchJg(terminal.next);
@@ -1440,6 +1446,7 @@ void A32EmitX64::EmitTerminalImpl(IR::Term::LinkBlockFast terminal, IR::Location
 
     patch_information[terminal.next].jmp.emplace_back(code.getCurr());
     if (const auto next_bb = GetBasicBlock(terminal.next)) {
+        code.MarkRegionAccessed(next_bb->entrypoint);
         EmitPatchJmp(terminal.next, next_bb->entrypoint);
     } else {
         EmitPatchJmp(terminal.next);
@@ -1482,11 +1489,18 @@ void A32EmitX64::EmitTerminalImpl(IR::Term::CheckHalt terminal, IR::LocationDesc
 
 void A32EmitX64::EmitPatchJg(const IR::LocationDescriptor& target_desc, CodePtr target_code_ptr) {
     const CodePtr patch_location = code.getCurr();
+    const auto jcc = [this](const void* target) {
+        if (config.enable_ticks) {
+            code.jg(target);
+        } else {
+            code.je(target);
+        }
+    };
     if (target_code_ptr) {
-        code.jg(target_code_ptr);
+        jcc(target_code_ptr);
     } else {
         code.mov(MJitStateReg(A32::Reg::PC), A32::LocationDescriptor{target_desc}.PC());
-        code.jg(code.GetReturnFromRunCodeAddress());
+        jcc(code.GetReturnFromRunCodeAddress());
     }
     code.EnsurePatchLocationSize(patch_location, 14);
 }
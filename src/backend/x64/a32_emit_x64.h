@@ -44,6 +44,8 @@ public:
 
     void ClearCache() override;
 
+    std::vector<IR::LocationDescriptor> EvictCodeRegion(size_t region) override;
+
     void InvalidateCacheRanges(const boost::icl::interval_set<u32>& ranges);
 
 protected:
@@ -51,16 +53,6 @@ protected:
     A32::Jit* jit_interface;
     BlockRangeInformation<u32> block_ranges;
 
-    struct FastDispatchEntry {
-        u64 location_descriptor;
-        const void* code_ptr;
-    };
-    static_assert(sizeof(FastDispatchEntry) == 0x10);
-    static constexpr u64 fast_dispatch_table_mask = 0xFFFF0;
-    static constexpr size_t fast_dispatch_table_size = 0x10000;
-    std::array<FastDispatchEntry, fast_dispatch_table_size> fast_dispatch_table;
-    void ClearFastDispatchTable();
-
     std::map<std::tuple<size_t, int, int>, void(*)()> read_fallbacks;
     std::map<std::tuple<size_t, int, int>, void(*)()> write_fallbacks;
     void GenFastmemFallbacks();
@@ -4,6 +4,7 @@
  * General Public License version 2 or any later version.
  */
 
+#include <algorithm>
 #include <functional>
 #include <memory>
 
@@ -33,11 +34,36 @@ namespace Dynarmic::A32 {
 
 using namespace Backend::X64;
 
-static RunCodeCallbacks GenRunCodeCallbacks(A32::UserCallbacks* cb, CodePtr (*LookupBlock)(void* lookup_block_arg), void* arg) {
+static RunCodeCallbacks GenRunCodeCallbacks(const A32::UserConfig& config, CodePtr (*LookupBlock)(void* lookup_block_arg), void* arg) {
     return RunCodeCallbacks{
         std::make_unique<ArgCallback>(LookupBlock, reinterpret_cast<u64>(arg)),
-        std::make_unique<ArgCallback>(Devirtualize<&A32::UserCallbacks::AddTicks>(cb)),
-        std::make_unique<ArgCallback>(Devirtualize<&A32::UserCallbacks::GetTicksRemaining>(cb)),
+        std::make_unique<ArgCallback>(Devirtualize<&A32::UserCallbacks::AddTicks>(config.callbacks)),
+        std::make_unique<ArgCallback>(Devirtualize<&A32::UserCallbacks::GetTicksRemaining>(config.callbacks)),
+        config.tick_counter,
+        config.tick_deadline,
+        config.enable_ticks,
+    };
+}
+
+static LocationDescriptorCalculator GenLDC() {
+    return [](BlockOfCode& code, Xbyak::Reg64 result, Xbyak::Reg64 scratch) {
+        // This calculation has to match up with A32JitState::GetUniqueHash
+        code.mov(result.cvt32(), code.dword[code.r15 + offsetof(A32JitState, upper_location_descriptor)]);
+        code.shl(result, 32);
+        code.mov(scratch.cvt32(), code.dword[code.r15 + offsetof(A32JitState, Reg) + sizeof(u32) * 15]);
+        code.or_(result, scratch);
+    };
+}
+
+static CodeCacheConfig GenCodeCacheConfig(const A32::UserConfig& config) {
+    return CodeCacheConfig{
+        config.code_cache_size,
+        config.far_code_offset,
+        config.constant_pool_size,
+        std::max(config.code_cache_size, config.code_cache_max_size),
+        config.code_cache_regions,
+        config.code_cache_huge_pages,
+        0,
     };
 }
 
@@ -54,7 +80,7 @@ static std::function<void(BlockOfCode&)> GenRCP(const A32::UserConfig& config) {
 
 struct Jit::Impl {
     Impl(Jit* jit, A32::UserConfig config)
-            : block_of_code(GenRunCodeCallbacks(config.callbacks, &GetCurrentBlockThunk, this), JitStateInfo{jit_state}, GenRCP(config))
+            : block_of_code(GenRunCodeCallbacks(config, &GetCurrentBlockThunk, this), JitStateInfo{jit_state}, GenLDC(), GenCodeCacheConfig(config), GenRCP(config))
             , emitter(block_of_code, config, jit)
             , config(std::move(config))
             , jit_interface(jit)
@@ -150,13 +176,26 @@ private:
 
     A32EmitX64::BlockDescriptor GetBasicBlock(IR::LocationDescriptor descriptor) {
         auto block = emitter.GetBasicBlock(descriptor);
-        if (block)
+        if (block) {
+            block_of_code.MarkRegionAccessed(block->entrypoint);
             return *block;
+        }
+
+        // Eviction and emission each modify code; change permissions only once for both.
+        block_of_code.EnableWriting();
+        SCOPE_EXIT { block_of_code.DisableWriting(); };
 
         constexpr size_t MINIMUM_REMAINING_CODESIZE = 1 * 1024 * 1024;
-        if (block_of_code.SpaceRemaining() < MINIMUM_REMAINING_CODESIZE) {
-            invalidate_entire_cache = true;
-            PerformCacheInvalidation();
+        if (block_of_code.SpaceRemaining() < MINIMUM_REMAINING_CODESIZE && !block_of_code.Grow()) {
+            if (block_of_code.RegionCount() == 1) {
+                invalidate_entire_cache = true;
+                PerformCacheInvalidation();
+            } else {
+                // Reuse a region whose code is least likely to be needed
+                jit_state.ResetRSB();
+                emitter.EvictCodeRegion(block_of_code.AdvanceRegion());
+                invalid_cache_generation++;
+            }
         }
 
         IR::Block ir_block = A32::Translate(A32::LocationDescriptor{descriptor}, [this](u32 vaddr) { return config.callbacks->MemoryReadCode(vaddr); }, {config.define_unpredictable_behaviour, config.hook_hint_instructions});
@@ -309,6 +348,23 @@ void Jit::LoadContext(const Context& ctx) {
     impl->jit_state.TransferJitState(ctx.impl->jit_state, reset_rsb);
 }
 
+Jit::FastDispatchStatistics Jit::GetFastDispatchStatistics() const {
+    const auto statistics = impl->emitter.GetFastDispatchStatistics();
+    return {statistics.hits, statistics.misses};
+}
+
+Jit::CodeCachePageBacking Jit::GetCodeCachePageBacking() const {
+    switch (impl->block_of_code.GetPageBacking()) {
+    case PageBacking::Normal:
+        return Jit::CodeCachePageBacking::Normal;
+    case PageBacking::TransparentHugePages:
+        return Jit::CodeCachePageBacking::TransparentHugePages;
+    case PageBacking::HugePages:
+        return Jit::CodeCachePageBacking::HugePages;
+    }
+    UNREACHABLE();
+}
+
 std::string Jit::Disassemble(const IR::LocationDescriptor& descriptor) {
     return impl->Disassemble(descriptor);
 }
@@ -4,7 +4,12 @@
  * General Public License version 2 or any later version.
  */
 
+#include <algorithm>
+#include <array>
 #include <initializer_list>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
 #include <dynarmic/A64/exclusive_monitor.h>
 #include <fmt/format.h>
@@ -19,8 +24,10 @@
 #include "backend/x64/perf_map.h"
 #include "common/assert.h"
 #include "common/bit_util.h"
+#include "common/cast_util.h"
 #include "common/common_types.h"
 #include "common/scope_exit.h"
+#include "common/variant_util.h"
 #include "frontend/A64/location_descriptor.h"
 #include "frontend/A64/types.h"
 #include "frontend/ir/basic_block.h"
@@ -51,26 +58,70 @@ bool A64EmitContext::AccurateNaN() const {
 
 A64EmitX64::A64EmitX64(BlockOfCode& code, A64::UserConfig conf, A64::Jit* jit_interface)
         : EmitX64(code), conf(conf), jit_interface{jit_interface} {
+    gpr_order = any_gpr;
+    if (conf.fastmem_pointer) {
+        gpr_order.erase(std::find(gpr_order.begin(), gpr_order.end(), HostLoc::R13));
+    }
+
+    if (conf.enable_fast_dispatch) {
+        InitializeFastDispatchTable(conf.fast_dispatch_table_size, conf.fast_dispatch_table_ways, conf.fast_dispatch_statistics);
+    }
+
+    if (conf.detect_self_modifying_code) {
+        const size_t address_space_bits = conf.fastmem_pointer ? conf.fastmem_address_space_bits : conf.page_table_address_space_bits;
+        code_page_address_space_bits = std::min<size_t>(address_space_bits, max_code_page_address_space_bits);
+        code_pages_aliased = address_space_bits > code_page_address_space_bits;
+        code_page_leaf_bits = std::min<size_t>(code_page_address_space_bits - 12, max_code_page_leaf_bits);
+        code_page_directory.resize(size_t(1) << (code_page_address_space_bits - 12 - code_page_leaf_bits), nullptr);
+    }
+
     GenMemory128Accessors();
     GenFastmemFallbacks();
+    GenInterpretSingleInstruction();
     GenTerminalHandlers();
     code.PreludeComplete();
-    ClearFastDispatchTable();
+
+    exception_handler.SetFastmemCallback([this](u64 rip_){
+        return FastmemCallback(rip_);
+    });
 }
 
 A64EmitX64::~A64EmitX64() = default;
 
-A64EmitX64::BlockDescriptor A64EmitX64::Emit(IR::Block& block) {
+A64EmitX64::BlockDescriptor A64EmitX64::Emit(IR::Block& block, bool count_executions) {
     code.EnableWriting();
     SCOPE_EXIT { code.DisableWriting(); };
 
     code.align();
     const u8* const entrypoint = code.getCurr();
+    // A block that may store to its own code can be invalidated while it runs, so its back-edge must remain patchable.
+    const bool may_write_own_code = conf.detect_self_modifying_code
+                                 && std::any_of(block.begin(), block.end(), [](const IR::Inst& inst) { return inst.IsMemoryWrite(); });
+    current_block_entrypoint = may_write_own_code ? nullptr : entrypoint;
+    SCOPE_EXIT { current_block_entrypoint = nullptr; };
 
     // Start emitting.
+    if (count_executions) {
+        EmitExecutionCounter(block.Location());
+    }
+    if (conf.hot_code_size > 0) {
+        EmitBlockProfiler(block.Location());
+    }
     EmitCondPrelude(block);
 
-    RegAlloc reg_alloc{code, A64JitState::SpillCount, SpillToOpArg<A64JitState>, any_gpr, any_xmm};
+    current_loop = PlanLoopRegion(block, count_executions);
+    SCOPE_EXIT { current_loop = std::nullopt; };
+
+    std::vector<HostLoc> block_gpr_order = gpr_order;
+    if (current_loop) {
+        for (const auto& [guest_reg, host_loc] : current_loop->cached_registers) {
+            block_gpr_order.erase(std::find(block_gpr_order.begin(), block_gpr_order.end(), host_loc));
+            code.mov(HostLocToReg64(host_loc), qword[r15 + offsetof(A64JitState, reg) + sizeof(u64) * static_cast<size_t>(guest_reg)]);
+        }
+        current_loop->head = code.getCurr();
+    }
+
+    RegAlloc reg_alloc{code, A64JitState::SpillCount, SpillToOpArg<A64JitState>, block_gpr_order, any_xmm};
     A64EmitContext ctx{conf, reg_alloc, block};
 
     for (auto iter = block.begin(); iter != block.end(); ++iter) {
@@ -114,24 +165,278 @@ A64EmitX64::BlockDescriptor A64EmitX64::Emit(IR::Block& block) {
 
     const auto range = boost::icl::discrete_interval<u64>::closed(descriptor.PC(), end_location.PC() - 1);
     block_ranges.AddRange(range, descriptor);
+    WatchCodePages(range);
+    for (const auto& [start, end] : block.AdditionalCodeRanges()) {
+        const auto additional_range = boost::icl::discrete_interval<u64>::closed(A64::LocationDescriptor{start}.PC(), A64::LocationDescriptor{end}.PC() - 1);
+        block_ranges.AddRange(additional_range, descriptor);
+        WatchCodePages(additional_range);
+    }
+
+    if (count_executions) {
+        execution_counters[descriptor].entrypoint = entrypoint;
+    } else {
+        ReplaceCountingBlock(descriptor, entrypoint);
+    }
 
     return RegisterBlock(descriptor, entrypoint, size);
 }
 
+bool A64EmitX64::ExecutionCountExceeded(IR::LocationDescriptor location) const {
+    const auto iter = execution_counters.find(location);
+    return iter != execution_counters.end() && *iter->second.remaining <= 0;
+}
+
+namespace {
+
+bool LinksTo(const IR::Terminal& terminal, IR::LocationDescriptor location) {
+    return Common::VisitVariant<bool>(terminal, [&](const auto& x) {
+        using T = std::decay_t<decltype(x)>;
+        if constexpr (std::is_same_v<T, IR::Term::LinkBlock>) {
+            return x.next == location;
+        } else if constexpr (std::is_same_v<T, IR::Term::If> || std::is_same_v<T, IR::Term::CheckBit>) {
+            return LinksTo(x.then_, location) || LinksTo(x.else_, location);
+        } else if constexpr (std::is_same_v<T, IR::Term::CheckHalt>) {
+            return LinksTo(x.else_, location);
+        } else {
+            return false;
+        }
+    });
+}
+
+} // anonymous namespace
+
+std::optional<A64EmitX64::LoopRegion> A64EmitX64::PlanLoopRegion(const IR::Block& block, bool count_executions) const {
+    // Blocks still being profiled are left unoptimized, and must count every execution.
+    if (conf.loop_cached_registers == 0 || count_executions || block.GetCondition() != IR::Cond::AL) {
+        return std::nullopt;
+    }
+    if (!LinksTo(block.GetTerminal(), block.Location())) {
+        return std::nullopt;
+    }
+
+    std::array<size_t, 31> uses{};
+    for (const auto& inst : block) {
+        // A store to the loop's own code must be noticed at the back-edge, which is not checked.
+        if (conf.detect_self_modifying_code && inst.IsMemoryWrite()) {
+            return std::nullopt;
+        }
+
+        switch (inst.GetOpcode()) {
+        case IR::Opcode::A64GetW:
+        case IR::Opcode::A64GetX:
+        case IR::Opcode::A64SetW:
+        case IR::Opcode::A64SetX: {
+            const size_t index = static_cast<size_t>(inst.GetArg(0).GetA64RegRef());
+            if (index < uses.size()) {
+                uses[index]++;
+            }
+            break;
+        }
+        case IR::Opcode::A64CallSupervisor:
+        case IR::Opcode::A64ExceptionRaised:
+        case IR::Opcode::A64DataCacheOperationRaised:
+        case IR::Opcode::A64ExclusiveWriteMemory8:
+        case IR::Opcode::A64ExclusiveWriteMemory16:
+        case IR::Opcode::A64ExclusiveWriteMemory32:
+        case IR::Opcode::A64ExclusiveWriteMemory64:
+        case IR::Opcode::A64ExclusiveWriteMemory128:
+            // These call back into the embedder, which may inspect guest registers.
+            return std::nullopt;
+        default:
+            break;
+        }
+    }
+
+    std::vector<A64::Reg> candidates;
+    for (size_t i = 0; i < uses.size(); i++) {
+        if (uses[i] > 0) {
+            candidates.emplace_back(static_cast<A64::Reg>(i));
+        }
+    }
+    std::stable_sort(candidates.begin(), candidates.end(), [&](A64::Reg a, A64::Reg b) {
+        return uses[static_cast<size_t>(a)] > uses[static_cast<size_t>(b)];
+    });
+
+    // Callee-save registers are preserved by every host call made from within the block.
+    LoopRegion loop;
+    for (const HostLoc host_loc : ABI_ALL_CALLEE_SAVE) {
+        if (loop.cached_registers.size() == std::min(candidates.size(), conf.loop_cached_registers)) {
+            break;
+        }
+        if (!HostLocIsGPR(host_loc) || std::find(gpr_order.begin(), gpr_order.end(), host_loc) == gpr_order.end()) {
+            continue;
+        }
+        loop.cached_registers.emplace_back(candidates[loop.cached_registers.size()], host_loc);
+    }
+    return loop;
+}
+
+std::optional<Xbyak::Reg64> A64EmitX64::LoopCachedRegister(A64::Reg reg) const {
+    if (!current_loop) {
+        return std::nullopt;
+    }
+    for (const auto& [guest_reg, host_loc] : current_loop->cached_registers) {
+        if (guest_reg == reg) {
+            return HostLocToReg64(host_loc);
+        }
+    }
+    return std::nullopt;
+}
+
+void A64EmitX64::EmitLoopWriteback() {
+    if (!current_loop) {
+        return;
+    }
+    for (const auto& [guest_reg, host_loc] : current_loop->cached_registers) {
+        code.mov(qword[r15 + offsetof(A64JitState, reg) + sizeof(u64) * static_cast<size_t>(guest_reg)], HostLocToReg64(host_loc));
+    }
+}
+
+void A64EmitX64::EmitExecutionCounter(IR::LocationDescriptor location) {
+    auto& counter = execution_counters[location];
+    if (!counter.remaining) {
+        counter.remaining = std::make_unique<s64>();
+    }
+    *counter.remaining = static_cast<s64>(conf.tiered_compilation_threshold);
+
+    Xbyak::Label threshold_reached;
+
+    code.mov(rax, reinterpret_cast<u64>(counter.remaining.get()));
+    code.sub(qword[rax], 1);
+    code.jle(threshold_reached, code.T_NEAR);
+
+    code.SwitchToFarCode();
+    code.L(threshold_reached);
+    code.mov(rax, A64::LocationDescriptor{location}.PC());
+    code.mov(qword[r15 + offsetof(A64JitState, pc)], rax);
+    // The block lookup table would find this block again, so the lookup must be performed by Jit::Impl
+    // for the block to be recompiled. Recompiling may evict this code, so it is done from the dispatcher.
+    code.ReturnFromRunCodeToLookupCallback();
+    code.SwitchToNearCode();
+}
+
+void A64EmitX64::ReplaceCountingBlock(IR::LocationDescriptor location, CodePtr new_entrypoint) {
+    const auto iter = execution_counters.find(location);
+    if (iter == execution_counters.end()) {
+        return;
+    }
+
+    // Stale references to the old code may remain in the fast dispatch table and the RSB.
+    // Redirect them to the new code. The old code no longer touches its counter after this.
+    const CodePtr save_code_ptr = code.getCurr();
+    code.SetCodePtr(iter->second.entrypoint);
+    code.jmp(new_entrypoint, code.T_NEAR);
+    code.SetCodePtr(save_code_ptr);
+
+    execution_counters.erase(iter);
+}
+
+void A64EmitX64::EmitBlockProfiler(IR::LocationDescriptor location) {
+    auto& count = block_execution_counts[location];
+    if (!count) {
+        count = std::make_unique<u64>(0);
+    }
+
+    code.mov(rax, reinterpret_cast<u64>(count.get()));
+    code.inc(qword[rax]);
+}
+
+void A64EmitX64::OptimizeCodeLayout(const std::function<IR::Block(IR::LocationDescriptor)>& translate) {
+    const auto hot_region = code.HotRegion();
+    if (!hot_region) {
+        return;
+    }
+
+    code.EnableWriting();
+    SCOPE_EXIT { code.DisableWriting(); };
+
+    // Blocks are only chosen if they are still present, so this must happen before the hot region is evicted.
+    std::vector<std::pair<u64, IR::LocationDescriptor>> hot_blocks;
+    for (auto& [location, count] : block_execution_counts) {
+        if (*count > 0 && !A64::LocationDescriptor{location}.SingleStepping() && GetBasicBlock(location)) {
+            hot_blocks.emplace_back(*count, location);
+        }
+        *count = 0;
+    }
+    std::stable_sort(hot_blocks.begin(), hot_blocks.end(), [](const auto& a, const auto& b) { return a.first > b.first; });
+
+    EvictCodeRegion(*hot_region);
+    code.EnterHotRegion();
+    SCOPE_EXIT { code.LeaveHotRegion(); };
+
+    constexpr size_t MINIMUM_REMAINING_CODESIZE = 1 * 1024 * 1024;
+    for (const auto& [count, location] : hot_blocks) {
+        if (code.SpaceRemaining() < MINIMUM_REMAINING_CODESIZE) {
+            break;
+        }
+
+        // Unlinks the old code, if it was not in the hot region. Registering the new code relinks it.
+        InvalidateBasicBlocks({location});
+        IR::Block block = translate(location);
+        Emit(block);
+    }
+
+    // Stale entries would still lead to the old code.
+    ClearFastDispatchTable();
+    ClearInlineCaches();
+}
+
 void A64EmitX64::ClearCache() {
     EmitX64::ClearCache();
     block_ranges.ClearCache();
     ClearFastDispatchTable();
+    inline_caches.clear();
+    fastmem_patch_info.clear();
+    execution_counters.clear();
+    block_execution_counts.clear();
+    std::fill(code_page_directory.begin(), code_page_directory.end(), nullptr);
+    code_page_leaves.clear();
 }
 
 void A64EmitX64::InvalidateCacheRanges(const boost::icl::interval_set<u64>& ranges) {
-    InvalidateBasicBlocks(block_ranges.InvalidateRanges(ranges));
+    const auto locations = block_ranges.InvalidateRanges(ranges);
+    UnwatchCodePages(ranges);
+    if (locations.empty()) {
+        return;
+    }
+
+    InvalidateBasicBlocks(locations);
     ClearFastDispatchTable();
+    ClearInlineCaches();
 }
 
-void A64EmitX64::ClearFastDispatchTable() {
-    if (conf.enable_fast_dispatch) {
-        fast_dispatch_table.fill({0xFFFFFFFFFFFFFFFFull, nullptr});
+std::vector<IR::LocationDescriptor> A64EmitX64::EvictCodeRegion(size_t region) {
+    auto evicted = EmitX64::EvictCodeRegion(region);
+    UnwatchCodePages(block_ranges.RemoveBlocks(evicted));
+    ClearFastDispatchTable();
+
+    for (auto iter = fastmem_patch_info.begin(); iter != fastmem_patch_info.end();) {
+        if (code.IsInRegion(Common::BitCast<CodePtr>(iter->first), region)) {
+            iter = fastmem_patch_info.erase(iter);
+        } else {
+            ++iter;
+        }
+    }
+
+    for (auto iter = execution_counters.begin(); iter != execution_counters.end();) {
+        if (code.IsInRegion(iter->second.entrypoint, region)) {
+            iter = execution_counters.erase(iter);
+        } else {
+            ++iter;
+        }
+    }
+
+    inline_caches.erase(std::remove_if(inline_caches.begin(), inline_caches.end(),
+                                       [&](const InlineCache& cache) { return code.IsInRegion(cache.code_ptr, region); }),
+                        inline_caches.end());
+    ClearInlineCaches();
+
+    return evicted;
+}
+
+void A64EmitX64::ClearInlineCaches() {
+    for (auto& cache : inline_caches) {
+        std::fill_n(cache.entries.get(), conf.inline_cache_entries, FastDispatchEntry{0xFFFFFFFFFFFFFFFFull, nullptr});
     }
 }
 
@@ -285,21 +590,23 @@ void A64EmitX64::GenFastmemFallbacks() {
     }
 }
 
+// PC ends up in rbp, location_descriptor ends up in rbx
+void A64EmitX64::EmitCalculateLocationDescriptor() {
+    // This calculation has to match up with A64::LocationDescriptor::UniqueHash
+    // TODO: Optimization is available here based on known state of fpcr.
+    code.mov(rbp, qword[r15 + offsetof(A64JitState, pc)]);
+    code.mov(rcx, A64::LocationDescriptor::pc_mask);
+    code.and_(rcx, rbp);
+    code.mov(ebx, dword[r15 + offsetof(A64JitState, fpcr)]);
+    code.and_(ebx, A64::LocationDescriptor::fpcr_mask);
+    code.shl(rbx, A64::LocationDescriptor::fpcr_shift);
+    code.or_(rbx, rcx);
+}
+
 void A64EmitX64::GenTerminalHandlers() {
-    // PC ends up in rbp, location_descriptor ends up in rbx
-    const auto calculate_location_descriptor = [this] {
-        // This calculation has to match up with A64::LocationDescriptor::UniqueHash
-        // TODO: Optimization is available here based on known state of fpcr.
-        code.mov(rbp, qword[r15 + offsetof(A64JitState, pc)]);
-        code.mov(rcx, A64::LocationDescriptor::pc_mask);
-        code.and_(rcx, rbp);
-        code.mov(ebx, dword[r15 + offsetof(A64JitState, fpcr)]);
-        code.and_(ebx, A64::LocationDescriptor::fpcr_mask);
-        code.shl(rbx, A64::LocationDescriptor::fpcr_shift);
-        code.or_(rbx, rcx);
-    };
+    const auto calculate_location_descriptor = [this] { EmitCalculateLocationDescriptor(); };
 
-    Xbyak::Label fast_dispatch_cache_miss, rsb_cache_miss;
+    Xbyak::Label fast_dispatch_cache_hit, fast_dispatch_cache_miss, rsb_cache_miss;
 
     code.align();
     terminal_handler_pop_rsb_hint = code.getCurr<const void*>();
@@ -323,22 +630,67 @@ void A64EmitX64::GenTerminalHandlers() {
         terminal_handler_fast_dispatch_hint = code.getCurr<const void*>();
         calculate_location_descriptor();
         code.L(rsb_cache_miss);
-        code.mov(r12, reinterpret_cast<u64>(fast_dispatch_table.data()));
-        if (code.DoesCpuSupport(Xbyak::util::Cpu::tSSE42)) {
-            code.crc32(rbp, r12d);
-        }
-        code.and_(ebp, fast_dispatch_table_mask);
-        code.lea(rbp, ptr[r12 + rbp]);
-        code.cmp(rbx, qword[rbp + offsetof(FastDispatchEntry, location_descriptor)]);
-        code.jne(fast_dispatch_cache_miss);
-        code.jmp(ptr[rbp + offsetof(FastDispatchEntry, code_ptr)]);
+        EmitFastDispatchTableLookup(fast_dispatch_cache_hit);
         code.L(fast_dispatch_cache_miss);
-        code.mov(qword[rbp + offsetof(FastDispatchEntry, location_descriptor)], rbx);
         code.LookupBlock();
-        code.mov(ptr[rbp + offsetof(FastDispatchEntry, code_ptr)], rax);
+        if (conf.background_compilation_threads > 0) {
+            // Don't cache the interpreter in place of a block that is still being compiled.
+            code.mov(rcx, reinterpret_cast<u64>(interpret_single_instruction));
+            code.cmp(rax, rcx);
+            code.je(interpret_single_instruction);
+        }
+        EmitFastDispatchTableInsert();
+        code.L(fast_dispatch_cache_hit);
         code.jmp(rax);
         PerfMapRegister(terminal_handler_fast_dispatch_hint, code.getCurr(), "a64_terminal_handler_fast_dispatch_hint");
     }
+
+    if (conf.enable_fast_dispatch && conf.inline_cache_entries > 0) {
+        // Location descriptor is in rbx, PC is in rbp, inline cache entries are in r14
+        Xbyak::Label inline_cache_insert;
+
+        code.align();
+        terminal_handler_inline_cache_miss = code.getCurr<const void*>();
+        EmitFastDispatchTableLookup(inline_cache_insert);
+        // Only hits in the fast dispatch table are inserted into the inline cache.
+        // LookupBlock may clear the cache, after which r14 would no longer be valid.
+        code.jmp(fast_dispatch_cache_miss, code.T_NEAR);
+        code.L(inline_cache_insert);
+        for (size_t i = conf.inline_cache_entries - 1; i > 0; i--) {
+            code.mov(rcx, qword[r14 + (i - 1) * sizeof(FastDispatchEntry) + offsetof(FastDispatchEntry, location_descriptor)]);
+            code.mov(rdx, qword[r14 + (i - 1) * sizeof(FastDispatchEntry) + offsetof(FastDispatchEntry, code_ptr)]);
+            code.mov(qword[r14 + i * sizeof(FastDispatchEntry) + offsetof(FastDispatchEntry, location_descriptor)], rcx);
+            code.mov(qword[r14 + i * sizeof(FastDispatchEntry) + offsetof(FastDispatchEntry, code_ptr)], rdx);
+        }
+        code.mov(qword[r14 + offsetof(FastDispatchEntry, location_descriptor)], rbx);
+        code.mov(qword[r14 + offsetof(FastDispatchEntry, code_ptr)], rax);
+        code.jmp(rax);
+        PerfMapRegister(terminal_handler_inline_cache_miss, code.getCurr(), "a64_terminal_handler_inline_cache_miss");
+    }
+}
+
+void A64EmitX64::GenInterpretSingleInstruction() {
+    if (conf.background_compilation_threads == 0) {
+        return;
+    }
+
+    Xbyak::Label halt_requested;
+
+    code.align();
+    interpret_single_instruction = code.getCurr<const void*>();
+    code.SwitchMxcsrOnExit();
+    Devirtualize<&A64::UserCallbacks::InterpreterFallback>(conf.callbacks).EmitCall(code,
+        [&](RegList param) {
+            code.mov(param[0], qword[r15 + offsetof(A64JitState, pc)]);
+            code.mov(param[1].cvt32(), 1);
+        });
+    code.sub(qword[r15 + offsetof(A64JitState, cycles_remaining)], 1);
+    code.cmp(code.byte[r15 + offsetof(A64JitState, halt_requested)], 0);
+    code.jne(halt_requested);
+    code.ReturnFromRunCode(true);
+    code.L(halt_requested);
+    code.ForceReturnFromRunCode(true);
+    PerfMapRegister(interpret_single_instruction, code.getCurr(), "a64_interpret_single_instruction");
 }
 
 void A64EmitX64::EmitA64SetCheckBit(A64EmitContext& ctx, IR::Inst* inst) {
@@ -384,7 +736,11 @@ void A64EmitX64::EmitA64GetW(A64EmitContext& ctx, IR::Inst* inst) {
     const A64::Reg reg = inst->GetArg(0).GetA64RegRef();
     const Xbyak::Reg32 result = ctx.reg_alloc.ScratchGpr().cvt32();
 
-    code.mov(result, dword[r15 + offsetof(A64JitState, reg) + sizeof(u64) * static_cast<size_t>(reg)]);
+    if (const auto cached = LoopCachedRegister(reg)) {
+        code.mov(result, cached->cvt32());
+    } else {
+        code.mov(result, dword[r15 + offsetof(A64JitState, reg) + sizeof(u64) * static_cast<size_t>(reg)]);
+    }
     ctx.reg_alloc.DefineValue(inst, result);
 }
 
@@ -392,7 +748,11 @@ void A64EmitX64::EmitA64GetX(A64EmitContext& ctx, IR::Inst* inst) {
     const A64::Reg reg = inst->GetArg(0).GetA64RegRef();
     const Xbyak::Reg64 result = ctx.reg_alloc.ScratchGpr();
 
-    code.mov(result, qword[r15 + offsetof(A64JitState, reg) + sizeof(u64) * static_cast<size_t>(reg)]);
+    if (const auto cached = LoopCachedRegister(reg)) {
+        code.mov(result, *cached);
+    } else {
+        code.mov(result, qword[r15 + offsetof(A64JitState, reg) + sizeof(u64) * static_cast<size_t>(reg)]);
+    }
     ctx.reg_alloc.DefineValue(inst, result);
 }
 
@@ -449,6 +809,15 @@ void A64EmitX64::EmitA64GetFPSR(A64EmitContext& ctx, IR::Inst* inst) {
 void A64EmitX64::EmitA64SetW(A64EmitContext& ctx, IR::Inst* inst) {
     auto args = ctx.reg_alloc.GetArgumentInfo(inst);
     const A64::Reg reg = inst->GetArg(0).GetA64RegRef();
+    if (const auto cached = LoopCachedRegister(reg)) {
+        // Writes to the 32-bit register zero the upper half.
+        if (args[1].IsImmediate()) {
+            code.mov(cached->cvt32(), static_cast<u32>(args[1].GetImmediateU64()));
+        } else {
+            code.mov(cached->cvt32(), ctx.reg_alloc.UseGpr(args[1]).cvt32());
+        }
+        return;
+    }
     const auto addr = qword[r15 + offsetof(A64JitState, reg) + sizeof(u64) * static_cast<size_t>(reg)];
     if (args[1].FitsInImmediateS32()) {
         code.mov(addr, args[1].GetImmediateS32());
@@ -463,6 +832,16 @@ void A64EmitX64::EmitA64SetW(A64EmitContext& ctx, IR::Inst* inst) {
 void A64EmitX64::EmitA64SetX(A64EmitContext& ctx, IR::Inst* inst) {
     auto args = ctx.reg_alloc.GetArgumentInfo(inst);
     const A64::Reg reg = inst->GetArg(0).GetA64RegRef();
+    if (const auto cached = LoopCachedRegister(reg)) {
+        if (args[1].IsImmediate()) {
+            code.mov(*cached, args[1].GetImmediateU64());
+        } else if (args[1].IsInXmm()) {
+            code.movq(*cached, ctx.reg_alloc.UseXmm(args[1]));
+        } else {
+            code.mov(*cached, ctx.reg_alloc.UseGpr(args[1]));
+        }
+        return;
+    }
     const auto addr = qword[r15 + offsetof(A64JitState, reg) + sizeof(u64) * static_cast<size_t>(reg)];
     if (args[1].FitsInImmediateS32()) {
         code.mov(addr, args[1].GetImmediateS32());
@@ -750,40 +1129,58 @@ void EmitDetectMisaignedVAddr(BlockOfCode& code, A64EmitContext& ctx, size_t bit
     code.and_(tmp, page_align_mask);
     code.cmp(tmp, page_align_mask);
     code.jne(resume, code.T_NEAR);
-    // NOTE: We expect to fallthrough into abort code here.
+    // Abort code does not necessarily follow, as the TLB miss path may be emitted in between.
+    code.jmp(abort, code.T_NEAR);
     code.SwitchToNearCode();
 }
 
-Xbyak::RegExp EmitVAddrLookup(BlockOfCode& code, A64EmitContext& ctx, size_t bitsize, Xbyak::Label& abort, Xbyak::Reg64 vaddr, std::optional<Xbyak::Reg64> arg_scratch = {}) {
-    const size_t valid_page_index_bits = ctx.conf.page_table_address_space_bits - page_bits;
+/// Leaves the host address of the page containing vaddr in page_table.
+void EmitPageTableWalk(BlockOfCode& code, A64EmitContext& ctx, Xbyak::Label& abort, Xbyak::Reg64 vaddr, Xbyak::Reg64 page_table, Xbyak::Reg64 tmp) {
+    const std::vector<size_t> level_bits = ctx.conf.page_table_level_bits.empty()
+                                         ? std::vector<size_t>{ctx.conf.page_table_address_space_bits - page_bits}
+                                         : ctx.conf.page_table_level_bits;
     const size_t unused_top_bits = 64 - ctx.conf.page_table_address_space_bits;
-
-    const Xbyak::Reg64 page_table = arg_scratch ? *arg_scratch : ctx.reg_alloc.ScratchGpr();
-    const Xbyak::Reg64 tmp = ctx.reg_alloc.ScratchGpr();
-
-    EmitDetectMisaignedVAddr(code, ctx, bitsize, abort, vaddr, tmp);
+    const size_t top_level_bits = level_bits.front();
+    const size_t top_level_shift = ctx.conf.page_table_address_space_bits - top_level_bits;
 
     code.mov(page_table, reinterpret_cast<u64>(ctx.conf.page_table));
     code.mov(tmp, vaddr);
     if (unused_top_bits == 0) {
-        code.shr(tmp, int(page_bits));
+        code.shr(tmp, int(top_level_shift));
     } else if (ctx.conf.silently_mirror_page_table) {
-        if (valid_page_index_bits >= 32) {
+        if (top_level_bits >= 32) {
             code.shl(tmp, int(unused_top_bits));
-            code.shr(tmp, int(unused_top_bits + page_bits));
+            code.shr(tmp, int(unused_top_bits + top_level_shift));
         } else {
-            code.shr(tmp, int(page_bits));
-            code.and_(tmp, u32((1 << valid_page_index_bits) - 1));
+            code.shr(tmp, int(top_level_shift));
+            code.and_(tmp, u32((1 << top_level_bits) - 1));
         }
     } else {
-        ASSERT(valid_page_index_bits < 32);
-        code.shr(tmp, int(page_bits));
-        code.test(tmp, u32(-(1 << valid_page_index_bits)));
+        ASSERT(top_level_bits < 32);
+        code.shr(tmp, int(top_level_shift));
+        code.test(tmp, u32(-(1 << top_level_bits)));
         code.jnz(abort, code.T_NEAR);
     }
     code.mov(page_table, qword[page_table + tmp * sizeof(void*)]);
     code.test(page_table, page_table);
     code.jz(abort, code.T_NEAR);
+
+    // Walk the remaining levels of a multi-level page table.
+    size_t shift = top_level_shift;
+    for (auto iter = level_bits.begin() + 1; iter != level_bits.end(); ++iter) {
+        shift -= *iter;
+        code.mov(tmp, vaddr);
+        code.shr(tmp, int(shift));
+        code.and_(tmp, u32((1 << *iter) - 1));
+        code.mov(page_table, qword[page_table + tmp * sizeof(void*)]);
+        code.test(page_table, page_table);
+        code.jz(abort, code.T_NEAR);
+    }
+}
+
+
+Xbyak::RegExp EmitUncachedVAddrLookup(BlockOfCode& code, A64EmitContext& ctx, Xbyak::Label& abort, Xbyak::Reg64 vaddr, Xbyak::Reg64 page_table, Xbyak::Reg64 tmp) {
+    EmitPageTableWalk(code, ctx, abort, vaddr, page_table, tmp);
     if (ctx.conf.absolute_offset_page_table) {
         return page_table + vaddr;
     }
@@ -792,8 +1189,345 @@ Xbyak::RegExp EmitVAddrLookup(BlockOfCode& code, A64EmitContext& ctx, size_t bit
     return page_table + tmp;
 }
 
+enum class MemoryAccess {
+    Read,
+    Write,
+};
+
+Xbyak::RegExp EmitVAddrLookup(BlockOfCode& code, A64EmitContext& ctx, size_t bitsize, MemoryAccess access, Xbyak::Label& abort, Xbyak::Reg64 vaddr, std::optional<Xbyak::Reg64> arg_scratch = {}) {
+    const Xbyak::Reg64 page_table = arg_scratch ? *arg_scratch : ctx.reg_alloc.ScratchGpr();
+    const Xbyak::Reg64 tmp = ctx.reg_alloc.ScratchGpr();
+
+    EmitDetectMisaignedVAddr(code, ctx, bitsize, abort, vaddr, tmp);
+
+    if (!ctx.conf.enable_page_table_tlb) {
+        return EmitUncachedVAddrLookup(code, ctx, abort, vaddr, page_table, tmp);
+    }
+
+    static_assert(A64JitState::TLBPageBits == page_bits);
+    const size_t tlb_offset = access == MemoryAccess::Read ? offsetof(A64JitState, read_tlb) : offsetof(A64JitState, write_tlb);
+    const auto tag = [&](Xbyak::Reg64 index) { return qword[r15 + index + tlb_offset + offsetof(A64JitState::TLBEntry, tag)]; };
+    const auto addend = [&](Xbyak::Reg64 index) { return qword[r15 + index + tlb_offset + offsetof(A64JitState::TLBEntry, addend)]; };
+    const auto emit_tlb_index = [&](Xbyak::Reg64 index) {
+        code.mov(index, vaddr);
+        code.shr(index, int(page_bits - 4));
+        code.and_(index, u32((A64JitState::TLBSize - 1) * sizeof(A64JitState::TLBEntry)));
+    };
+
+    Xbyak::Label miss, end;
+
+    emit_tlb_index(tmp);
+    code.mov(page_table, vaddr);
+    code.and_(page_table, u32(~(page_size - 1)));
+    code.cmp(page_table, tag(tmp));
+    code.jne(miss, code.T_NEAR);
+    code.mov(page_table, addend(tmp));
+    code.L(end);
+
+    code.SwitchToFarCode();
+    code.L(miss);
+    EmitPageTableWalk(code, ctx, abort, vaddr, page_table, tmp);
+    if (!ctx.conf.absolute_offset_page_table) {
+        code.mov(tmp, vaddr);
+        code.and_(tmp, u32(~(page_size - 1)));
+        code.sub(page_table, tmp);
+    }
+    emit_tlb_index(tmp);
+    code.mov(addend(tmp), page_table);
+    code.mov(page_table, vaddr);
+    code.and_(page_table, u32(~(page_size - 1)));
+    code.mov(tag(tmp), page_table);
+    code.mov(page_table, addend(tmp));
+    code.jmp(end, code.T_NEAR);
+    code.SwitchToNearCode();
+
+    return page_table + vaddr;
+}
+
+Xbyak::RegExp EmitFastmemVAddr(BlockOfCode& code, A64EmitContext& ctx, Xbyak::Label& abort, Xbyak::Reg64 vaddr, bool& require_abort_handling) {
+    const size_t unused_top_bits = 64 - ctx.conf.fastmem_address_space_bits;
+
+    if (unused_top_bits == 0) {
+        return r13 + vaddr;
+    } else if (ctx.conf.silently_mirror_fastmem) {
+        const Xbyak::Reg64 tmp = ctx.reg_alloc.ScratchGpr();
+        if (unused_top_bits < 32) {
+            code.mov(tmp, vaddr);
+            code.shl(tmp, int(unused_top_bits));
+            code.shr(tmp, int(unused_top_bits));
+        } else if (unused_top_bits == 32) {
+            code.mov(tmp.cvt32(), vaddr.cvt32());
+        } else {
+            code.mov(tmp.cvt32(), vaddr.cvt32());
+            code.and_(tmp, u32((u64(1) << ctx.conf.fastmem_address_space_bits) - 1));
+        }
+        return r13 + tmp;
+    } else {
+        if (ctx.conf.fastmem_address_space_bits < 32) {
+            code.test(vaddr, u32(~((u64(1) << ctx.conf.fastmem_address_space_bits) - 1)));
+        } else {
+            const Xbyak::Reg64 tmp = ctx.reg_alloc.ScratchGpr();
+            code.mov(tmp, vaddr);
+            code.shr(tmp, int(ctx.conf.fastmem_address_space_bits));
+        }
+        code.jnz(abort, code.T_NEAR);
+        require_abort_handling = true;
+        return r13 + vaddr;
+    }
+}
+
 } // anonymous namepsace
 
+u8* A64EmitX64::CodePageEntry(u64 vaddr, bool allocate) {
+    // Addresses beyond the address space are mirrored, which matches what the memory accesses do.
+    const size_t unused_top_bits = 64 - code_page_address_space_bits;
+    const u64 page = (vaddr << unused_top_bits) >> (unused_top_bits + page_bits);
+    const u64 leaf_mask = (u64(1) << code_page_leaf_bits) - 1;
+
+    u8*& leaf = code_page_directory[static_cast<size_t>(page >> code_page_leaf_bits)];
+    if (!leaf) {
+        if (!allocate) {
+            return nullptr;
+        }
+        code_page_leaves.emplace_back(std::make_unique<u8[]>(size_t(1) << code_page_leaf_bits));
+        leaf = code_page_leaves.back().get();
+    }
+    return &leaf[page & leaf_mask];
+}
+
+void A64EmitX64::WatchCodePages(boost::icl::discrete_interval<u64> range) {
+    if (code_page_directory.empty()) {
+        return;
+    }
+
+    const u64 first_page = boost::icl::first(range) >> page_bits;
+    const u64 last_page = boost::icl::last(range) >> page_bits;
+    for (u64 page = first_page; page <= last_page; page++) {
+        *CodePageEntry(page << page_bits, true) = 1;
+    }
+}
+
+void A64EmitX64::UnwatchCodePages(const boost::icl::interval_set<u64>& ranges) {
+    // When pages are aliased, another page sharing the entry may still contain code.
+    if (code_page_directory.empty() || code_pages_aliased) {
+        return;
+    }
+
+    for (const auto& range : ranges) {
+        const u64 first_page = boost::icl::first(range) >> page_bits;
+        const u64 last_page = boost::icl::last(range) >> page_bits;
+        for (u64 page = first_page; page <= last_page; page++) {
+            u8* const watched = CodePageEntry(page << page_bits, false);
+            if (watched && *watched && !block_ranges.Intersects(boost::icl::discrete_interval<u64>::closed(page << page_bits, (page << page_bits) + (page_size - 1)))) {
+                *watched = 0;
+            }
+        }
+    }
+}
+
+void A64EmitX64::EmitDetectCodeWrite(A64EmitContext& ctx, Xbyak::Reg64 vaddr, size_t bitsize) {
+    if (code_page_directory.empty()) {
+        return;
+    }
+
+    const size_t unused_top_bits = 64 - code_page_address_space_bits;
+    const Xbyak::Reg64 directory = ctx.reg_alloc.ScratchGpr();
+    const Xbyak::Reg64 leaf = ctx.reg_alloc.ScratchGpr();
+    const Xbyak::Reg64 page = ctx.reg_alloc.ScratchGpr();
+
+    Xbyak::Label code_write, end;
+
+    const auto emit_check = [&](size_t offset) {
+        Xbyak::Label not_watched;
+
+        code.lea(page, ptr[vaddr + offset]);
+        if (unused_top_bits != 0) {
+            code.shl(page, int(unused_top_bits));
+        }
+        code.shr(page, int(unused_top_bits + page_bits));
+        code.mov(leaf, page);
+        code.shr(leaf, int(code_page_leaf_bits));
+        code.mov(leaf, qword[directory + leaf * 8]);
+        code.test(leaf, leaf);
+        code.jz(not_watched);
+        code.and_(page.cvt32(), static_cast<u32>((u64(1) << code_page_leaf_bits) - 1));
+        code.cmp(code.byte[leaf + page], 0);
+        code.jne(code_write, code.T_NEAR);
+        code.L(not_watched);
+    };
+
+    // Both the first and the last byte written are checked in case the store straddles a page boundary.
+    code.mov(directory, reinterpret_cast<u64>(code_page_directory.data()));
+    emit_check(0);
+    if (bitsize != 8) {
+        emit_check(bitsize / 8 - 1);
+    }
+    code.L(end);
+
+    code.SwitchToFarCode();
+    code.L(code_write);
+    code.sub(rsp, 8);
+    ABI_PushCallerSaveRegistersAndAdjustStack(code);
+    if (vaddr.getIdx() != code.ABI_PARAM2.getIdx()) {
+        code.mov(code.ABI_PARAM2, vaddr);
+    }
+    code.mov(code.ABI_PARAM1, reinterpret_cast<u64>(this));
+    code.mov(code.ABI_PARAM3, bitsize / 8);
+    code.CallLambda(
+        [](A64EmitX64* this_, u64 vaddr, size_t size) {
+            this_->code_write_handler(vaddr, size);
+        }
+    );
+    ABI_PopCallerSaveRegistersAndAdjustStack(code);
+    code.add(rsp, 8);
+    code.jmp(end, code.T_NEAR);
+    code.SwitchToNearCode();
+}
+
+std::optional<A64EmitX64::DoNotFastmemMarker> A64EmitX64::ShouldFastmem(A64EmitContext& ctx, IR::Inst* inst) const {
+    if (!conf.fastmem_pointer || !exception_handler.SupportsFastmem()) {
+        return std::nullopt;
+    }
+
+    const auto marker = std::make_tuple(ctx.Location(), ctx.GetInstOffset(inst));
+    if (do_not_fastmem.count(marker) > 0) {
+        return std::nullopt;
+    }
+    return marker;
+}
+
+FakeCall A64EmitX64::FastmemCallback(u64 rip_) {
+    const auto iter = fastmem_patch_info.find(rip_);
+    ASSERT(iter != fastmem_patch_info.end());
+    if (conf.recompile_on_fastmem_failure) {
+        const auto marker = iter->second.marker;
+        do_not_fastmem.emplace(marker);
+        InvalidateBasicBlocks({std::get<0>(marker)});
+    }
+    FakeCall ret;
+    ret.call_rip = iter->second.callback;
+    ret.ret_rip = iter->second.resume_rip;
+    return ret;
+}
+
+void A64EmitX64::EmitFastmemRead(A64EmitContext& ctx, IR::Inst* inst, size_t bitsize, DoNotFastmemMarker marker) {
+    Xbyak::Label abort, end;
+    bool require_abort_handling = false;
+
+    auto args = ctx.reg_alloc.GetArgumentInfo(inst);
+    const Xbyak::Reg64 vaddr = ctx.reg_alloc.UseGpr(args[0]);
+    const int value_idx = bitsize == 128 ? ctx.reg_alloc.ScratchXmm().getIdx() : ctx.reg_alloc.ScratchGpr().getIdx();
+
+    const auto wrapped_fn = read_fallbacks[std::make_tuple(bitsize, vaddr.getIdx(), value_idx)];
+
+    const auto src_ptr = EmitFastmemVAddr(code, ctx, abort, vaddr, require_abort_handling);
+
+    const auto location = code.getCurr();
+
+    switch (bitsize) {
+    case 8:
+        code.movzx(Xbyak::Reg32{value_idx}, code.byte[src_ptr]);
+        break;
+    case 16:
+        code.movzx(Xbyak::Reg32{value_idx}, word[src_ptr]);
+        break;
+    case 32:
+        code.mov(Xbyak::Reg32{value_idx}, dword[src_ptr]);
+        break;
+    case 64:
+        code.mov(Xbyak::Reg64{value_idx}, qword[src_ptr]);
+        break;
+    case 128:
+        code.movups(Xbyak::Xmm{value_idx}, xword[src_ptr]);
+        break;
+    default:
+        ASSERT_MSG(false, "Invalid bitsize");
+        break;
+    }
+
+    fastmem_patch_info.emplace(
+        Common::BitCast<u64>(location),
+        FastmemPatchInfo{
+            Common::BitCast<u64>(code.getCurr()),
+            Common::BitCast<u64>(wrapped_fn),
+            marker,
+        }
+    );
+
+    if (require_abort_handling) {
+        code.L(end);
+
+        code.SwitchToFarCode();
+        code.L(abort);
+        code.call(wrapped_fn);
+        code.jmp(end, code.T_NEAR);
+        code.SwitchToNearCode();
+    }
+
+    if (bitsize == 128) {
+        ctx.reg_alloc.DefineValue(inst, Xbyak::Xmm{value_idx});
+    } else {
+        ctx.reg_alloc.DefineValue(inst, Xbyak::Reg64{value_idx});
+    }
+}
+
+void A64EmitX64::EmitFastmemWrite(A64EmitContext& ctx, IR::Inst* inst, size_t bitsize, DoNotFastmemMarker marker) {
+    Xbyak::Label abort, end;
+    bool require_abort_handling = false;
+
+    auto args = ctx.reg_alloc.GetArgumentInfo(inst);
+    const Xbyak::Reg64 vaddr = ctx.reg_alloc.UseGpr(args[0]);
+    const int value_idx = bitsize == 128 ? ctx.reg_alloc.UseXmm(args[1]).getIdx() : ctx.reg_alloc.UseGpr(args[1]).getIdx();
+
+    const auto wrapped_fn = write_fallbacks[std::make_tuple(bitsize, vaddr.getIdx(), value_idx)];
+
+    const auto dest_ptr = EmitFastmemVAddr(code, ctx, abort, vaddr, require_abort_handling);
+
+    const auto location = code.getCurr();
+
+    switch (bitsize) {
+    case 8:
+        code.mov(code.byte[dest_ptr], Xbyak::Reg64{value_idx}.cvt8());
+        break;
+    case 16:
+        code.mov(word[dest_ptr], Xbyak::Reg16{value_idx});
+        break;
+    case 32:
+        code.mov(dword[dest_ptr], Xbyak::Reg32{value_idx});
+        break;
+    case 64:
+        code.mov(qword[dest_ptr], Xbyak::Reg64{value_idx});
+        break;
+    case 128:
+        code.movups(xword[dest_ptr], Xbyak::Xmm{value_idx});
+        break;
+    default:
+        ASSERT_MSG(false, "Invalid bitsize");
+        break;
+    }
+
+    fastmem_patch_info.emplace(
+        Common::BitCast<u64>(location),
+        FastmemPatchInfo{
+            Common::BitCast<u64>(code.getCurr()),
+            Common::BitCast<u64>(wrapped_fn),
+            marker,
+        }
+    );
+
+    if (require_abort_handling) {
+        code.L(end);
+
+        code.SwitchToFarCode();
+        code.L(abort);
+        code.call(wrapped_fn);
+        code.jmp(end, code.T_NEAR);
+        code.SwitchToNearCode();
+    }
+
+    EmitDetectCodeWrite(ctx, vaddr, bitsize);
+}
+
 void A64EmitX64::EmitDirectPageTableMemoryRead(A64EmitContext& ctx, IR::Inst* inst, size_t bitsize) {
     Xbyak::Label abort, end;
 
@@ -801,7 +1535,7 @@ void A64EmitX64::EmitDirectPageTableMemoryRead(A64EmitContext& ctx, IR::Inst* in
     const Xbyak::Reg64 vaddr = ctx.reg_alloc.UseGpr(args[0]);
     const Xbyak::Reg64 value = ctx.reg_alloc.ScratchGpr();
 
-    const auto src_ptr = EmitVAddrLookup(code, ctx, bitsize, abort, vaddr, value);
+    const auto src_ptr = EmitVAddrLookup(code, ctx, bitsize, MemoryAccess::Read, abort, vaddr, value);
     switch (bitsize) {
     case 8:
         code.movzx(value.cvt32(), code.byte[src_ptr]);
@@ -834,7 +1568,7 @@ void A64EmitX64::EmitDirectPageTableMemoryWrite(A64EmitContext& ctx, IR::Inst* i
     const Xbyak::Reg64 vaddr = ctx.reg_alloc.UseGpr(args[0]);
     const Xbyak::Reg64 value = ctx.reg_alloc.UseGpr(args[1]);
 
-    const auto dest_ptr = EmitVAddrLookup(code, ctx, bitsize, abort, vaddr);
+    const auto dest_ptr = EmitVAddrLookup(code, ctx, bitsize, MemoryAccess::Write, abort, vaddr);
     switch (bitsize) {
     case 8:
         code.mov(code.byte[dest_ptr], value.cvt8());
@@ -856,9 +1590,16 @@ void A64EmitX64::EmitDirectPageTableMemoryWrite(A64EmitContext& ctx, IR::Inst* i
     code.call(write_fallbacks[std::make_tuple(bitsize, vaddr.getIdx(), value.getIdx())]);
     code.jmp(end, code.T_NEAR);
     code.SwitchToNearCode();
+
+    EmitDetectCodeWrite(ctx, vaddr, bitsize);
 }
 
 void A64EmitX64::EmitA64ReadMemory8(A64EmitContext& ctx, IR::Inst* inst) {
+    if (const auto marker = ShouldFastmem(ctx, inst)) {
+        EmitFastmemRead(ctx, inst, 8, *marker);
+        return;
+    }
+
     if (conf.page_table) {
         EmitDirectPageTableMemoryRead(ctx, inst, 8);
         return;
@@ -870,6 +1611,11 @@ void A64EmitX64::EmitA64ReadMemory8(A64EmitContext& ctx, IR::Inst* inst) {
 }
 
 void A64EmitX64::EmitA64ReadMemory16(A64EmitContext& ctx, IR::Inst* inst) {
+    if (const auto marker = ShouldFastmem(ctx, inst)) {
+        EmitFastmemRead(ctx, inst, 16, *marker);
+        return;
+    }
+
     if (conf.page_table) {
         EmitDirectPageTableMemoryRead(ctx, inst, 16);
         return;
@@ -881,6 +1627,11 @@ void A64EmitX64::EmitA64ReadMemory16(A64EmitContext& ctx, IR::Inst* inst) {
 }
 
 void A64EmitX64::EmitA64ReadMemory32(A64EmitContext& ctx, IR::Inst* inst) {
+    if (const auto marker = ShouldFastmem(ctx, inst)) {
+        EmitFastmemRead(ctx, inst, 32, *marker);
+        return;
+    }
+
     if (conf.page_table) {
         EmitDirectPageTableMemoryRead(ctx, inst, 32);
         return;
@@ -892,6 +1643,11 @@ void A64EmitX64::EmitA64ReadMemory32(A64EmitContext& ctx, IR::Inst* inst) {
 }
 
 void A64EmitX64::EmitA64ReadMemory64(A64EmitContext& ctx, IR::Inst* inst) {
+    if (const auto marker = ShouldFastmem(ctx, inst)) {
+        EmitFastmemRead(ctx, inst, 64, *marker);
+        return;
+    }
+
     if (conf.page_table) {
         EmitDirectPageTableMemoryRead(ctx, inst, 64);
         return;
@@ -903,6 +1659,11 @@ void A64EmitX64::EmitA64ReadMemory64(A64EmitContext& ctx, IR::Inst* inst) {
 }
 
 void A64EmitX64::EmitA64ReadMemory128(A64EmitContext& ctx, IR::Inst* inst) {
+    if (const auto marker = ShouldFastmem(ctx, inst)) {
+        EmitFastmemRead(ctx, inst, 128, *marker);
+        return;
+    }
+
     if (conf.page_table) {
         Xbyak::Label abort, end;
 
@@ -910,7 +1671,7 @@ void A64EmitX64::EmitA64ReadMemory128(A64EmitContext& ctx, IR::Inst* inst) {
         const Xbyak::Reg64 vaddr = ctx.reg_alloc.UseGpr(args[0]);
         const Xbyak::Xmm value = ctx.reg_alloc.ScratchXmm();
 
-        const auto src_ptr = EmitVAddrLookup(code, ctx, 128, abort, vaddr);
+        const auto src_ptr = EmitVAddrLookup(code, ctx, 128, MemoryAccess::Read, abort, vaddr);
         code.movups(value, xword[src_ptr]);
         code.L(end);
 
@@ -931,6 +1692,11 @@ void A64EmitX64::EmitA64ReadMemory128(A64EmitContext& ctx, IR::Inst* inst) {
 }
 
 void A64EmitX64::EmitA64WriteMemory8(A64EmitContext& ctx, IR::Inst* inst) {
+    if (const auto marker = ShouldFastmem(ctx, inst)) {
+        EmitFastmemWrite(ctx, inst, 8, *marker);
+        return;
+    }
+
     if (conf.page_table) {
         EmitDirectPageTableMemoryWrite(ctx, inst, 8);
         return;
@@ -942,6 +1708,11 @@ void A64EmitX64::EmitA64WriteMemory8(A64EmitContext& ctx, IR::Inst* inst) {
 }
 
 void A64EmitX64::EmitA64WriteMemory16(A64EmitContext& ctx, IR::Inst* inst) {
+    if (const auto marker = ShouldFastmem(ctx, inst)) {
+        EmitFastmemWrite(ctx, inst, 16, *marker);
+        return;
+    }
+
     if (conf.page_table) {
         EmitDirectPageTableMemoryWrite(ctx, inst, 16);
         return;
@@ -953,6 +1724,11 @@ void A64EmitX64::EmitA64WriteMemory16(A64EmitContext& ctx, IR::Inst* inst) {
 }
 
 void A64EmitX64::EmitA64WriteMemory32(A64EmitContext& ctx, IR::Inst* inst) {
+    if (const auto marker = ShouldFastmem(ctx, inst)) {
+        EmitFastmemWrite(ctx, inst, 32, *marker);
+        return;
+    }
+
     if (conf.page_table) {
         EmitDirectPageTableMemoryWrite(ctx, inst, 32);
         return;
@@ -964,6 +1740,11 @@ void A64EmitX64::EmitA64WriteMemory32(A64EmitContext& ctx, IR::Inst* inst) {
 }
 
 void A64EmitX64::EmitA64WriteMemory64(A64EmitContext& ctx, IR::Inst* inst) {
+    if (const auto marker = ShouldFastmem(ctx, inst)) {
+        EmitFastmemWrite(ctx, inst, 64, *marker);
+        return;
+    }
+
     if (conf.page_table) {
         EmitDirectPageTableMemoryWrite(ctx, inst, 64);
         return;
@@ -975,6 +1756,11 @@ void A64EmitX64::EmitA64WriteMemory64(A64EmitContext& ctx, IR::Inst* inst) {
 }
 
 void A64EmitX64::EmitA64WriteMemory128(A64EmitContext& ctx, IR::Inst* inst) {
+    if (const auto marker = ShouldFastmem(ctx, inst)) {
+        EmitFastmemWrite(ctx, inst, 128, *marker);
+        return;
+    }
+
     if (conf.page_table) {
         Xbyak::Label abort, end;
 
@@ -982,7 +1768,7 @@ void A64EmitX64::EmitA64WriteMemory128(A64EmitContext& ctx, IR::Inst* inst) {
         const Xbyak::Reg64 vaddr = ctx.reg_alloc.UseGpr(args[0]);
         const Xbyak::Xmm value = ctx.reg_alloc.UseXmm(args[1]);
 
-        const auto dest_ptr = EmitVAddrLookup(code, ctx, 128, abort, vaddr);
+        const auto dest_ptr = EmitVAddrLookup(code, ctx, 128, MemoryAccess::Write, abort, vaddr);
         code.movups(xword[dest_ptr], value);
         code.L(end);
 
@@ -991,6 +1777,8 @@ void A64EmitX64::EmitA64WriteMemory128(A64EmitContext& ctx, IR::Inst* inst) {
         code.call(write_fallbacks[std::make_tuple(128, vaddr.getIdx(), value.getIdx())]);
         code.jmp(end, code.T_NEAR);
         code.SwitchToNearCode();
+
+        EmitDetectCodeWrite(ctx, vaddr, 128);
         return;
     }
 
@@ -1002,6 +1790,184 @@ void A64EmitX64::EmitA64WriteMemory128(A64EmitContext& ctx, IR::Inst* inst) {
     code.CallFunction(memory_write_128);
 }
 
+void A64EmitX64::EmitA64TranslateMemory(A64EmitContext& ctx, IR::Inst* inst) {
+    ASSERT(conf.page_table);
+
+    auto args = ctx.reg_alloc.GetArgumentInfo(inst);
+    const Xbyak::Reg64 vaddr = ctx.reg_alloc.UseGpr(args[0]);
+    const u32 span = args[1].GetImmediateU8();
+    const MemoryAccess access = args[2].GetImmediateU1() ? MemoryAccess::Write : MemoryAccess::Read;
+    const Xbyak::Reg64 result = ctx.reg_alloc.ScratchGpr();
+
+    Xbyak::Label abort, end;
+
+    // The entire range must lie within the page containing vaddr, otherwise each access is translated on its own.
+    code.mov(result.cvt32(), vaddr.cvt32());
+    code.and_(result.cvt32(), static_cast<u32>(page_size - 1));
+    code.cmp(result.cvt32(), static_cast<u32>(page_size - span));
+    code.ja(abort, code.T_NEAR);
+
+    const auto host_ptr = EmitVAddrLookup(code, ctx, 8, access, abort, vaddr, result);
+    code.lea(result, ptr[host_ptr]);
+    code.L(end);
+
+    code.SwitchToFarCode();
+    code.L(abort);
+    code.xor_(result.cvt32(), result.cvt32());
+    code.jmp(end, code.T_NEAR);
+    code.SwitchToNearCode();
+
+    ctx.reg_alloc.DefineValue(inst, result);
+}
+
+void A64EmitX64::EmitTranslatedMemoryRead(A64EmitContext& ctx, IR::Inst* inst, size_t bitsize) {
+    Xbyak::Label slow_path, abort, end;
+
+    auto args = ctx.reg_alloc.GetArgumentInfo(inst);
+    const Xbyak::Reg64 host_address = ctx.reg_alloc.UseGpr(args[0]);
+    const Xbyak::Reg64 vaddr = ctx.reg_alloc.UseGpr(args[1]);
+    const u8 offset = args[2].GetImmediateU8();
+    const Xbyak::Reg64 page_table = ctx.reg_alloc.ScratchGpr();
+    const Xbyak::Reg64 tmp = ctx.reg_alloc.ScratchGpr();
+    const int value_idx = bitsize == 128
+                        ? ctx.reg_alloc.ScratchXmm().getIdx()
+                        : ctx.reg_alloc.ScratchGpr().getIdx();
+
+    const auto emit_load = [&](const Xbyak::RegExp& src_ptr) {
+        switch (bitsize) {
+        case 8:
+            code.movzx(Xbyak::Reg32{value_idx}, code.byte[src_ptr]);
+            break;
+        case 16:
+            code.movzx(Xbyak::Reg32{value_idx}, word[src_ptr]);
+            break;
+        case 32:
+            code.mov(Xbyak::Reg32{value_idx}, dword[src_ptr]);
+            break;
+        case 64:
+            code.mov(Xbyak::Reg64{value_idx}, qword[src_ptr]);
+            break;
+        case 128:
+            code.movups(Xbyak::Xmm{value_idx}, xword[src_ptr]);
+            break;
+        default:
+            UNREACHABLE();
+        }
+    };
+
+    code.test(host_address, host_address);
+    code.jz(slow_path, code.T_NEAR);
+    emit_load(host_address + offset);
+    code.L(end);
+
+    code.SwitchToFarCode();
+    code.L(slow_path);
+    emit_load(EmitUncachedVAddrLookup(code, ctx, abort, vaddr, page_table, tmp));
+    code.jmp(end, code.T_NEAR);
+    code.L(abort);
+    code.call(read_fallbacks[std::make_tuple(bitsize, vaddr.getIdx(), value_idx)]);
+    code.jmp(end, code.T_NEAR);
+    code.SwitchToNearCode();
+
+    if (bitsize == 128) {
+        ctx.reg_alloc.DefineValue(inst, Xbyak::Xmm{value_idx});
+    } else {
+        ctx.reg_alloc.DefineValue(inst, Xbyak::Reg64{value_idx});
+    }
+}
+
+void A64EmitX64::EmitTranslatedMemoryWrite(A64EmitContext& ctx, IR::Inst* inst, size_t bitsize) {
+    Xbyak::Label slow_path, abort, end;
+
+    auto args = ctx.reg_alloc.GetArgumentInfo(inst);
+    const Xbyak::Reg64 host_address = ctx.reg_alloc.UseGpr(args[0]);
+    const Xbyak::Reg64 vaddr = ctx.reg_alloc.UseGpr(args[1]);
+    const u8 offset = args[2].GetImmediateU8();
+    const int value_idx = bitsize == 128
+                        ? ctx.reg_alloc.UseXmm(args[3]).getIdx()
+                        : ctx.reg_alloc.UseGpr(args[3]).getIdx();
+    const Xbyak::Reg64 page_table = ctx.reg_alloc.ScratchGpr();
+    const Xbyak::Reg64 tmp = ctx.reg_alloc.ScratchGpr();
+
+    const auto emit_store = [&](const Xbyak::RegExp& dest_ptr) {
+        switch (bitsize) {
+        case 8:
+            code.mov(code.byte[dest_ptr], Xbyak::Reg64{value_idx}.cvt8());
+            break;
+        case 16:
+            code.mov(word[dest_ptr], Xbyak::Reg64{value_idx}.cvt16());
+            break;
+        case 32:
+            code.mov(dword[dest_ptr], Xbyak::Reg64{value_idx}.cvt32());
+            break;
+        case 64:
+            code.mov(qword[dest_ptr], Xbyak::Reg64{value_idx});
+            break;
+        case 128:
+            code.movups(xword[dest_ptr], Xbyak::Xmm{value_idx});
+            break;
+        default:
+            UNREACHABLE();
+        }
+    };
+
+    code.test(host_address, host_address);
+    code.jz(slow_path, code.T_NEAR);
+    emit_store(host_address + offset);
+    code.L(end);
+
+    code.SwitchToFarCode();
+    code.L(slow_path);
+    emit_store(EmitUncachedVAddrLookup(code, ctx, abort, vaddr, page_table, tmp));
+    code.jmp(end, code.T_NEAR);
+    code.L(abort);
+    code.call(write_fallbacks[std::make_tuple(bitsize, vaddr.getIdx(), value_idx)]);
+    code.jmp(end, code.T_NEAR);
+    code.SwitchToNearCode();
+
+    EmitDetectCodeWrite(ctx, vaddr, bitsize);
+}
+
+void A64EmitX64::EmitA64ReadMemoryTranslated8(A64EmitContext& ctx, IR::Inst* inst) {
+    EmitTranslatedMemoryRead(ctx, inst, 8);
+}
+
+void A64EmitX64::EmitA64ReadMemoryTranslated16(A64EmitContext& ctx, IR::Inst* inst) {
+    EmitTranslatedMemoryRead(ctx, inst, 16);
+}
+
+void A64EmitX64::EmitA64ReadMemoryTranslated32(A64EmitContext& ctx, IR::Inst* inst) {
+    EmitTranslatedMemoryRead(ctx, inst, 32);
+}
+
+void A64EmitX64::EmitA64ReadMemoryTranslated64(A64EmitContext& ctx, IR::Inst* inst) {
+    EmitTranslatedMemoryRead(ctx, inst, 64);
+}
+
+void A64EmitX64::EmitA64ReadMemoryTranslated128(A64EmitContext& ctx, IR::Inst* inst) {
+    EmitTranslatedMemoryRead(ctx, inst, 128);
+}
+
+void A64EmitX64::EmitA64WriteMemoryTranslated8(A64EmitContext& ctx, IR::Inst* inst) {
+    EmitTranslatedMemoryWrite(ctx, inst, 8);
+}
+
+void A64EmitX64::EmitA64WriteMemoryTranslated16(A64EmitContext& ctx, IR::Inst* inst) {
+    EmitTranslatedMemoryWrite(ctx, inst, 16);
+}
+
+void A64EmitX64::EmitA64WriteMemoryTranslated32(A64EmitContext& ctx, IR::Inst* inst) {
+    EmitTranslatedMemoryWrite(ctx, inst, 32);
+}
+
+void A64EmitX64::EmitA64WriteMemoryTranslated64(A64EmitContext& ctx, IR::Inst* inst) {
+    EmitTranslatedMemoryWrite(ctx, inst, 64);
+}
+
+void A64EmitX64::EmitA64WriteMemoryTranslated128(A64EmitContext& ctx, IR::Inst* inst) {
+    EmitTranslatedMemoryWrite(ctx, inst, 128);
+}
+
 void A64EmitX64::EmitExclusiveWrite(A64EmitContext& ctx, IR::Inst* inst, size_t bitsize) {
     if (conf.global_monitor) {
         auto args = ctx.reg_alloc.GetArgumentInfo(inst);
@@ -1132,6 +2098,7 @@ std::string A64EmitX64::LocationDescriptorToFriendlyName(const IR::LocationDescr
 }
 
 void A64EmitX64::EmitTerminalImpl(IR::Term::Interpret terminal, IR::LocationDescriptor) {
+    EmitLoopWriteback();
     code.SwitchMxcsrOnExit();
     Devirtualize<&A64::UserCallbacks::InterpreterFallback>(conf.callbacks).EmitCall(code,
         [&](RegList param) {
@@ -1143,14 +2110,43 @@ void A64EmitX64::EmitTerminalImpl(IR::Term::Interpret terminal, IR::LocationDesc
 }
 
 void A64EmitX64::EmitTerminalImpl(IR::Term::ReturnToDispatch, IR::LocationDescriptor) {
+    EmitLoopWriteback();
     code.ReturnFromRunCode();
 }
 
-void A64EmitX64::EmitTerminalImpl(IR::Term::LinkBlock terminal, IR::LocationDescriptor) {
-    code.cmp(qword[r15 + offsetof(A64JitState, cycles_remaining)], 0);
+void A64EmitX64::EmitTerminalImpl(IR::Term::LinkBlock terminal, IR::LocationDescriptor initial_location) {
+    const bool is_back_edge = terminal.next == initial_location && current_block_entrypoint;
+    if (!is_back_edge) {
+        EmitLoopWriteback();
+    }
+
+    // Without ticks, links are only broken by a halt request. EmitPatchJg emits the matching jump.
+    if (conf.enable_ticks) {
+        code.cmp(qword[r15 + offsetof(A64JitState, cycles_remaining)], 0);
+    } else {
+        code.cmp(code.byte[r15 + offsetof(A64JitState, halt_requested)], u8(0));
+    }
+
+    if (is_back_edge) {
+        // Loop back-edge: this block is its own successor, so it is always valid to jump straight back
+        // to its start. No patch information is required as the block cannot invalidate itself while it runs
+        // (see Emit). Registers cached by a loop region stay in host registers until the loop exits.
+        const CodePtr loop_head = current_loop ? current_loop->head : current_block_entrypoint;
+        if (conf.enable_ticks) {
+            code.jg(loop_head);
+        } else {
+            code.je(loop_head);
+        }
+        EmitLoopWriteback();
+        code.mov(rax, A64::LocationDescriptor{terminal.next}.PC());
+        code.mov(qword[r15 + offsetof(A64JitState, pc)], rax);
+        code.ForceReturnFromRunCode();
+        return;
+    }
 
     patch_information[terminal.next].jg.emplace_back(code.getCurr());
     if (auto next_bb = GetBasicBlock(terminal.next)) {
+        code.MarkRegionAccessed(next_bb->entrypoint);
         EmitPatchJg(terminal.next, next_bb->entrypoint);
     } else {
         EmitPatchJg(terminal.next);
@@ -1161,8 +2157,10 @@ void A64EmitX64::EmitTerminalImpl(IR::Term::LinkBlock terminal, IR::LocationDesc
 }
 
 void A64EmitX64::EmitTerminalImpl(IR::Term::LinkBlockFast terminal, IR::LocationDescriptor) {
+    EmitLoopWriteback();
     patch_information[terminal.next].jmp.emplace_back(code.getCurr());
     if (auto next_bb = GetBasicBlock(terminal.next)) {
+        code.MarkRegionAccessed(next_bb->entrypoint);
         EmitPatchJmp(terminal.next, next_bb->entrypoint);
     } else {
         EmitPatchJmp(terminal.next);
@@ -1170,15 +2168,35 @@ void A64EmitX64::EmitTerminalImpl(IR::Term::LinkBlockFast terminal, IR::Location
 }
 
 void A64EmitX64::EmitTerminalImpl(IR::Term::PopRSBHint, IR::LocationDescriptor) {
+    EmitLoopWriteback();
     code.jmp(terminal_handler_pop_rsb_hint);
 }
 
 void A64EmitX64::EmitTerminalImpl(IR::Term::FastDispatchHint, IR::LocationDescriptor) {
-    if (conf.enable_fast_dispatch) {
-        code.jmp(terminal_handler_fast_dispatch_hint);
-    } else {
+    EmitLoopWriteback();
+    if (!conf.enable_fast_dispatch) {
         code.ReturnFromRunCode();
+        return;
     }
+
+    if (conf.inline_cache_entries == 0) {
+        code.jmp(terminal_handler_fast_dispatch_hint);
+        return;
+    }
+
+    auto& cache = inline_caches.emplace_back(InlineCache{code.getCurr(), std::make_unique<FastDispatchEntry[]>(conf.inline_cache_entries)});
+    std::fill_n(cache.entries.get(), conf.inline_cache_entries, FastDispatchEntry{0xFFFFFFFFFFFFFFFFull, nullptr});
+
+    EmitCalculateLocationDescriptor();
+    code.mov(r14, reinterpret_cast<u64>(cache.entries.get()));
+    for (size_t i = 0; i < conf.inline_cache_entries; i++) {
+        Xbyak::Label next;
+        code.cmp(rbx, qword[r14 + i * sizeof(FastDispatchEntry) + offsetof(FastDispatchEntry, location_descriptor)]);
+        code.jne(next);
+        code.jmp(qword[r14 + i * sizeof(FastDispatchEntry) + offsetof(FastDispatchEntry, code_ptr)]);
+        code.L(next);
+    }
+    code.jmp(terminal_handler_inline_cache_miss);
 }
 
 void A64EmitX64::EmitTerminalImpl(IR::Term::If terminal, IR::LocationDescriptor initial_location) {
@@ -1207,18 +2225,35 @@ void A64EmitX64::EmitTerminalImpl(IR::Term::CheckBit terminal, IR::LocationDescr
 
 void A64EmitX64::EmitTerminalImpl(IR::Term::CheckHalt terminal, IR::LocationDescriptor initial_location) {
     code.cmp(code.byte[r15 + offsetof(A64JitState, halt_requested)], u8(0));
-    code.jne(code.GetForceReturnFromRunCodeAddress());
+    if (!current_loop) {
+        code.jne(code.GetForceReturnFromRunCodeAddress());
+        EmitTerminal(terminal.else_, initial_location);
+        return;
+    }
+
+    Xbyak::Label halt;
+    code.jne(halt, code.T_NEAR);
     EmitTerminal(terminal.else_, initial_location);
+    code.L(halt);
+    EmitLoopWriteback();
+    code.ForceReturnFromRunCode();
 }
 
 void A64EmitX64::EmitPatchJg(const IR::LocationDescriptor& target_desc, CodePtr target_code_ptr) {
     const CodePtr patch_location = code.getCurr();
+    const auto jcc = [this](const void* target) {
+        if (conf.enable_ticks) {
+            code.jg(target);
+        } else {
+            code.je(target);
+        }
+    };
     if (target_code_ptr) {
-        code.jg(target_code_ptr);
+        jcc(target_code_ptr);
     } else {
         code.mov(rax, A64::LocationDescriptor{target_desc}.PC());
         code.mov(qword[r15 + offsetof(A64JitState, pc)], rax);
-        code.jg(code.GetReturnFromRunCodeAddress());
+        jcc(code.GetReturnFromRunCodeAddress());
     }
     code.EnsurePatchLocationSize(patch_location, 23);
 }
@@ -6,8 +6,14 @@
 
 #pragma once
 
+#include <functional>
 #include <map>
+#include <memory>
+#include <optional>
+#include <set>
 #include <tuple>
+#include <unordered_map>
+#include <vector>
 
 #include <dynarmic/A64/a64.h>
 #include <dynarmic/A64/config.h>
@@ -16,6 +22,7 @@
 #include "backend/x64/block_range_information.h"
 #include "backend/x64/emit_x64.h"
 #include "frontend/A64/location_descriptor.h"
+#include "frontend/A64/types.h"
 #include "frontend/ir/terminal.h"
 
 namespace Dynarmic::Backend::X64 {
@@ -38,28 +45,51 @@ public:
 
     /**
      * Emit host machine code for a basic block with intermediate representation `block`.
+     * If count_executions is true, the emitted code counts its executions and returns to the
+     * dispatcher once it has run UserConfig::tiered_compilation_threshold times. Emitting a block
+     * for the same location without counting later replaces the counting code.
      * @note block is modified.
      */
-    BlockDescriptor Emit(IR::Block& block);
+    BlockDescriptor Emit(IR::Block& block, bool count_executions = false);
+
+    /// Determines if the block at location was emitted with count_executions and has reached
+    /// its execution threshold, meaning it should be recompiled.
+    bool ExecutionCountExceeded(IR::LocationDescriptor location) const;
 
     void ClearCache() override;
 
+    std::vector<IR::LocationDescriptor> EvictCodeRegion(size_t region) override;
+
     void InvalidateCacheRanges(const boost::icl::interval_set<u64>& ranges);
 
+    /// Re-emits the blocks that have executed since the last call, most frequently executed first,
+    /// into the hot region of the code cache until it is full. The blocks are translated again with
+    /// translate. Links to the blocks are patched to the new code. Does nothing if there is no hot region.
+    void OptimizeCodeLayout(const std::function<IR::Block(IR::LocationDescriptor)>& translate);
+
+    /// Called from emitted code after the guest has stored size bytes at vaddr on a page that
+    /// contains translated code. Only used if UserConfig::detect_self_modifying_code is set.
+    void SetCodeWriteHandler(std::function<void(u64 vaddr, size_t size)> handler) { code_write_handler = std::move(handler); }
+
+    /// Code that executes the instruction at the current PC using UserCallbacks::InterpreterFallback
+    /// then returns to the dispatcher. Used in place of blocks that are still being compiled.
+    /// Only available if UserConfig::background_compilation_threads is non-zero.
+    CodePtr InterpretSingleInstruction() const { return interpret_single_instruction; }
+
 protected:
     const A64::UserConfig conf;
     A64::Jit* jit_interface;
     BlockRangeInformation<u64> block_ranges;
+    std::vector<HostLoc> gpr_order;
 
-    struct FastDispatchEntry {
-        u64 location_descriptor;
-        const void* code_ptr;
+    // Inline cache information
+    struct InlineCache {
+        CodePtr code_ptr;
+        /// conf.inline_cache_entries entries, most recently used first.
+        std::unique_ptr<FastDispatchEntry[]> entries;
     };
-    static_assert(sizeof(FastDispatchEntry) == 0x10);
-    static constexpr u64 fast_dispatch_table_mask = 0xFFFFF0;
-    static constexpr size_t fast_dispatch_table_size = 0x100000;
-    std::array<FastDispatchEntry, fast_dispatch_table_size> fast_dispatch_table;
-    void ClearFastDispatchTable();
+    std::vector<InlineCache> inline_caches;
+    void ClearInlineCaches();
 
     void (*memory_read_128)();
     void (*memory_write_128)();
@@ -71,10 +101,80 @@ protected:
 
     const void* terminal_handler_pop_rsb_hint;
     const void* terminal_handler_fast_dispatch_hint = nullptr;
+    const void* terminal_handler_inline_cache_miss = nullptr;
     void GenTerminalHandlers();
-
+    void EmitCalculateLocationDescriptor();
+
+    const void* interpret_single_instruction = nullptr;
+    void GenInterpretSingleInstruction();
+
+    // Loop information
+    /// Entrypoint of the block currently being emitted. Links from a block to itself jump
+    /// directly back here rather than going through the patching mechanism.
+    CodePtr current_block_entrypoint = nullptr;
+    /// A block that links to itself may keep guest registers in host registers across iterations.
+    /// They are loaded before the loop head and written back on every path that leaves the loop.
+    struct LoopRegion {
+        CodePtr head = nullptr;
+        std::vector<std::pair<A64::Reg, HostLoc>> cached_registers;
+    };
+    /// The loop region of the block currently being emitted, if it has one.
+    std::optional<LoopRegion> current_loop;
+    std::optional<LoopRegion> PlanLoopRegion(const IR::Block& block, bool count_executions) const;
+    std::optional<Xbyak::Reg64> LoopCachedRegister(A64::Reg reg) const;
+    void EmitLoopWriteback();
+
+    // Tiered compilation information
+    struct ExecutionCounter {
+        std::unique_ptr<s64> remaining;
+        CodePtr entrypoint;
+    };
+    std::unordered_map<IR::LocationDescriptor, ExecutionCounter> execution_counters;
+    void EmitExecutionCounter(IR::LocationDescriptor location);
+    void ReplaceCountingBlock(IR::LocationDescriptor location, CodePtr new_entrypoint);
+
+    // Code layout information
+    /// Number of times each block has been executed since the last code layout optimization.
+    /// Only used if UserConfig::hot_code_size is non-zero.
+    std::unordered_map<IR::LocationDescriptor, std::unique_ptr<u64>> block_execution_counts;
+    void EmitBlockProfiler(IR::LocationDescriptor location);
+
+    // Fastmem information
+    using DoNotFastmemMarker = std::tuple<IR::LocationDescriptor, std::ptrdiff_t>;
+    struct FastmemPatchInfo {
+        u64 resume_rip;
+        u64 callback;
+        DoNotFastmemMarker marker;
+    };
+    std::unordered_map<u64, FastmemPatchInfo> fastmem_patch_info;
+    std::set<DoNotFastmemMarker> do_not_fastmem;
+    std::optional<DoNotFastmemMarker> ShouldFastmem(A64EmitContext& ctx, IR::Inst* inst) const;
+    FakeCall FastmemCallback(u64 rip);
+
+    // Self-modifying code detection information
+    /// Larger address spaces are mirrored into this many bits, so that several pages share an entry.
+    static constexpr size_t max_code_page_address_space_bits = 48;
+    static constexpr size_t max_code_page_leaf_bits = 16;
+    /// Two-level map with one byte per guest page, non-zero if the page contains translated code.
+    /// Leaves are only allocated for pages that have contained translated code.
+    std::vector<u8*> code_page_directory;
+    std::vector<std::unique_ptr<u8[]>> code_page_leaves;
+    size_t code_page_address_space_bits = 0;
+    size_t code_page_leaf_bits = 0;
+    bool code_pages_aliased = false;
+    std::function<void(u64 vaddr, size_t size)> code_write_handler;
+    u8* CodePageEntry(u64 vaddr, bool allocate);
+    void WatchCodePages(boost::icl::discrete_interval<u64> range);
+    void UnwatchCodePages(const boost::icl::interval_set<u64>& ranges);
+    void EmitDetectCodeWrite(A64EmitContext& ctx, Xbyak::Reg64 vaddr, size_t bitsize);
+
+    // Memory access helpers
+    void EmitFastmemRead(A64EmitContext& ctx, IR::Inst* inst, size_t bitsize, DoNotFastmemMarker marker);
+    void EmitFastmemWrite(A64EmitContext& ctx, IR::Inst* inst, size_t bitsize, DoNotFastmemMarker marker);
     void EmitDirectPageTableMemoryRead(A64EmitContext& ctx, IR::Inst* inst, size_t bitsize);
     void EmitDirectPageTableMemoryWrite(A64EmitContext& ctx, IR::Inst* inst, size_t bitsize);
+    void EmitTranslatedMemoryRead(A64EmitContext& ctx, IR::Inst* inst, size_t bitsize);
+    void EmitTranslatedMemoryWrite(A64EmitContext& ctx, IR::Inst* inst, size_t bitsize);
     void EmitExclusiveWrite(A64EmitContext& ctx, IR::Inst* inst, size_t bitsize);
 
     // Microinstruction emitters
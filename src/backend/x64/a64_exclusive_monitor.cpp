@@ -4,61 +4,83 @@
  * General Public License version 2 or any later version.
  */
 
-#include <algorithm>
-
 #include <dynarmic/A64/exclusive_monitor.h>
 #include "common/assert.h"
+#include "common/common_types.h"
 
 namespace Dynarmic {
 namespace A64 {
 
-ExclusiveMonitor::ExclusiveMonitor(size_t processor_count) : exclusive_addresses(processor_count, INVALID_EXCLUSIVE_ADDRESS) {
-    Unlock();
-}
+ExclusiveMonitor::ExclusiveMonitor(size_t processor_count) : reservations(processor_count) {}
 
 size_t ExclusiveMonitor::GetProcessorCount() const {
-    return exclusive_addresses.size();
+    return reservations.size();
 }
 
 void ExclusiveMonitor::Mark(size_t processor_id, VAddr address, size_t size) {
     ASSERT(size <= 16);
     const VAddr masked_address = address & RESERVATION_GRANULE_MASK;
 
-    Lock();
-    exclusive_addresses[processor_id] = masked_address;
-    Unlock();
+    // The shard lock is required so that a processor cannot mark (and subsequently read) an
+    // address while another processor is in the middle of an exclusive write to it.
+    Lock(masked_address);
+    reservations[processor_id].address.store(masked_address, std::memory_order_relaxed);
+    Unlock(masked_address);
 }
 
-void ExclusiveMonitor::Lock() {
+size_t ExclusiveMonitor::ShardIndex(VAddr address) {
+    // Fibonacci hashing of the granule index; neighbouring granules land in different shards.
+    const u64 granule = address >> 4;
+    return static_cast<size_t>((granule * 0x9E37'79B9'7F4A'7C15ull) >> (64 - SHARD_COUNT_BITS));
+}
+
+void ExclusiveMonitor::Lock(VAddr address) {
+    std::atomic_flag& is_locked = shards[ShardIndex(address)].is_locked;
     while (is_locked.test_and_set(std::memory_order_acquire)) {}
 }
 
-void ExclusiveMonitor::Unlock() {
-    is_locked.clear(std::memory_order_release);
+void ExclusiveMonitor::Unlock(VAddr address) {
+    shards[ShardIndex(address)].is_locked.clear(std::memory_order_release);
 }
 
 bool ExclusiveMonitor::CheckAndClear(size_t processor_id, VAddr address, size_t size) {
     ASSERT(size <= 16);
     const VAddr masked_address = address & RESERVATION_GRANULE_MASK;
 
-    Lock();
-    if (exclusive_addresses[processor_id] != masked_address) {
-        Unlock();
+    // Cheap early-out that avoids touching the shard lock at all.
+    if (reservations[processor_id].address.load(std::memory_order_relaxed) != masked_address) {
+        return false;
+    }
+
+    Lock(masked_address);
+    if (reservations[processor_id].address.load(std::memory_order_relaxed) != masked_address) {
+        Unlock(masked_address);
         return false;
     }
 
-    for (VAddr& other_address : exclusive_addresses) {
-        if (other_address == masked_address) {
-            other_address = INVALID_EXCLUSIVE_ADDRESS;
+    // Other processors may concurrently re-mark addresses belonging to other shards, so only
+    // clear reservations that still refer to this granule.
+    // A failing lock cmpxchg still takes the cache line exclusive, so look before touching.
+    for (Reservation& reservation : reservations) {
+        VAddr expected = reservation.address.load(std::memory_order_relaxed);
+        if (expected != masked_address) {
+            continue;
         }
+        reservation.address.compare_exchange_strong(expected, INVALID_EXCLUSIVE_ADDRESS, std::memory_order_relaxed);
     }
     return true;
 }
 
 void ExclusiveMonitor::Clear() {
-    Lock();
-    std::fill(exclusive_addresses.begin(), exclusive_addresses.end(), INVALID_EXCLUSIVE_ADDRESS);
-    Unlock();
+    for (Shard& shard : shards) {
+        while (shard.is_locked.test_and_set(std::memory_order_acquire)) {}
+    }
+    for (Reservation& reservation : reservations) {
+        reservation.address.store(INVALID_EXCLUSIVE_ADDRESS, std::memory_order_relaxed);
+    }
+    for (Shard& shard : shards) {
+        shard.is_locked.clear(std::memory_order_release);
+    }
 }
 
 } // namespace A64
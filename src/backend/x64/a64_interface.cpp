@@ -4,18 +4,23 @@
  * General Public License version 2 or any later version.
  */
 
+#include <algorithm>
 #include <cstring>
 #include <memory>
+#include <numeric>
 
 #include <boost/icl/interval_set.hpp>
 #include <dynarmic/A64/a64.h>
 
 #include "backend/x64/a64_emit_x64.h"
 #include "backend/x64/a64_jitstate.h"
+#include "backend/x64/a64_translation_cache.h"
+#include "backend/x64/background_translator.h"
 #include "backend/x64/block_of_code.h"
 #include "backend/x64/devirtualize.h"
 #include "backend/x64/jitstate_info.h"
 #include "common/assert.h"
+#include "common/cast_util.h"
 #include "common/llvm_disassemble.h"
 #include "common/scope_exit.h"
 #include "frontend/A64/translate/translate.h"
@@ -26,26 +31,77 @@ namespace Dynarmic::A64 {
 
 using namespace Backend::X64;
 
-static RunCodeCallbacks GenRunCodeCallbacks(A64::UserCallbacks* cb, CodePtr (*LookupBlock)(void* lookup_block_arg), void* arg) {
+static RunCodeCallbacks GenRunCodeCallbacks(const A64::UserConfig& conf, CodePtr (*LookupBlock)(void* lookup_block_arg), void* arg) {
     return RunCodeCallbacks{
         std::make_unique<ArgCallback>(LookupBlock, reinterpret_cast<u64>(arg)),
-        std::make_unique<ArgCallback>(Devirtualize<&A64::UserCallbacks::AddTicks>(cb)),
-        std::make_unique<ArgCallback>(Devirtualize<&A64::UserCallbacks::GetTicksRemaining>(cb)),
+        std::make_unique<ArgCallback>(Devirtualize<&A64::UserCallbacks::AddTicks>(conf.callbacks)),
+        std::make_unique<ArgCallback>(Devirtualize<&A64::UserCallbacks::GetTicksRemaining>(conf.callbacks)),
+        conf.tick_counter,
+        conf.tick_deadline,
+        conf.enable_ticks,
     };
 }
 
-static std::function<void(BlockOfCode&)> GenRCP(const A64::UserConfig&) {
-    return [](BlockOfCode&){};
+static LocationDescriptorCalculator GenLDC() {
+    return [](BlockOfCode& code, Xbyak::Reg64 result, Xbyak::Reg64 scratch) {
+        // This calculation has to match up with A64JitState::GetUniqueHash
+        code.mov(result, code.qword[code.r15 + offsetof(A64JitState, pc)]);
+        code.mov(scratch, A64::LocationDescriptor::pc_mask);
+        code.and_(result, scratch);
+        code.mov(scratch.cvt32(), code.dword[code.r15 + offsetof(A64JitState, fpcr)]);
+        code.and_(scratch.cvt32(), A64::LocationDescriptor::fpcr_mask);
+        code.shl(scratch, A64::LocationDescriptor::fpcr_shift);
+        code.or_(result, scratch);
+    };
+}
+
+static CodeCacheConfig GenCodeCacheConfig(const A64::UserConfig& conf) {
+    return CodeCacheConfig{
+        conf.code_cache_size,
+        conf.far_code_offset,
+        conf.constant_pool_size,
+        std::max(conf.code_cache_size, conf.code_cache_max_size),
+        conf.code_cache_regions,
+        conf.code_cache_huge_pages,
+        conf.hot_code_size,
+    };
+}
+
+static std::function<void(BlockOfCode&)> GenRCP(const A64::UserConfig& conf) {
+    return [conf](BlockOfCode& code) {
+        if (conf.fastmem_pointer) {
+            code.mov(code.r13, Common::BitCast<u64>(conf.fastmem_pointer));
+        }
+    };
 }
 
 struct Jit::Impl final {
 public:
     Impl(Jit* jit, UserConfig conf)
         : conf(conf)
-        , block_of_code(GenRunCodeCallbacks(conf.callbacks, &GetCurrentBlockThunk, this), JitStateInfo{jit_state}, GenRCP(conf))
+        , block_of_code(GenRunCodeCallbacks(conf, &GetCurrentBlockThunk, this), JitStateInfo{jit_state}, GenLDC(), GenCodeCacheConfig(conf), GenRCP(conf))
         , emitter(block_of_code, conf, jit)
     {
         ASSERT(conf.page_table_address_space_bits >= 12 && conf.page_table_address_space_bits <= 64);
+        ASSERT(conf.fastmem_address_space_bits >= 12 && conf.fastmem_address_space_bits <= 64);
+        if (!conf.page_table_level_bits.empty()) {
+            ASSERT(std::accumulate(conf.page_table_level_bits.begin(), conf.page_table_level_bits.end(), size_t(0)) == conf.page_table_address_space_bits - 12);
+            ASSERT(std::all_of(conf.page_table_level_bits.begin(), conf.page_table_level_bits.end(), [](size_t bits) { return bits >= 1; }));
+            ASSERT(std::all_of(conf.page_table_level_bits.begin() + 1, conf.page_table_level_bits.end(), [](size_t bits) { return bits < 32; }));
+        }
+        ASSERT(conf.max_blocks_per_trace >= 1);
+
+        if (conf.detect_self_modifying_code) {
+            emitter.SetCodeWriteHandler([this](u64 vaddr, size_t size) {
+                InvalidateCodeWrite(vaddr, size);
+            });
+        }
+
+        if (conf.background_compilation_threads > 0) {
+            background_translator = std::make_unique<BackgroundTranslator>(conf.background_compilation_threads, [this](IR::LocationDescriptor location) {
+                return GetTranslation(location);
+            });
+        }
     }
 
     ~Impl() = default;
@@ -71,6 +127,7 @@ public:
         block_of_code.RunCode(&jit_state, current_code_ptr);
 
         PerformRequestedCacheInvalidation();
+        PerformRequestedCodeLayout();
     }
 
     void Step() {
@@ -82,6 +139,7 @@ public:
         block_of_code.StepCode(&jit_state, GetCurrentSingleStep());
 
         PerformRequestedCacheInvalidation();
+        PerformRequestedCodeLayout();
     }
 
     void ClearCache() {
@@ -92,10 +150,31 @@ public:
     void InvalidateCacheRange(u64 start_address, size_t length) {
         const auto end_address = static_cast<u64>(start_address + length - 1);
         const auto range = boost::icl::discrete_interval<u64>::closed(start_address, end_address);
+        if (conf.translation_cache) {
+            conf.translation_cache->impl->InvalidateRanges(boost::icl::interval_set<u64>{range});
+        }
         invalid_cache_ranges.add(range);
         RequestCacheInvalidation();
     }
 
+    void InvalidateTLBRange(u64 start_address, size_t length) {
+        jit_state.InvalidateTLBRange(start_address, length);
+    }
+
+    void ClearTLB() {
+        jit_state.ResetTLB();
+    }
+
+    void OptimizeCodeLayout() {
+        code_layout_requested = true;
+        if (is_executing) {
+            jit_state.halt_requested = true;
+            return;
+        }
+
+        PerformRequestedCodeLayout();
+    }
+
     void Reset() {
         ASSERT(!is_executing);
         jit_state = {};
@@ -194,6 +273,27 @@ public:
         return is_executing;
     }
 
+    Jit::FastDispatchStatistics GetFastDispatchStatistics() const {
+        const auto statistics = emitter.GetFastDispatchStatistics();
+        return {statistics.hits, statistics.misses};
+    }
+
+    Jit::CodeCachePageBacking GetCodeCachePageBacking() const {
+        switch (block_of_code.GetPageBacking()) {
+        case PageBacking::Normal:
+            return Jit::CodeCachePageBacking::Normal;
+        case PageBacking::TransparentHugePages:
+            return Jit::CodeCachePageBacking::TransparentHugePages;
+        case PageBacking::HugePages:
+            return Jit::CodeCachePageBacking::HugePages;
+        }
+        UNREACHABLE();
+    }
+
+    Jit::CodeCacheStatistics GetCodeCacheStatistics() const {
+        return code_cache_statistics;
+    }
+
     std::string Disassemble() const {
         return Common::DisassembleX64(block_of_code.GetCodeBegin(), block_of_code.getCurr());
     }
@@ -217,27 +317,164 @@ private:
     }
 
     CodePtr GetBlock(IR::LocationDescriptor current_location) {
-        if (auto block = emitter.GetBasicBlock(current_location))
-            return block->entrypoint;
+        if (auto block = emitter.GetBasicBlock(current_location)) {
+            if (conf.tiered_compilation_threshold == 0 || !emitter.ExecutionCountExceeded(current_location)) {
+                block_of_code.MarkRegionAccessed(block->entrypoint);
+                return block->entrypoint;
+            }
+
+            // This block is hot, recompile it with all optimizations.
+            block_of_code.EnableWriting();
+            SCOPE_EXIT { block_of_code.DisableWriting(); };
+            emitter.InvalidateBasicBlocks({current_location});
+            IR::Block ir_block = GetTranslation(current_location);
+            return EmitBlock(ir_block);
+        }
+
+        const bool single_stepping = A64::LocationDescriptor{current_location}.SingleStepping();
+
+        if (background_translator && !single_stepping) {
+            PublishBackgroundTranslations();
+            if (auto block = emitter.GetBasicBlock(current_location))
+                return block->entrypoint;
+
+            // Make progress in the interpreter while this block is compiled.
+            background_translator->Request(current_location);
+            return emitter.InterpretSingleInstruction();
+        }
+
+        if (conf.tiered_compilation_threshold > 0 && !single_stepping) {
+            if (auto cached_block = GetCachedTranslation(current_location)) {
+                return EmitBlock(*cached_block);
+            }
+
+            IR::Block ir_block = Translate(current_location, false);
+            return EmitBlock(ir_block, true);
+        }
+
+        IR::Block ir_block = GetTranslation(current_location);
+        return EmitBlock(ir_block);
+    }
+
+    void PublishBackgroundTranslations() {
+        std::vector<IR::Block> completed = background_translator->TakeCompleted();
+        if (completed.empty()) {
+            return;
+        }
+
+        block_of_code.EnableWriting();
+        SCOPE_EXIT { block_of_code.DisableWriting(); };
+        for (IR::Block& ir_block : completed) {
+            if (emitter.GetBasicBlock(ir_block.Location())) {
+                continue;
+            }
+            EmitBlock(ir_block);
+        }
+    }
+
+    CodePtr EmitBlock(IR::Block& ir_block, bool count_executions = false) {
+        // Eviction and emission each modify code; change permissions only once for both.
+        block_of_code.EnableWriting();
+        SCOPE_EXIT { block_of_code.DisableWriting(); };
 
         constexpr size_t MINIMUM_REMAINING_CODESIZE = 1 * 1024 * 1024;
         if (block_of_code.SpaceRemaining() < MINIMUM_REMAINING_CODESIZE) {
-            // Immediately evacuate cache
-            invalidate_entire_cache = true;
-            PerformRequestedCacheInvalidation();
+            if (block_of_code.Grow()) {
+                code_cache_statistics.grows++;
+            } else if (block_of_code.RegionCount() == 1) {
+                // Immediately evacuate cache
+                code_cache_statistics.flushes++;
+                invalidate_entire_cache = true;
+                PerformRequestedCacheInvalidation();
+            } else {
+                // Reuse a region whose code is least likely to be needed
+                jit_state.ResetRSB();
+                if (!emitter.EvictCodeRegion(block_of_code.AdvanceRegion()).empty()) {
+                    code_cache_statistics.region_evictions++;
+                }
+            }
+        }
+
+        if (conf.code_layout_interval > 0 && ++blocks_since_code_layout >= conf.code_layout_interval) {
+            code_layout_requested = true;
+        }
+
+        // Tier-0 blocks are left unoptimized.
+        if (!count_executions) {
+            PrepareForEmission(ir_block);
+        }
+
+        return emitter.Emit(ir_block, count_executions).entrypoint;
+    }
+
+    IR::Block GetTranslation(IR::LocationDescriptor current_location) {
+        if (!conf.translation_cache) {
+            return Translate(current_location);
+        }
+
+        if (auto cached_block = GetCachedTranslation(current_location)) {
+            return std::move(*cached_block);
         }
 
+        TranslationCache::Impl& translation_cache = *conf.translation_cache->impl;
+        const u64 generation = translation_cache.CurrentGeneration();
+        IR::Block ir_block = Translate(current_location);
+        translation_cache.Insert(ir_block, generation, [this](u64 vaddr) { return conf.callbacks->MemoryReadCode(vaddr); });
+        return ir_block;
+    }
+
+    std::optional<IR::Block> GetCachedTranslation(IR::LocationDescriptor current_location) {
+        if (!conf.translation_cache) {
+            return std::nullopt;
+        }
+        return conf.translation_cache->impl->Get(current_location, [this](u64 vaddr) { return conf.callbacks->MemoryReadCode(vaddr); });
+    }
+
+    IR::Block Translate(IR::LocationDescriptor current_location, bool optimize = true) {
         // JIT Compile
         const auto get_code = [this](u64 vaddr) { return conf.callbacks->MemoryReadCode(vaddr); };
-        IR::Block ir_block = A64::Translate(A64::LocationDescriptor{current_location}, get_code, {conf.define_unpredictable_behaviour});
+        IR::Block ir_block = A64::Translate(A64::LocationDescriptor{current_location}, get_code, {conf.define_unpredictable_behaviour, true, conf.max_blocks_per_trace});
         Optimization::A64CallbackConfigPass(ir_block, conf);
-        Optimization::A64GetSetElimination(ir_block);
+        if (optimize) {
+            Optimization::A64GetSetElimination(ir_block);
+            Optimization::ConstantPropagation(ir_block);
+            Optimization::DeadCodeElimination(ir_block);
+            Optimization::A64MergeInterpretBlocksPass(ir_block, conf.callbacks);
+        }
+        // printf("%s\n", IR::DumpBlock(ir_block).c_str());
+        Optimization::VerificationPass(ir_block);
+        return ir_block;
+    }
+
+    /// Runs the passes whose output depends on this Jit's memory configuration or on guest data.
+    /// Translations are shared between Jits, so these run on the block about to be emitted instead.
+    /// This is always called on the thread calling Run, so data may be read through the callbacks.
+    void PrepareForEmission(IR::Block& ir_block) {
+        Optimization::A64ConstantMemoryReads(ir_block, conf.callbacks);
         Optimization::ConstantPropagation(ir_block);
         Optimization::DeadCodeElimination(ir_block);
-        Optimization::A64MergeInterpretBlocksPass(ir_block, conf.callbacks);
-        // printf("%s\n", IR::DumpBlock(ir_block).c_str());
+        Optimization::A64CoalesceMemoryAccesses(ir_block, conf);
         Optimization::VerificationPass(ir_block);
-        return emitter.Emit(ir_block).entrypoint;
+    }
+
+    /// Called when the guest stores to a page containing translated code.
+    /// Unlike InvalidateCacheRange this takes effect immediately: the block containing the store
+    /// continues executing from code that is not freed, but no stale block is entered afterwards.
+    void InvalidateCodeWrite(u64 vaddr, size_t size) {
+        if (invalidate_entire_cache) {
+            // Everything will be invalidated upon return from Run anyway.
+            return;
+        }
+
+        const auto range = boost::icl::discrete_interval<u64>::closed(vaddr, static_cast<u64>(vaddr + size - 1));
+        if (conf.translation_cache) {
+            conf.translation_cache->impl->InvalidateRanges(boost::icl::interval_set<u64>{range});
+        }
+        jit_state.ResetRSB();
+        if (background_translator) {
+            background_translator->Invalidate();
+        }
+        emitter.InvalidateCacheRanges(boost::icl::interval_set<u64>{range});
     }
 
     void RequestCacheInvalidation() {
@@ -255,6 +492,9 @@ private:
         }
 
         jit_state.ResetRSB();
+        if (background_translator) {
+            background_translator->Invalidate();
+        }
         if (invalidate_entire_cache) {
             block_of_code.ClearCache();
             emitter.ClearCache();
@@ -265,6 +505,22 @@ private:
         invalidate_entire_cache = false;
     }
 
+    void PerformRequestedCodeLayout() {
+        if (!code_layout_requested) {
+            return;
+        }
+
+        // Blocks in the hot region are about to be replaced.
+        jit_state.ResetRSB();
+        emitter.OptimizeCodeLayout([this](IR::LocationDescriptor location) {
+            IR::Block ir_block = GetTranslation(location);
+            PrepareForEmission(ir_block);
+            return ir_block;
+        });
+        code_layout_requested = false;
+        blocks_since_code_layout = 0;
+    }
+
     bool is_executing = false;
 
     UserConfig conf;
@@ -274,6 +530,14 @@ private:
 
     bool invalidate_entire_cache = false;
     boost::icl::interval_set<u64> invalid_cache_ranges;
+
+    bool code_layout_requested = false;
+    size_t blocks_since_code_layout = 0;
+
+    Jit::CodeCacheStatistics code_cache_statistics;
+
+    // Declared last so that worker threads are stopped before anything they use is destroyed.
+    std::unique_ptr<BackgroundTranslator> background_translator;
 };
 
 Jit::Jit(UserConfig conf)
@@ -297,6 +561,18 @@ void Jit::InvalidateCacheRange(u64 start_address, size_t length) {
     impl->InvalidateCacheRange(start_address, length);
 }
 
+void Jit::InvalidateTLBRange(u64 start_address, size_t length) {
+    impl->InvalidateTLBRange(start_address, length);
+}
+
+void Jit::ClearTLB() {
+    impl->ClearTLB();
+}
+
+void Jit::OptimizeCodeLayout() {
+    impl->OptimizeCodeLayout();
+}
+
 void Jit::Reset() {
     impl->Reset();
 }
@@ -385,6 +661,18 @@ bool Jit::IsExecuting() const {
     return impl->IsExecuting();
 }
 
+Jit::FastDispatchStatistics Jit::GetFastDispatchStatistics() const {
+    return impl->GetFastDispatchStatistics();
+}
+
+Jit::CodeCachePageBacking Jit::GetCodeCachePageBacking() const {
+    return impl->GetCodeCachePageBacking();
+}
+
+Jit::CodeCacheStatistics Jit::GetCodeCacheStatistics() const {
+    return impl->GetCodeCacheStatistics();
+}
+
 std::string Jit::Disassemble() const {
     return impl->Disassemble();
 }
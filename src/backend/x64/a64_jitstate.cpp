@@ -108,4 +108,28 @@ void A64JitState::SetFpsr(u32 value) {
     fpsr_exc = value & 0x9F;
 }
 
+void A64JitState::InvalidateTLBRange(u64 start_address, size_t length) {
+    if (length == 0) {
+        return;
+    }
+
+    const u64 first_page = start_address >> TLBPageBits;
+    const u64 last_page = (start_address + length - 1) >> TLBPageBits;
+
+    // Every entry would be visited anyway, or the range wraps around the address space.
+    if (length > (TLBSize << TLBPageBits) || last_page < first_page) {
+        ResetTLB();
+        return;
+    }
+
+    for (u64 page = first_page; page != last_page + 1; page++) {
+        const size_t index = static_cast<size_t>(page & (TLBSize - 1));
+        for (auto* tlb : {&read_tlb, &write_tlb}) {
+            if ((*tlb)[index].tag == page << TLBPageBits) {
+                (*tlb)[index] = {InvalidTLBTag, 0};
+            }
+        }
+    }
+}
+
 } // namespace Dynarmic::Backend::X64
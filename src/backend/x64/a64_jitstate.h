@@ -25,7 +25,7 @@ class BlockOfCode;
 struct A64JitState {
     using ProgramCounterType = u64;
 
-    A64JitState() { ResetRSB(); }
+    A64JitState() { ResetRSB(); ResetTLB(); }
 
     std::array<u64, 31> reg{};
     u64 sp = 0;
@@ -85,6 +85,23 @@ struct A64JitState {
         const u64 pc_u64 = pc & A64::LocationDescriptor::pc_mask;
         return pc_u64 | fpcr_u64;
     }
+
+    // Software TLB caching page_table lookups (See: A64EmitX64 EmitVAddrLookup)
+    struct TLBEntry {
+        u64 tag;    // Virtual address of the page. Never page-aligned if the entry is invalid.
+        u64 addend; // Added to a virtual address within the page to obtain the host address.
+    };
+    static_assert(sizeof(TLBEntry) == 16);
+    static constexpr size_t TLBSize = 128; // MUST be a power of 2.
+    static constexpr size_t TLBPageBits = 12;
+    static constexpr u64 InvalidTLBTag = 0xFFFFFFFFFFFFFFFFull;
+    std::array<TLBEntry, TLBSize> read_tlb;
+    std::array<TLBEntry, TLBSize> write_tlb;
+    void ResetTLB() {
+        read_tlb.fill({InvalidTLBTag, 0});
+        write_tlb.fill({InvalidTLBTag, 0});
+    }
+    void InvalidateTLBRange(u64 start_address, size_t length);
 };
 
 #ifdef _MSC_VER
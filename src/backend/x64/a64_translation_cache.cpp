@@ -0,0 +1,259 @@
+/* This file is part of the dynarmic project.
+ * Copyright (c) 2020 MerryMage
+ * This software may be used and distributed according to the terms of the GNU
+ * General Public License version 2 or any later version.
+ */
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <vector>
+
+#include <dynarmic/A64/translation_cache.h>
+
+#include "backend/x64/a64_translation_cache.h"
+#include "common/crypto/crc32.h"
+#include "frontend/A64/location_descriptor.h"
+#include "frontend/ir/serialization.h"
+
+namespace Dynarmic::A64 {
+
+namespace {
+
+constexpr u64 file_magic = 0x4354'3436'414E'5944; // "DYNA64TC"
+constexpr size_t file_header_size = 3 * sizeof(u64);
+
+struct Hasher {
+    u32 crc_iso = 0;
+    u32 crc_castagnoli = 0;
+
+    void Add(u64 value, int length) {
+        crc_iso = Common::Crypto::CRC32::ComputeCRC32ISO(crc_iso, value, length);
+        crc_castagnoli = Common::Crypto::CRC32::ComputeCRC32Castagnoli(crc_castagnoli, value, length);
+    }
+
+    u64 Get() const {
+        return (u64{crc_iso} << 32) | crc_castagnoli;
+    }
+};
+
+u64 HashGuestCode(const IR::Block& block, const MemoryReadCodeFuncType& get_code) {
+    Hasher hasher;
+    const auto add_range = [&](IR::LocationDescriptor start, IR::LocationDescriptor end) {
+        const u64 end_pc = A64::LocationDescriptor{end}.PC();
+        for (u64 pc = A64::LocationDescriptor{start}.PC(); pc < end_pc; pc += 4) {
+            hasher.Add(get_code(pc), 4);
+        }
+    };
+
+    add_range(block.Location(), block.EndLocation());
+    for (const auto& [start, end] : block.AdditionalCodeRanges()) {
+        add_range(start, end);
+    }
+    return hasher.Get();
+}
+
+u64 HashBytes(const u8* data, size_t size) {
+    Hasher hasher;
+    for (size_t i = 0; i < size; i += sizeof(u64)) {
+        const size_t length = std::min(sizeof(u64), size - i);
+        u64 value = 0;
+        std::memcpy(&value, data + i, length);
+        hasher.Add(value, static_cast<int>(length));
+    }
+    return hasher.Get();
+}
+
+void WriteU64(std::vector<u8>& out, u64 value) {
+    const size_t pos = out.size();
+    out.resize(pos + sizeof(u64));
+    std::memcpy(out.data() + pos, &value, sizeof(u64));
+}
+
+std::optional<u64> ReadU64(const std::vector<u8>& data, size_t& pos) {
+    if (pos > data.size() || data.size() - pos < sizeof(u64)) {
+        return std::nullopt;
+    }
+    u64 value;
+    std::memcpy(&value, data.data() + pos, sizeof(u64));
+    pos += sizeof(u64);
+    return value;
+}
+
+} // anonymous namespace
+
+std::optional<IR::Block> TranslationCache::Impl::Get(IR::LocationDescriptor location, const MemoryReadCodeFuncType& get_code) {
+    std::lock_guard<std::mutex> lock{mutex};
+
+    const auto iter = blocks.find(location);
+    if (iter == blocks.end()) {
+        statistics.misses++;
+        return std::nullopt;
+    }
+
+    Entry& entry = iter->second;
+    if (!entry.verified) {
+        if (HashGuestCode(entry.block, get_code) != entry.code_hash) {
+            // Guest code has changed since this translation was saved.
+            blocks.erase(iter);
+            statistics.discarded++;
+            statistics.misses++;
+            return std::nullopt;
+        }
+        entry.verified = true;
+    }
+    statistics.hits++;
+    return entry.block.Clone();
+}
+
+u64 TranslationCache::Impl::CurrentGeneration() {
+    std::lock_guard<std::mutex> lock{mutex};
+    return generation;
+}
+
+void TranslationCache::Impl::Insert(const IR::Block& block, u64 block_generation, const MemoryReadCodeFuncType& get_code) {
+    const u64 code_hash = HashGuestCode(block, get_code);
+
+    std::lock_guard<std::mutex> lock{mutex};
+
+    if (block_generation != generation) {
+        return;
+    }
+
+    InsertEntry(block.Clone(), code_hash, true);
+}
+
+void TranslationCache::Impl::InsertEntry(IR::Block block, u64 code_hash, bool verified) {
+    const A64::LocationDescriptor descriptor{block.Location()};
+    const A64::LocationDescriptor end_location{block.EndLocation()};
+    const auto range = boost::icl::discrete_interval<u64>::closed(descriptor.PC(), end_location.PC() - 1);
+
+    block_ranges.AddRange(range, descriptor);
+    for (const auto& [start, end] : block.AdditionalCodeRanges()) {
+        const auto additional_range = boost::icl::discrete_interval<u64>::closed(A64::LocationDescriptor{start}.PC(), A64::LocationDescriptor{end}.PC() - 1);
+        block_ranges.AddRange(additional_range, descriptor);
+    }
+    blocks.insert_or_assign(block.Location(), Entry{std::move(block), code_hash, verified});
+}
+
+void TranslationCache::Impl::InvalidateRanges(const boost::icl::interval_set<u64>& ranges) {
+    std::lock_guard<std::mutex> lock{mutex};
+
+    generation++;
+    for (const auto& location : block_ranges.InvalidateRanges(ranges)) {
+        blocks.erase(location);
+    }
+}
+
+void TranslationCache::Impl::Clear() {
+    std::lock_guard<std::mutex> lock{mutex};
+
+    generation++;
+    blocks.clear();
+    block_ranges.ClearCache();
+}
+
+bool TranslationCache::Impl::SaveToFile(const std::string& path) {
+    std::vector<u8> payload;
+    {
+        std::lock_guard<std::mutex> lock{mutex};
+
+        WriteU64(payload, blocks.size());
+        for (const auto& [location, entry] : blocks) {
+            WriteU64(payload, entry.code_hash);
+            IR::SerializeBlock(entry.block, payload);
+        }
+    }
+
+    std::vector<u8> header;
+    WriteU64(header, file_magic);
+    WriteU64(header, IR::SerializationFingerprint());
+    WriteU64(header, HashBytes(payload.data(), payload.size()));
+
+    std::ofstream file{path, std::ios::binary | std::ios::trunc};
+    file.write(reinterpret_cast<const char*>(header.data()), static_cast<std::streamsize>(header.size()));
+    file.write(reinterpret_cast<const char*>(payload.data()), static_cast<std::streamsize>(payload.size()));
+    return static_cast<bool>(file);
+}
+
+bool TranslationCache::Impl::LoadFromFile(const std::string& path) {
+    std::ifstream file{path, std::ios::binary};
+    if (!file) {
+        return false;
+    }
+    const std::vector<u8> data{std::istreambuf_iterator<char>{file}, std::istreambuf_iterator<char>{}};
+
+    size_t pos = 0;
+    if (ReadU64(data, pos) != file_magic || ReadU64(data, pos) != IR::SerializationFingerprint()) {
+        return false;
+    }
+    const auto checksum = ReadU64(data, pos);
+    if (!checksum || *checksum != HashBytes(data.data() + file_header_size, data.size() - file_header_size)) {
+        return false;
+    }
+
+    const auto count = ReadU64(data, pos);
+    if (!count) {
+        return false;
+    }
+
+    std::vector<Entry> entries;
+    for (u64 i = 0; i < *count; i++) {
+        const auto code_hash = ReadU64(data, pos);
+        if (!code_hash) {
+            return false;
+        }
+        auto block = IR::DeserializeBlock(data, pos);
+        if (!block) {
+            return false;
+        }
+        entries.push_back(Entry{std::move(*block), *code_hash, false});
+    }
+    if (pos != data.size()) {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock{mutex};
+    for (auto& entry : entries) {
+        if (blocks.count(entry.block.Location())) {
+            continue;
+        }
+        InsertEntry(std::move(entry.block), entry.code_hash, false);
+    }
+    return true;
+}
+
+TranslationCache::Statistics TranslationCache::Impl::GetStatistics() {
+    std::lock_guard<std::mutex> lock{mutex};
+    return statistics;
+}
+
+TranslationCache::TranslationCache() : impl(std::make_unique<Impl>()) {}
+
+TranslationCache::~TranslationCache() = default;
+
+void TranslationCache::InvalidateCacheRange(VAddr start_address, std::size_t length) {
+    const auto end_address = static_cast<u64>(start_address + length - 1);
+    boost::icl::interval_set<u64> ranges;
+    ranges.add(boost::icl::discrete_interval<u64>::closed(start_address, end_address));
+    impl->InvalidateRanges(ranges);
+}
+
+void TranslationCache::ClearCache() {
+    impl->Clear();
+}
+
+bool TranslationCache::SaveToFile(const std::string& path) const {
+    return impl->SaveToFile(path);
+}
+
+bool TranslationCache::LoadFromFile(const std::string& path) {
+    return impl->LoadFromFile(path);
+}
+
+TranslationCache::Statistics TranslationCache::GetStatistics() const {
+    return impl->GetStatistics();
+}
+
+} // namespace Dynarmic::A64
@@ -0,0 +1,64 @@
+/* This file is part of the dynarmic project.
+ * Copyright (c) 2020 MerryMage
+ * This software may be used and distributed according to the terms of the GNU
+ * General Public License version 2 or any later version.
+ */
+
+#pragma once
+
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+
+#include <boost/icl/interval_set.hpp>
+#include <dynarmic/A64/translation_cache.h>
+
+#include "backend/x64/block_range_information.h"
+#include "common/common_types.h"
+#include "frontend/A64/translate/translate.h"
+#include "frontend/ir/basic_block.h"
+#include "frontend/ir/location_descriptor.h"
+
+namespace Dynarmic::A64 {
+
+struct TranslationCache::Impl final {
+    /// Returns a copy of the cached translation of the block at location, if there is one.
+    /// Translations loaded from a file are checked against the guest code read through get_code
+    /// the first time they are requested.
+    std::optional<IR::Block> Get(IR::LocationDescriptor location, const MemoryReadCodeFuncType& get_code);
+
+    /// Returns a token to be passed to Insert. This must be obtained before guest code is read.
+    u64 CurrentGeneration();
+
+    /// Caches a copy of block. This does nothing if any invalidation has happened since generation
+    /// was obtained, as block may have been translated from stale guest code.
+    void Insert(const IR::Block& block, u64 generation, const MemoryReadCodeFuncType& get_code);
+
+    void InvalidateRanges(const boost::icl::interval_set<u64>& ranges);
+    void Clear();
+
+    bool SaveToFile(const std::string& path);
+    bool LoadFromFile(const std::string& path);
+
+    TranslationCache::Statistics GetStatistics();
+
+private:
+    struct Entry {
+        IR::Block block;
+        /// Hash of the guest code the block was translated from.
+        u64 code_hash;
+        /// False if this entry was loaded from a file and has not been checked against guest code yet.
+        bool verified;
+    };
+
+    void InsertEntry(IR::Block block, u64 code_hash, bool verified);
+
+    std::mutex mutex;
+    u64 generation = 0;
+    TranslationCache::Statistics statistics;
+    std::unordered_map<IR::LocationDescriptor, Entry> blocks;
+    Backend::X64::BlockRangeInformation<u64> block_ranges;
+};
+
+} // namespace Dynarmic::A64
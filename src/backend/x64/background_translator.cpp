@@ -0,0 +1,96 @@
+/* This file is part of the dynarmic project.
+ * Copyright (c) 2020 MerryMage
+ * This software may be used and distributed according to the terms of the GNU
+ * General Public License version 2 or any later version.
+ */
+
+#include "backend/x64/background_translator.h"
+#include "common/assert.h"
+
+namespace Dynarmic::Backend::X64 {
+
+BackgroundTranslator::BackgroundTranslator(size_t num_threads, TranslateFn translate)
+    : translate(std::move(translate))
+{
+    ASSERT(num_threads > 0);
+    threads.reserve(num_threads);
+    for (size_t i = 0; i < num_threads; i++) {
+        threads.emplace_back([this]{ WorkerThread(); });
+    }
+}
+
+BackgroundTranslator::~BackgroundTranslator() {
+    {
+        std::lock_guard lock{mutex};
+        stopping = true;
+    }
+    work_available.notify_all();
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
+
+void BackgroundTranslator::Request(IR::LocationDescriptor location) {
+    {
+        std::lock_guard lock{mutex};
+        if (!requested.emplace(location).second) {
+            return;
+        }
+        queue.push_back(location);
+    }
+    work_available.notify_one();
+}
+
+std::vector<IR::Block> BackgroundTranslator::TakeCompleted() {
+    if (!has_completed.load(std::memory_order_acquire)) {
+        return {};
+    }
+
+    std::lock_guard lock{mutex};
+
+    std::vector<IR::Block> result;
+    result.reserve(completed.size());
+    for (auto& block : completed) {
+        requested.erase(block.Location());
+        result.emplace_back(std::move(block));
+    }
+    completed.clear();
+    has_completed.store(false, std::memory_order_relaxed);
+    return result;
+}
+
+void BackgroundTranslator::Invalidate() {
+    std::lock_guard lock{mutex};
+    generation++;
+    queue.clear();
+    requested.clear();
+    completed.clear();
+    has_completed.store(false, std::memory_order_relaxed);
+}
+
+void BackgroundTranslator::WorkerThread() {
+    std::unique_lock lock{mutex};
+    while (true) {
+        work_available.wait(lock, [this]{ return stopping || !queue.empty(); });
+        if (stopping) {
+            return;
+        }
+
+        const IR::LocationDescriptor location = queue.front();
+        queue.pop_front();
+        const u64 request_generation = generation;
+
+        lock.unlock();
+        IR::Block block = translate(location);
+        lock.lock();
+
+        if (request_generation != generation) {
+            // Guest code may have changed while we were translating.
+            continue;
+        }
+        completed.emplace_back(std::move(block));
+        has_completed.store(true, std::memory_order_release);
+    }
+}
+
+} // namespace Dynarmic::Backend::X64
@@ -0,0 +1,67 @@
+/* This file is part of the dynarmic project.
+ * Copyright (c) 2020 MerryMage
+ * This software may be used and distributed according to the terms of the GNU
+ * General Public License version 2 or any later version.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+#include "common/common_types.h"
+#include "frontend/ir/basic_block.h"
+#include "frontend/ir/location_descriptor.h"
+
+namespace Dynarmic::Backend::X64 {
+
+/**
+ * Translates and optimizes blocks on a pool of worker threads.
+ * Emission is not performed here as it must happen on the thread that owns the BlockOfCode.
+ */
+class BackgroundTranslator final {
+public:
+    using TranslateFn = std::function<IR::Block(IR::LocationDescriptor)>;
+
+    /// translate is called concurrently from num_threads threads.
+    BackgroundTranslator(size_t num_threads, TranslateFn translate);
+    ~BackgroundTranslator();
+
+    BackgroundTranslator(const BackgroundTranslator&) = delete;
+    BackgroundTranslator& operator=(const BackgroundTranslator&) = delete;
+
+    /// Queues the block at location for translation, unless it is already queued or in progress.
+    void Request(IR::LocationDescriptor location);
+
+    /// Removes and returns all translations that have completed since the last call.
+    std::vector<IR::Block> TakeCompleted();
+
+    /// Discards all queued requests. Translations that are currently in progress are discarded
+    /// when they complete. Call this whenever guest code may have changed.
+    void Invalidate();
+
+private:
+    void WorkerThread();
+
+    TranslateFn translate;
+
+    std::mutex mutex;
+    std::condition_variable work_available;
+    bool stopping = false;
+    u64 generation = 0;
+    std::deque<IR::LocationDescriptor> queue;
+    /// Locations that have been requested but whose translation has not yet been taken.
+    std::unordered_set<IR::LocationDescriptor> requested;
+    std::vector<IR::Block> completed;
+    std::atomic<bool> has_completed{false};
+
+    std::vector<std::thread> threads;
+};
+
+} // namespace Dynarmic::Backend::X64
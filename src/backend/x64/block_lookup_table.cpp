@@ -0,0 +1,156 @@
+/* This file is part of the dynarmic project.
+ * Copyright (c) 2020 MerryMage
+ * This software may be used and distributed according to the terms of the GNU
+ * General Public License version 2 or any later version.
+ */
+
+#include <cstddef>
+#include <utility>
+
+#include "backend/x64/block_lookup_table.h"
+#include "common/assert.h"
+
+namespace Dynarmic::Backend::X64 {
+
+namespace {
+constexpr size_t initial_capacity = 1024;
+} // anonymous namespace
+
+BlockLookupTable::BlockLookupTable() {
+    Rehash(initial_capacity);
+}
+
+size_t BlockLookupTable::IndexOf(u64 location_descriptor) const {
+    const size_t mask = Capacity() - 1;
+    for (size_t index = Hash(location_descriptor) & mask;; index = (index + 1) & mask) {
+        const u64 current = entries[index].location_descriptor;
+        if (current == location_descriptor || current == empty_location_descriptor) {
+            return index;
+        }
+    }
+}
+
+std::optional<BlockLookupTable::BlockDescriptor> BlockLookupTable::Find(u64 location_descriptor) const {
+    const size_t index = IndexOf(location_descriptor);
+    if (entries[index].location_descriptor == empty_location_descriptor) {
+        return std::nullopt;
+    }
+    return BlockDescriptor{entries[index].entrypoint, sizes[index]};
+}
+
+void BlockLookupTable::Insert(u64 location_descriptor, BlockDescriptor block) {
+    ASSERT(location_descriptor != empty_location_descriptor);
+
+    // Keep the load factor at most one half so that probe sequences remain short.
+    if ((size + 1) * 2 > Capacity()) {
+        Rehash(Capacity() * 2);
+    }
+
+    const size_t index = IndexOf(location_descriptor);
+    if (entries[index].location_descriptor != empty_location_descriptor) {
+        return;
+    }
+    entries[index] = {location_descriptor, block.entrypoint};
+    sizes[index] = block.size;
+    size++;
+}
+
+bool BlockLookupTable::Erase(u64 location_descriptor) {
+    const size_t index = IndexOf(location_descriptor);
+    if (entries[index].location_descriptor == empty_location_descriptor) {
+        return false;
+    }
+    EraseAt(index);
+    return true;
+}
+
+void BlockLookupTable::EraseAt(size_t index) {
+    const size_t mask = Capacity() - 1;
+
+    // Backward shift deletion: move later members of the probe sequence into the hole so that no tombstones are required.
+    size_t hole = index;
+    for (size_t next = (hole + 1) & mask; entries[next].location_descriptor != empty_location_descriptor; next = (next + 1) & mask) {
+        const size_t home = Hash(entries[next].location_descriptor) & mask;
+        // The entry at next may only move to hole if hole lies cyclically within [home, next).
+        if (((next - home) & mask) >= ((next - hole) & mask)) {
+            entries[hole] = entries[next];
+            sizes[hole] = sizes[next];
+            hole = next;
+        }
+    }
+
+    entries[hole] = {empty_location_descriptor, nullptr};
+    sizes[hole] = 0;
+    size--;
+}
+
+std::vector<u64> BlockLookupTable::EraseIf(const std::function<bool(const BlockDescriptor&)>& predicate) {
+    std::vector<u64> erased;
+    for (size_t i = 0; i < Capacity(); i++) {
+        const Entry& entry = entries[i];
+        if (entry.location_descriptor != empty_location_descriptor && predicate(BlockDescriptor{entry.entrypoint, sizes[i]})) {
+            erased.emplace_back(entry.location_descriptor);
+        }
+    }
+    for (u64 location_descriptor : erased) {
+        Erase(location_descriptor);
+    }
+    return erased;
+}
+
+void BlockLookupTable::Clear() {
+    entries.assign(Capacity(), Entry{empty_location_descriptor, nullptr});
+    sizes.assign(Capacity(), 0);
+    size = 0;
+}
+
+void BlockLookupTable::Rehash(size_t new_capacity) {
+    std::vector<Entry> old_entries = std::exchange(entries, std::vector<Entry>(new_capacity, Entry{empty_location_descriptor, nullptr}));
+    std::vector<size_t> old_sizes = std::exchange(sizes, std::vector<size_t>(new_capacity, 0));
+    size = 0;
+
+    for (size_t i = 0; i < old_entries.size(); i++) {
+        if (old_entries[i].location_descriptor != empty_location_descriptor) {
+            const size_t index = IndexOf(old_entries[i].location_descriptor);
+            entries[index] = old_entries[i];
+            sizes[index] = old_sizes[i];
+            size++;
+        }
+    }
+
+    UpdateEmittedCodeView();
+}
+
+void BlockLookupTable::UpdateEmittedCodeView() {
+    ASSERT(Capacity() * sizeof(Entry) <= (u64(1) << 32));
+    emitted_code_view.entries = entries.data();
+    emitted_code_view.mask = (Capacity() - 1) * sizeof(Entry);
+}
+
+void BlockLookupTable::EmitLookup(Xbyak::CodeGenerator& code, Xbyak::Reg64 result, Xbyak::Reg64 key, Xbyak::Reg64 index, Xbyak::Reg64 base, Xbyak::Label& miss) const {
+    Xbyak::Label loop, hit;
+
+    // index = Hash(key) * sizeof(Entry), masked at the start of each iteration.
+    code.mov(base, reinterpret_cast<u64>(&emitted_code_view));
+    code.mov(index, hash_multiplier);
+    code.imul(index, key);
+    code.shr(index, 32);
+    code.shl(index, 4);
+    static_assert(sizeof(Entry) == 1 << 4);
+
+    code.L(loop);
+    code.and_(index, code.qword[base + offsetof(EmittedCodeView, mask)]);
+    code.mov(result, code.qword[base + offsetof(EmittedCodeView, entries)]);
+    code.cmp(key, code.qword[result + index + offsetof(Entry, location_descriptor)]);
+    code.je(hit);
+    // The immediate is sign-extended to empty_location_descriptor.
+    code.cmp(code.qword[result + index + offsetof(Entry, location_descriptor)], static_cast<u32>(empty_location_descriptor));
+    code.je(miss, code.T_NEAR);
+    code.add(index, sizeof(Entry));
+    code.jmp(loop);
+
+    code.L(hit);
+    code.mov(result, code.qword[result + index + offsetof(Entry, entrypoint)]);
+}
+
+} // namespace Dynarmic::Backend::X64
@@ -0,0 +1,87 @@
+/* This file is part of the dynarmic project.
+ * Copyright (c) 2020 MerryMage
+ * This software may be used and distributed according to the terms of the GNU
+ * General Public License version 2 or any later version.
+ */
+
+#pragma once
+
+#include <functional>
+#include <optional>
+#include <vector>
+
+#include <xbyak.h>
+
+#include "common/common_types.h"
+
+namespace Dynarmic::Backend::X64 {
+
+using CodePtr = const void*;
+
+/**
+ * Maps location descriptors to emitted blocks.
+ * This is an open-addressed hash table with linear probing so that it can be probed directly by emitted code.
+ */
+class BlockLookupTable final {
+public:
+    struct BlockDescriptor {
+        CodePtr entrypoint;  // Entrypoint of emitted code
+        size_t size;         // Length in bytes of emitted code
+    };
+
+    BlockLookupTable();
+
+    BlockLookupTable(const BlockLookupTable&) = delete;
+    BlockLookupTable& operator=(const BlockLookupTable&) = delete;
+
+    std::optional<BlockDescriptor> Find(u64 location_descriptor) const;
+    /// Does nothing if location_descriptor is already present.
+    void Insert(u64 location_descriptor, BlockDescriptor block);
+    /// @returns true if location_descriptor was present.
+    bool Erase(u64 location_descriptor);
+    /// Removes every block for which predicate returns true.
+    /// @returns the location descriptors of the removed blocks.
+    std::vector<u64> EraseIf(const std::function<bool(const BlockDescriptor&)>& predicate);
+    void Clear();
+
+    size_t Size() const { return size; }
+
+    /**
+     * Emits code that looks up the location descriptor in key.
+     * On a hit, result contains the entrypoint. On a miss, jumps to miss.
+     * Only result, index and base are modified.
+     */
+    void EmitLookup(Xbyak::CodeGenerator& code, Xbyak::Reg64 result, Xbyak::Reg64 key, Xbyak::Reg64 index, Xbyak::Reg64 base, Xbyak::Label& miss) const;
+
+private:
+    struct Entry {
+        u64 location_descriptor;
+        CodePtr entrypoint;
+    };
+    static_assert(sizeof(Entry) == 0x10);
+
+    static constexpr u64 empty_location_descriptor = 0xFFFFFFFFFFFFFFFFull;
+    static constexpr u64 hash_multiplier = 0x9E3779B97F4A7C15ull;
+
+    static size_t Hash(u64 location_descriptor) {
+        return static_cast<size_t>((location_descriptor * hash_multiplier) >> 32);
+    }
+
+    size_t Capacity() const { return entries.size(); }
+    size_t IndexOf(u64 location_descriptor) const;
+    void EraseAt(size_t index);
+    void Rehash(size_t new_capacity);
+    void UpdateEmittedCodeView();
+
+    std::vector<Entry> entries;
+    std::vector<size_t> sizes;
+    size_t size = 0;
+
+    // Read by emitted code. Updated whenever entries is reallocated.
+    struct EmittedCodeView {
+        const Entry* entries = nullptr;
+        u64 mask = 0;  // Mask of byte offsets into entries
+    } emitted_code_view;
+};
+
+} // namespace Dynarmic::Backend::X64
@@ -4,8 +4,14 @@
  * General Public License version 2 or any later version.
  */
 
+#include <algorithm>
 #include <array>
+#include <cstdio>
 #include <cstring>
+#include <limits>
+#include <mutex>
+#include <tuple>
+#include <unordered_map>
 
 #include <xbyak.h>
 
@@ -19,6 +25,7 @@
     #include <windows.h>
 #else
     #include <sys/mman.h>
+    #include <unistd.h>
 #endif
 
 namespace Dynarmic::Backend::X64 {
@@ -44,19 +51,278 @@ const std::array<Xbyak::Reg64, 6> BlockOfCode::ABI_PARAMS = {BlockOfCode::ABI_PA
 
 namespace {
 
-constexpr size_t TOTAL_CODE_SIZE = 128 * 1024 * 1024;
-constexpr size_t FAR_CODE_OFFSET = 100 * 1024 * 1024;
-constexpr size_t CONSTANT_POOL_SIZE = 2 * 1024 * 1024;
+constexpr size_t MINIMUM_REGION_SIZE = 2 * 1024 * 1024;
+
+#if defined(DYNARMIC_ENABLE_NO_EXECUTE_SUPPORT) && defined(__linux__) && defined(MFD_CLOEXEC)
+    #define DYNARMIC_DUAL_MAPPED_CODE 1
+#endif
+
+constexpr size_t SMALL_PAGE_SIZE = 4096;
+constexpr size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+size_t RoundUp(size_t size, size_t granularity) {
+    return (size + granularity - 1) & ~(granularity - 1);
+}
 
 class CustomXbyakAllocator : public Xbyak::Allocator {
 public:
-#ifdef DYNARMIC_ENABLE_NO_EXECUTE_SUPPORT
+    explicit CustomXbyakAllocator(bool use_huge_pages) : use_huge_pages(use_huge_pages) {}
+
+    /// Only reserves address space. Memory is committed by BlockOfCode as it is required.
+    /// Where possible on hosts that enforce W^X, the same memory is reserved twice: the returned view is
+    /// used for writing code and a second view (see ExecutableOffset) is used for executing it.
+    Xbyak::uint8* alloc(size_t size) override {
+#ifdef _WIN32
+        // Large pages on Windows must be committed up front and require SeLockMemoryPrivilege, so they are not used.
+        void* p = VirtualAlloc(nullptr, size, MEM_RESERVE, PAGE_NOACCESS);
+        if (p == nullptr) {
+            throw Xbyak::Error(Xbyak::ERR_CANT_ALLOC);
+        }
+#else
+        Reservation reservation{RoundUp(size, SMALL_PAGE_SIZE), nullptr, PageBacking::Normal};
+        void* p = ReserveDualMapped(reservation);
+        if (p == nullptr) {
+            p = ReserveSingleMapped(reservation);
+        }
+        if (p == nullptr) {
+            throw Xbyak::Error(Xbyak::ERR_CANT_ALLOC);
+        }
+
+        std::lock_guard<std::mutex> lock{mutex};
+        reservations[p] = reservation;
+#endif
+        return static_cast<Xbyak::uint8*>(p);
+    }
+
+    void free(Xbyak::uint8* p) override {
+        if (!p) {
+            return;
+        }
+#ifdef _WIN32
+        VirtualFree(p, 0, MEM_RELEASE);
+#else
+        std::lock_guard<std::mutex> lock{mutex};
+        const auto iter = reservations.find(p);
+        ASSERT(iter != reservations.end());
+        munmap(iter->first, iter->second.size);
+        if (iter->second.executable) {
+            munmap(iter->second.executable, iter->second.size);
+        }
+        reservations.erase(iter);
+#endif
+    }
+
     bool useProtect() const override { return false; }
+
+    /// Distance from the writable view of the reservation at p to its executable view.
+    /// This is zero unless the reservation is dual-mapped.
+    std::ptrdiff_t ExecutableOffset([[maybe_unused]] const u8* p) {
+#ifndef _WIN32
+        std::lock_guard<std::mutex> lock{mutex};
+        const auto iter = reservations.find(const_cast<u8*>(p));
+        ASSERT(iter != reservations.end());
+        if (iter->second.executable) {
+            return static_cast<u8*>(iter->second.executable) - p;
+        }
+#endif
+        return 0;
+    }
+
+    /// The kind of pages backing the reservation at p.
+    PageBacking GetPageBacking([[maybe_unused]] const u8* p) {
+#ifndef _WIN32
+        std::lock_guard<std::mutex> lock{mutex};
+        const auto iter = reservations.find(const_cast<u8*>(p));
+        ASSERT(iter != reservations.end());
+        return iter->second.backing;
+#else
+        return PageBacking::Normal;
+#endif
+    }
+
+private:
+    bool use_huge_pages;
+
+#ifndef _WIN32
+    struct Reservation {
+        size_t size;
+        void* executable;
+        PageBacking backing;
+    };
+
+    /// Explicit huge pages are reserved when they are mapped, so a mapping only succeeds if enough are available.
+    /// They can only be used for sizes that are a multiple of the huge page size.
+    bool CanUseExplicitHugePages(const Reservation& reservation) const {
+        return use_huge_pages && reservation.size % HUGE_PAGE_SIZE == 0;
+    }
+
+    /// Reserves inaccessible address space at an address that is aligned to alignment, mapping fd if it is not -1.
+    /// Returns nullptr on failure.
+    static void* MapAligned(size_t size, size_t alignment, int flags, int fd) {
+        int reserve_flags = MAP_PRIVATE | MAP_ANONYMOUS;
+#ifdef MAP_NORESERVE
+        reserve_flags |= MAP_NORESERVE;
+#endif
+        void* area = mmap(nullptr, size + alignment, PROT_NONE, reserve_flags, -1, 0);
+        if (area == MAP_FAILED) {
+            return nullptr;
+        }
+
+        u8* const area_begin = static_cast<u8*>(area);
+        u8* const aligned = reinterpret_cast<u8*>(RoundUp(reinterpret_cast<size_t>(area_begin), alignment));
+        if (aligned != area_begin) {
+            munmap(area_begin, static_cast<size_t>(aligned - area_begin));
+        }
+        munmap(aligned + size, static_cast<size_t>(area_begin + alignment - aligned));
+
+        void* p = mmap(aligned, size, PROT_NONE, flags | MAP_FIXED, fd, 0);
+        if (p == MAP_FAILED) {
+            munmap(aligned, size);
+            return nullptr;
+        }
+        return p;
+    }
+
+    /// Requests transparent huge pages for [p, p + size). This only has an effect if the kernel has them enabled.
+    static bool AdviseHugePages([[maybe_unused]] void* p, [[maybe_unused]] size_t size, [[maybe_unused]] bool shared) {
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+        // "never" (and "deny" for shared memory) disables transparent huge pages even for advised mappings.
+        std::FILE* file = std::fopen(shared ? "/sys/kernel/mm/transparent_hugepage/shmem_enabled" : "/sys/kernel/mm/transparent_hugepage/enabled", "r");
+        if (!file) {
+            return false;
+        }
+        std::array<char, 128> setting{};
+        const bool read = std::fgets(setting.data(), static_cast<int>(setting.size()), file) != nullptr;
+        std::fclose(file);
+        if (!read || std::strstr(setting.data(), "[never]") || std::strstr(setting.data(), "[deny]")) {
+            return false;
+        }
+        return madvise(p, size, MADV_HUGEPAGE) == 0;
+#else
+        return false;
+#endif
+    }
+
+    void* ReserveSingleMapped(Reservation& reservation) const {
+#ifdef MAP_HUGETLB
+        if (CanUseExplicitHugePages(reservation)) {
+            void* p = mmap(nullptr, reservation.size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+            if (p != MAP_FAILED) {
+                reservation.backing = PageBacking::HugePages;
+                return p;
+            }
+        }
+#endif
+
+        int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+#ifdef MAP_NORESERVE
+        flags |= MAP_NORESERVE;
+#endif
+        if (!use_huge_pages) {
+            void* p = mmap(nullptr, reservation.size, PROT_NONE, flags, -1, 0);
+            return p == MAP_FAILED ? nullptr : p;
+        }
+
+        // Transparent huge pages are only used for huge-page-aligned memory.
+        void* p = MapAligned(reservation.size, HUGE_PAGE_SIZE, flags, -1);
+        if (p && AdviseHugePages(p, reservation.size, false)) {
+            reservation.backing = PageBacking::TransparentHugePages;
+        }
+        return p;
+    }
+
+    /// Maps an anonymous file twice. Returns the writable view, or nullptr if this is unsupported.
+    void* ReserveDualMapped([[maybe_unused]] Reservation& reservation) const {
+#ifdef DYNARMIC_DUAL_MAPPED_CODE
+#ifdef MFD_HUGETLB
+        if (CanUseExplicitHugePages(reservation)) {
+            if (void* p = MapFileTwice(reservation, MFD_HUGETLB)) {
+                reservation.backing = PageBacking::HugePages;
+                return p;
+            }
+        }
+#endif
+
+        void* p = MapFileTwice(reservation, 0);
+        if (p && use_huge_pages) {
+            const std::ptrdiff_t exec_offset = static_cast<u8*>(reservation.executable) - static_cast<u8*>(p);
+            if (AdviseHugePages(p, reservation.size, true) && AdviseHugePages(static_cast<u8*>(p) + exec_offset, reservation.size, true)) {
+                reservation.backing = PageBacking::TransparentHugePages;
+            }
+        }
+        return p;
+#else
+        return nullptr;
+#endif
+    }
+
+#ifdef DYNARMIC_DUAL_MAPPED_CODE
+    void* MapFileTwice(Reservation& reservation, unsigned int memfd_flags) const {
+        const size_t size = reservation.size;
+        const int fd = memfd_create("dynarmic-code-cache", MFD_CLOEXEC | memfd_flags);
+        if (fd == -1) {
+            return nullptr;
+        }
+        // The file is sparse: pages are only allocated once they are written to.
+        if (ftruncate(fd, static_cast<off_t>(size)) != 0) {
+            close(fd);
+            return nullptr;
+        }
+
+        // Transparent huge pages are only used for huge-page-aligned memory.
+        const size_t alignment = use_huge_pages ? HUGE_PAGE_SIZE : SMALL_PAGE_SIZE;
+        void* writable = MapAligned(size, alignment, MAP_SHARED, fd);
+        void* exec = writable ? MapAligned(size, alignment, MAP_SHARED, fd) : nullptr;
+        close(fd);
+        if (!exec) {
+            if (writable)
+                munmap(writable, size);
+            return nullptr;
+        }
+
+        reservation.executable = exec;
+        return writable;
+    }
+#endif
+
+    std::mutex mutex;
+    std::unordered_map<void*, Reservation> reservations;
 #endif
 };
 
-// This is threadsafe as Xbyak::Allocator does not contain any state; it is a pure interface.
-CustomXbyakAllocator s_allocator;
+CustomXbyakAllocator s_allocator{false};
+CustomXbyakAllocator s_huge_page_allocator{true};
+
+CustomXbyakAllocator& GetAllocator(const CodeCacheConfig& ccc) {
+    return ccc.huge_pages ? s_huge_page_allocator : s_allocator;
+}
+
+/// Makes reserved address space usable. Returns the number of bytes committed.
+/// If exec_offset is non-zero, base is the writable view of dual-mapped memory: it is made writable and the
+/// executable view is made executable, so permissions never need to be changed afterwards.
+size_t CommitMemory(const u8* base, size_t size, std::ptrdiff_t exec_offset) {
+#ifdef _WIN32
+    ASSERT(exec_offset == 0);
+#ifdef DYNARMIC_ENABLE_NO_EXECUTE_SUPPORT
+    const DWORD mode = PAGE_READWRITE;
+#else
+    const DWORD mode = PAGE_EXECUTE_READWRITE;
+#endif
+    const bool ok = VirtualAlloc(const_cast<u8*>(base), size, MEM_COMMIT, mode) != nullptr;
+#else
+#ifdef DYNARMIC_ENABLE_NO_EXECUTE_SUPPORT
+    const int mode = PROT_READ | PROT_WRITE;
+#else
+    const int mode = PROT_READ | PROT_WRITE | PROT_EXEC;
+#endif
+    bool ok = mprotect(const_cast<u8*>(base), size, mode) == 0;
+    if (exec_offset != 0) {
+        ok = ok && mprotect(const_cast<u8*>(base + exec_offset), size, PROT_READ | PROT_EXEC) == 0;
+    }
+#endif
+    ASSERT_MSG(ok, "Unable to commit memory for code cache");
+    return size;
+}
 
 #ifdef DYNARMIC_ENABLE_NO_EXECUTE_SUPPORT
 void ProtectMemory(const void* base, size_t size, bool is_executable) {
@@ -75,62 +341,232 @@ void ProtectMemory(const void* base, size_t size, bool is_executable) {
 
 } // anonymous namespace
 
-BlockOfCode::BlockOfCode(RunCodeCallbacks cb, JitStateInfo jsi, std::function<void(BlockOfCode&)> rcp)
-        : Xbyak::CodeGenerator(TOTAL_CODE_SIZE, nullptr, &s_allocator)
+BlockOfCode::BlockOfCode(RunCodeCallbacks cb, JitStateInfo jsi, LocationDescriptorCalculator ldc, CodeCacheConfig ccc, std::function<void(BlockOfCode&)> rcp)
+        : Xbyak::CodeGenerator(ccc.max_code_size, nullptr, &GetAllocator(ccc))
         , cb(std::move(cb))
         , jsi(jsi)
-        , constant_pool(*this, CONSTANT_POOL_SIZE)
+        , ldc(std::move(ldc))
+        , ccc(ccc)
+        , exec_offset(GetAllocator(ccc).ExecutableOffset(CodeGenerator::getCode()))
+        , page_backing(GetAllocator(ccc).GetPageBacking(CodeGenerator::getCode()))
+        , committed_size(CommitMemory(CodeGenerator::getCode(), RoundUp(ccc.code_size, CommitGranularity()), exec_offset))
+        , constant_pool(*this, ccc.constant_pool_size)
 {
     EnableWriting();
     GenRunCode(rcp);
 }
 
 void BlockOfCode::PreludeComplete() {
+    ASSERT_MSG(getSize() + ccc.far_code_offset < ccc.code_size, "Far code offset is beyond end of code cache");
+
     prelude_complete = true;
     near_code_begin = getCurr();
-    far_code_begin = getCurr() + FAR_CODE_OFFSET;
+    far_code_begin = getCurr() + ccc.far_code_offset;
+
+    const u8* near_begin = static_cast<const u8*>(near_code_begin);
+    const u8* far_begin = static_cast<const u8*>(far_code_begin);
+    size_t near_size = ccc.far_code_offset;
+    size_t far_size = static_cast<size_t>(getCode() + ccc.code_size - far_begin);
+
+    if (ccc.hot_code_size > 0) {
+        // The hot region is the first region, and has the same near/far split as the code cache as a whole.
+        const size_t hot_near_size = static_cast<size_t>(static_cast<u64>(ccc.hot_code_size) * ccc.far_code_offset / ccc.code_size);
+        const size_t hot_far_size = ccc.hot_code_size - hot_near_size;
+        ASSERT_MSG(hot_near_size < near_size && hot_far_size < far_size, "Hot region is larger than the code cache");
+
+        hot_region = regions.size();
+        AddRegion(near_begin, far_begin, hot_near_size, hot_far_size);
+        near_begin += hot_near_size;
+        far_begin += hot_far_size;
+        near_size -= hot_near_size;
+        far_size -= hot_far_size;
+    }
+
+    // Use fewer regions than requested rather than regions too small to be useful.
+    ASSERT_MSG(std::min(near_size, far_size) >= MINIMUM_REGION_SIZE,
+               "Code cache must have at least {} bytes each of near and far code outside of the hot region", MINIMUM_REGION_SIZE);
+    initial_region_count = std::clamp<size_t>(std::min(near_size, far_size) / MINIMUM_REGION_SIZE, 1, std::max<size_t>(ccc.num_regions, 1));
+
+    const size_t near_region_size = near_size / initial_region_count;
+    const size_t far_region_size = far_size / initial_region_count;
+    for (size_t i = 0; i < initial_region_count; i++) {
+        AddRegion(near_begin + i * near_region_size, far_begin + i * far_region_size, near_region_size, far_region_size);
+    }
+
     ClearCache();
     DisableWriting();
 }
 
 void BlockOfCode::EnableWriting() {
+    if (writing_depth++ != 0 || IsDualMapped()) {
+        return;
+    }
 #ifdef DYNARMIC_ENABLE_NO_EXECUTE_SUPPORT
-    ProtectMemory(getCode(), maxSize_, false);
+    ProtectMemory(getCode(), committed_size, false);
 #endif
 }
 
 void BlockOfCode::DisableWriting() {
+    ASSERT(writing_depth > 0);
+    if (--writing_depth != 0 || IsDualMapped()) {
+        return;
+    }
 #ifdef DYNARMIC_ENABLE_NO_EXECUTE_SUPPORT
-    ProtectMemory(getCode(), maxSize_, true);
+    ProtectMemory(getCode(), committed_size, true);
 #endif
 }
 
+size_t BlockOfCode::CommitGranularity() const {
+    // Explicit huge pages cannot be partially committed.
+    return page_backing == PageBacking::HugePages ? HUGE_PAGE_SIZE : SMALL_PAGE_SIZE;
+}
+
 void BlockOfCode::ClearCache() {
     ASSERT(prelude_complete);
     in_far_code = false;
-    near_code_ptr = near_code_begin;
-    far_code_ptr = far_code_begin;
-    SetCodePtr(near_code_begin);
+    for (auto& region : regions) {
+        region.live_bytes = 0;
+        region.accessed = false;
+    }
+    MoveToRegion(hot_region ? *hot_region + 1 : 0);
 }
 
 size_t BlockOfCode::SpaceRemaining() const {
     ASSERT(prelude_complete);
-    // This function provides an underestimate of near-code-size but that's okay.
-    // (Why? The maximum size of near code should be measured from near_code_begin, not top_.)
-    // These are offsets from Xbyak::CodeArray::top_.
-    std::size_t far_code_offset, near_code_offset;
-    if (in_far_code) {
-        near_code_offset = static_cast<const u8*>(near_code_ptr) - getCode();
-        far_code_offset = getCurr() - getCode();
-    } else {
-        near_code_offset = getCurr() - getCode();
-        far_code_offset = static_cast<const u8*>(far_code_ptr) - getCode();
-    }
-    if (far_code_offset > TOTAL_CODE_SIZE)
+    const Region& region = regions[current_region];
+    const u8* const near_ptr = in_far_code ? static_cast<const u8*>(near_code_ptr) : getCurr();
+    const u8* const far_ptr = in_far_code ? getCurr() : static_cast<const u8*>(far_code_ptr);
+    if (near_ptr > region.near_end)
         return 0;
-    if (near_code_offset > FAR_CODE_OFFSET)
+    if (far_ptr > region.far_end)
         return 0;
-    return std::min(TOTAL_CODE_SIZE - far_code_offset, FAR_CODE_OFFSET - near_code_offset);
+    return std::min<size_t>(region.near_end - near_ptr, region.far_end - far_ptr);
+}
+
+size_t BlockOfCode::AdvanceRegion() {
+    ASSERT(prelude_complete);
+    ASSERT(!in_far_code);
+
+    // Regions are considered in the order they were last used, so that ties go to the least recently used.
+    // A region whose blocks have all been invalidated is reused without discarding anything. Otherwise a region
+    // whose code has not run since the last time a region was reused is unlikely to hold hot blocks, and reusing
+    // the region with the least live code discards the fewest blocks that are still wanted.
+    // The hot region is never chosen.
+    const auto eviction_cost = [this](size_t region) {
+        const Region& r = regions[region];
+        return std::make_tuple(r.live_bytes != 0, r.accessed, r.live_bytes);
+    };
+
+    std::optional<size_t> next_region;
+    for (size_t i = 1; i < regions.size(); i++) {
+        const size_t candidate = (current_region + i) % regions.size();
+        if (candidate == hot_region) {
+            continue;
+        }
+        if (!next_region || eviction_cost(candidate) < eviction_cost(*next_region)) {
+            next_region = candidate;
+        }
+    }
+    ASSERT(next_region);
+
+    for (auto& region : regions) {
+        region.accessed = false;
+    }
+
+    regions[*next_region].live_bytes = 0;
+    MoveToRegion(*next_region);
+    return current_region;
+}
+
+void BlockOfCode::EnterHotRegion() {
+    ASSERT(prelude_complete);
+    ASSERT(!in_far_code);
+    ASSERT(hot_region && !saved_position);
+
+    saved_position = SavedPosition{current_region, getCurr(), far_code_ptr};
+    regions[*hot_region].live_bytes = 0;
+    MoveToRegion(*hot_region);
+}
+
+void BlockOfCode::LeaveHotRegion() {
+    ASSERT(!in_far_code);
+    ASSERT(saved_position);
+
+    current_region = saved_position->region;
+    near_code_ptr = saved_position->near_code_ptr;
+    far_code_ptr = saved_position->far_code_ptr;
+    SetCodePtr(near_code_ptr);
+    saved_position = std::nullopt;
+}
+
+void BlockOfCode::MarkRegionAccessed(CodePtr ptr) {
+    if (const auto region = RegionOf(ptr)) {
+        regions[*region].accessed = true;
+    }
+}
+
+void BlockOfCode::AddLiveCode(CodePtr ptr, size_t size) {
+    if (const auto region = RegionOf(ptr)) {
+        regions[*region].live_bytes += size;
+    }
+}
+
+void BlockOfCode::RemoveLiveCode(CodePtr ptr, size_t size) {
+    if (const auto region = RegionOf(ptr)) {
+        ASSERT(regions[*region].live_bytes >= size);
+        regions[*region].live_bytes -= size;
+    }
+}
+
+bool BlockOfCode::IsInRegion(CodePtr ptr, size_t region) const {
+    const u8* const p = static_cast<const u8*>(ptr);
+    const Region& r = regions[region];
+    return (p >= r.near_begin && p < r.near_end) || (p >= r.far_begin && p < r.far_end);
+}
+
+bool BlockOfCode::Grow() {
+    ASSERT(prelude_complete);
+    ASSERT(!in_far_code);
+
+    if (current_region != regions.size() - 1) {
+        return false;
+    }
+
+    // Each new region has the same size and near/far split as the initial regions.
+    const size_t grow_size = RoundUp(ccc.code_size / initial_region_count, CommitGranularity());
+    if (committed_size + grow_size > maxSize_) {
+        return false;
+    }
+
+    const u8* const begin = getCode() + committed_size;
+    committed_size += CommitMemory(begin - exec_offset, grow_size, exec_offset);
+
+    const size_t near_size = static_cast<size_t>(static_cast<u64>(grow_size) * ccc.far_code_offset / ccc.code_size);
+    AddRegion(begin, begin + near_size, near_size, grow_size - near_size);
+
+    MoveToRegion(regions.size() - 1);
+    return true;
+}
+
+void BlockOfCode::AddRegion(const u8* near_begin, const u8* far_begin, size_t near_size, size_t far_size) {
+    ASSERT_MSG(std::min(near_size, far_size) >= MINIMUM_REGION_SIZE, "Code cache regions are too small");
+    regions.push_back(Region{near_begin, near_begin + near_size, far_begin, far_begin + far_size});
+}
+
+void BlockOfCode::MoveToRegion(size_t region) {
+    current_region = region;
+    near_code_ptr = regions[region].near_begin;
+    far_code_ptr = regions[region].far_begin;
+    SetCodePtr(near_code_ptr);
+}
+
+std::optional<size_t> BlockOfCode::RegionOf(CodePtr ptr) const {
+    for (size_t i = 0; i < regions.size(); i++) {
+        if (IsInRegion(ptr, i)) {
+            return i;
+        }
+    }
+    return std::nullopt;
 }
 
 void BlockOfCode::RunCode(void* jit_state, CodePtr code_ptr) const {
@@ -155,6 +591,10 @@ void BlockOfCode::ForceReturnFromRunCode(bool mxcsr_already_exited) {
     jmp(return_from_run_code[index]);
 }
 
+void BlockOfCode::ReturnFromRunCodeToLookupCallback() {
+    jmp(return_from_run_code_to_lookup_callback);
+}
+
 void BlockOfCode::GenRunCode(std::function<void(BlockOfCode&)> rcp) {
     Xbyak::Label loop, enter_mxcsr_then_loop;
 
@@ -170,9 +610,14 @@ void BlockOfCode::GenRunCode(std::function<void(BlockOfCode&)> rcp) {
     mov(r15, ABI_PARAM1);
     mov(rbx, ABI_PARAM2); // save temporarily in non-volatile register
 
-    cb.GetTicksRemaining->EmitCall(*this);
-    mov(qword[r15 + jsi.offsetof_cycles_to_run], ABI_RETURN);
-    mov(qword[r15 + jsi.offsetof_cycles_remaining], ABI_RETURN);
+    if (cb.enable_ticks) {
+        GetTicksRemaining();
+    } else {
+        // Cycles are never consumed, so this only keeps cycle checks outside of the dispatcher from firing.
+        mov(rax, std::numeric_limits<s64>::max());
+        mov(qword[r15 + jsi.offsetof_cycles_to_run], rax);
+        mov(qword[r15 + jsi.offsetof_cycles_remaining], rax);
+    }
 
     rcp(*this);
 
@@ -200,21 +645,36 @@ void BlockOfCode::GenRunCode(std::function<void(BlockOfCode&)> rcp) {
 
     Xbyak::Label return_to_caller, return_to_caller_mxcsr_already_exited;
 
+    const auto exit_if_done = [this](Xbyak::Label& exit) {
+        if (cb.enable_ticks) {
+            cmp(qword[r15 + jsi.offsetof_cycles_remaining], 0);
+            jng(exit, T_NEAR);
+        } else {
+            cmp(byte[r15 + jsi.offsetof_halt_requested], 0);
+            jne(exit, T_NEAR);
+        }
+    };
+
     align();
     return_from_run_code[0] = getCurr<const void*>();
 
-    cmp(qword[r15 + jsi.offsetof_cycles_remaining], 0);
-    jng(return_to_caller);
-    cb.LookupBlock->EmitCall(*this);
+    exit_if_done(return_to_caller);
+    LookupBlock();
     jmp(ABI_RETURN);
 
     align();
     return_from_run_code[MXCSR_ALREADY_EXITED] = getCurr<const void*>();
 
-    cmp(qword[r15 + jsi.offsetof_cycles_remaining], 0);
-    jng(return_to_caller_mxcsr_already_exited);
+    exit_if_done(return_to_caller_mxcsr_already_exited);
     SwitchMxcsrOnEntry();
-    cb.LookupBlock->EmitCall(*this);
+    LookupBlock();
+    jmp(ABI_RETURN);
+
+    align();
+    return_from_run_code_to_lookup_callback = getCurr<const void*>();
+
+    exit_if_done(return_to_caller);
+    CallLookupBlock();
     jmp(ABI_RETURN);
 
     align();
@@ -227,10 +687,7 @@ void BlockOfCode::GenRunCode(std::function<void(BlockOfCode&)> rcp) {
     return_from_run_code[MXCSR_ALREADY_EXITED | FORCE_RETURN] = getCurr<const void*>();
     L(return_to_caller_mxcsr_already_exited);
 
-    cb.AddTicks->EmitCall(*this, [this](RegList param) {
-        mov(param[0], qword[r15 + jsi.offsetof_cycles_to_run]);
-        sub(param[0], qword[r15 + jsi.offsetof_cycles_remaining]);
-    });
+    AddTicks();
 
     ABI_PopCalleeSaveRegistersAndAdjustStack(*this);
     ret();
@@ -249,17 +706,64 @@ void BlockOfCode::SwitchMxcsrOnExit() {
 }
 
 void BlockOfCode::UpdateTicks() {
-    cb.AddTicks->EmitCall(*this, [this](RegList param) {
-        mov(param[0], qword[r15 + jsi.offsetof_cycles_to_run]);
-        sub(param[0], qword[r15 + jsi.offsetof_cycles_remaining]);
-    });
+    AddTicks();
+    GetTicksRemaining();
+}
+
+void BlockOfCode::AddTicks() {
+    if (!cb.enable_ticks) {
+        return;
+    }
+
+    if (!cb.tick_counter || !cb.tick_deadline) {
+        cb.AddTicks->EmitCall(*this, [this](RegList param) {
+            mov(param[0], qword[r15 + jsi.offsetof_cycles_to_run]);
+            sub(param[0], qword[r15 + jsi.offsetof_cycles_remaining]);
+        });
+        return;
+    }
+
+    // The embedder may access the tick counter from other threads.
+    mov(rax, qword[r15 + jsi.offsetof_cycles_to_run]);
+    sub(rax, qword[r15 + jsi.offsetof_cycles_remaining]);
+    mov(rcx, reinterpret_cast<u64>(cb.tick_counter));
+    lock();
+    add(qword[rcx], rax);
+}
+
+void BlockOfCode::GetTicksRemaining() {
+    if (!cb.enable_ticks) {
+        return;
+    }
+
+    if (!cb.tick_counter || !cb.tick_deadline) {
+        cb.GetTicksRemaining->EmitCall(*this);
+    } else {
+        // No cycles remain once the deadline has passed.
+        mov(rdx, reinterpret_cast<u64>(cb.tick_deadline));
+        mov(rax, qword[rdx]);
+        mov(rdx, reinterpret_cast<u64>(cb.tick_counter));
+        xor_(ecx, ecx);
+        sub(rax, qword[rdx]);
+        cmovb(rax, rcx);
+    }
 
-    cb.GetTicksRemaining->EmitCall(*this);
     mov(qword[r15 + jsi.offsetof_cycles_to_run], ABI_RETURN);
     mov(qword[r15 + jsi.offsetof_cycles_remaining], ABI_RETURN);
 }
 
 void BlockOfCode::LookupBlock() {
+    Xbyak::Label miss, end;
+
+    ldc(*this, rcx, rdx);
+    block_lookup_table.EmitLookup(*this, ABI_RETURN, rcx, rdx, r8, miss);
+    jmp(end, T_NEAR);
+    L(miss);
+    cb.LookupBlock->EmitCall(*this);
+    L(end);
+}
+
+void BlockOfCode::CallLookupBlock() {
     cb.LookupBlock->EmitCall(*this);
 }
 
@@ -274,7 +778,7 @@ void BlockOfCode::SwitchToFarCode() {
     near_code_ptr = getCurr();
     SetCodePtr(far_code_ptr);
 
-    ASSERT_MSG(near_code_ptr < far_code_begin, "Near code has overwritten far code!");
+    ASSERT_MSG(near_code_ptr < regions[current_region].near_end, "Near code has overwritten far code!");
 }
 
 void BlockOfCode::SwitchToNearCode() {
@@ -294,11 +798,11 @@ size_t BlockOfCode::GetTotalCodeSize() const {
 }
 
 void* BlockOfCode::AllocateFromCodeSpace(size_t alloc_size) {
-    if (size_ + alloc_size >= maxSize_) {
+    if (size_ + alloc_size >= committed_size) {
         throw Xbyak::Error(Xbyak::ERR_CODE_IS_TOO_BIG);
     }
 
-    void* ret = getCurr<void*>();
+    void* ret = CodeGenerator::getCurr<void*>();
     size_ += alloc_size;
     memset(ret, 0, alloc_size);
     return ret;
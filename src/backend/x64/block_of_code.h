@@ -7,13 +7,18 @@
 #pragma once
 
 #include <array>
+#include <cstddef>
+#include <cstdint>
 #include <functional>
 #include <memory>
+#include <optional>
 #include <type_traits>
+#include <vector>
 
 #include <xbyak.h>
 #include <xbyak_util.h>
 
+#include "backend/x64/block_lookup_table.h"
 #include "backend/x64/callback.h"
 #include "backend/x64/constant_pool.h"
 #include "backend/x64/jitstate_info.h"
@@ -22,32 +27,111 @@
 
 namespace Dynarmic::Backend::X64 {
 
-using CodePtr = const void*;
+class BlockOfCode;
 
 struct RunCodeCallbacks {
     std::unique_ptr<Callback> LookupBlock;
     std::unique_ptr<Callback> AddTicks;
     std::unique_ptr<Callback> GetTicksRemaining;
+    /// If both are non-null, ticks are accounted for inline using these instead of calling AddTicks and GetTicksRemaining.
+    u64* tick_counter = nullptr;
+    const u64* tick_deadline = nullptr;
+    /// If false, ticks are not accounted for at all and execution only stops once halt_requested is set.
+    bool enable_ticks = true;
+};
+
+/// Emits code that calculates the location descriptor of the current guest state into result. May clobber scratch.
+using LocationDescriptorCalculator = std::function<void(BlockOfCode& code, Xbyak::Reg64 result, Xbyak::Reg64 scratch)>;
+
+enum class PageBacking {
+    Normal,
+    TransparentHugePages,
+    HugePages,
+};
+
+struct CodeCacheConfig {
+    /// Size of the initially committed code cache in bytes, including the constant pool.
+    size_t code_size;
+    /// Offset of far code from the beginning of near code.
+    size_t far_code_offset;
+    /// Size of the constant pool in bytes.
+    size_t constant_pool_size;
+    /// Address space reserved for the code cache. Must be at least code_size.
+    size_t max_code_size;
+    /// Number of regions the initially committed code cache is partitioned into.
+    /// Fewer are used if the code cache is too small for this many.
+    size_t num_regions;
+    /// Attempt to back the code cache with huge pages. Falls back to ordinary pages if they are unavailable.
+    bool huge_pages;
+    /// Size of the hot region in bytes, taken from the start of the initially committed code cache.
+    /// Zero if there is no hot region.
+    size_t hot_code_size;
 };
 
 class BlockOfCode final : public Xbyak::CodeGenerator {
 public:
-    BlockOfCode(RunCodeCallbacks cb, JitStateInfo jsi, std::function<void(BlockOfCode&)> rcp);
+    BlockOfCode(RunCodeCallbacks cb, JitStateInfo jsi, LocationDescriptorCalculator ldc, CodeCacheConfig ccc, std::function<void(BlockOfCode&)> rcp);
     BlockOfCode(const BlockOfCode&) = delete;
 
     /// Call when external emitters have finished emitting their preludes.
     void PreludeComplete();
 
     /// Change permissions to RW. This is required to support systems with W^X enforced.
+    /// Calls may be nested; permissions only change at the outermost call, so callers that perform
+    /// several modifications in a row should enable writing once around all of them.
+    /// This does nothing if the code cache is dual-mapped.
     void EnableWriting();
     /// Change permissions to RX. This is required to support systems with W^X enforced.
+    /// Must be paired with a call to EnableWriting.
     void DisableWriting();
+    /// On systems with W^X enforced, the code cache may be mapped twice: once writable and once executable.
+    /// Code is written through the writable view and executed from the executable view, so permissions never change.
+    /// All code pointers handed out by BlockOfCode refer to the executable view.
+    bool IsDualMapped() const { return exec_offset != 0; }
+    /// The kind of pages the code cache (including the constant pool) is backed by.
+    PageBacking GetPageBacking() const { return page_backing; }
 
     /// Clears this block of code and resets code pointer to beginning.
     void ClearCache();
-    /// Calculates how much space is remaining to use. This is the minimum of near code and far code.
+    /// Calculates how much space is remaining to use in the current region. This is the minimum of near code and far code.
     size_t SpaceRemaining() const;
 
+    /// Near code and far code are each partitioned into regions.
+    /// Code is emitted into one region at a time. Once it is full, the region with the least live code is reused.
+    /// The hot region, if any, is not counted.
+    size_t RegionCount() const { return regions.size() - (hot_region ? 1 : 0); }
+    /// The region code is currently being emitted into.
+    size_t CurrentRegion() const { return current_region; }
+    /// Moves the code pointer to the beginning of another region, discarding the code that region used to hold.
+    /// Regions without live code are preferred, followed by regions not marked accessed since the previous call.
+    /// Of those, the region with the fewest live bytes is chosen; ties are broken in favour of the least recently used.
+    /// @returns the index of the newly current region.
+    size_t AdvanceRegion();
+    /// A region set aside for frequently executed blocks. Code is only emitted into it between calls to
+    /// EnterHotRegion and LeaveHotRegion, and it is never chosen by AdvanceRegion.
+    std::optional<size_t> HotRegion() const { return hot_region; }
+    /// Moves the code pointer to the beginning of the hot region, discarding the code it used to hold.
+    void EnterHotRegion();
+    /// Moves the code pointer back to where it was before EnterHotRegion was called.
+    void LeaveHotRegion();
+    /// Records that the block at ptr is in use, so that AdvanceRegion prefers to keep its region.
+    /// This is done when the dispatcher looks up a block and when newly emitted code links to one, which keeps
+    /// the code run over links free of bookkeeping.
+    void MarkRegionAccessed(CodePtr ptr);
+    /// Records that size bytes of near code starting at ptr are in use by a block.
+    void AddLiveCode(CodePtr ptr, size_t size);
+    /// Records that the size bytes of near code starting at ptr are no longer used, for example because
+    /// the block there has been invalidated.
+    void RemoveLiveCode(CodePtr ptr, size_t size);
+    /// Number of bytes of near code in use by blocks in the specified region.
+    size_t LiveCodeSize(size_t region) const { return regions[region].live_bytes; }
+    /// Determines if ptr lies within the near or far code of the specified region.
+    bool IsInRegion(CodePtr ptr, size_t region) const;
+    /// Commits more of the reserved address space as a new region and moves the code pointer to it.
+    /// This only succeeds if the current region is the most recently added one and space remains.
+    /// @returns true if successful.
+    bool Grow();
+
     /// Runs emulated code from code_ptr.
     void RunCode(void* jit_state, CodePtr code_ptr) const;
     /// Runs emulated code from code_ptr for a single cycle.
@@ -56,6 +140,10 @@ public:
     void ReturnFromRunCode(bool mxcsr_already_exited = false);
     /// Code emitter: Returns to dispatcher, forces return to host
     void ForceReturnFromRunCode(bool mxcsr_already_exited = false);
+    /// Code emitter: Returns to dispatcher, which finds the next block by calling cb.LookupBlock without
+    /// probing the block lookup table. Unlike calling cb.LookupBlock directly, this is safe even if the
+    /// lookup modifies the code cache.
+    void ReturnFromRunCodeToLookupCallback();
     /// Code emitter: Makes guest MXCSR the current MXCSR
     void SwitchMxcsrOnEntry();
     /// Code emitter: Makes saved host MXCSR the current MXCSR
@@ -63,9 +151,24 @@ public:
     /// Code emitter: Updates cycles remaining my calling cb.AddTicks and cb.GetTicksRemaining
     /// @note this clobbers ABI caller-save registers
     void UpdateTicks();
-    /// Code emitter: Performs a block lookup based on current state
+    /// Code emitter: Reports the cycles executed since cycles_to_run was set, by calling cb.AddTicks or by adding
+    /// them to the tick counter. Emits nothing if ticks are disabled.
+    /// @note this clobbers ABI caller-save registers
+    void AddTicks();
+    /// Code emitter: Sets cycles_to_run and cycles_remaining by calling cb.GetTicksRemaining or from the distance
+    /// between the tick counter and the tick deadline. Emits nothing if ticks are disabled.
+    /// @note this clobbers ABI caller-save registers
+    void GetTicksRemaining();
+    /// Code emitter: Performs a block lookup based on current state.
+    /// The block lookup table is probed first; cb.LookupBlock is only called if the block is not found.
     /// @note this clobbers ABI caller-save registers
     void LookupBlock();
+    /// Code emitter: Performs a block lookup based on current state by calling cb.LookupBlock
+    /// @note this clobbers ABI caller-save registers
+    void CallLookupBlock();
+
+    /// Emitted blocks. This is probed directly by the dispatcher.
+    BlockLookupTable& GetBlockLookupTable() { return block_lookup_table; }
 
     /// Code emitter: Calls the function
     template <typename FunctionPointer>
@@ -111,9 +214,37 @@ public:
 
     void int3() { db(0xCC); }
 
+    // The following hide members of Xbyak::CodeGenerator so that code pointers refer to the executable view
+    // of the code cache while code is written through the writable view. Relative branches to absolute
+    // addresses are encoded against the writable view, so their targets are moved by the same amount.
+
+    template<typename T = const u8*>
+    T getCode() const { return reinterpret_cast<T>(CodeGenerator::getCode() + exec_offset); }
+    template<typename T = const u8*>
+    T getCurr() const { return reinterpret_cast<T>(CodeGenerator::getCurr() + exec_offset); }
+
+    // This covers every Xbyak mnemonic that has an overload taking an absolute target.
+    using CodeGenerator::call;
+    using CodeGenerator::jmp;
+    void call(const void* addr) { CodeGenerator::call(ToWritable(addr)); }
+    template<typename Ret, typename... Params>
+    void call(Ret(*func)(Params...)) { call(reinterpret_cast<const void*>(func)); }
+    void jmp(const void* addr, LabelType type = T_AUTO) { CodeGenerator::jmp(ToWritable(addr), type); }
+
+#define DYNARMIC_JCC(name)   \
+    using CodeGenerator::name; \
+    void name(const void* addr) { CodeGenerator::name(ToWritable(addr)); }
+    DYNARMIC_JCC(ja) DYNARMIC_JCC(jae) DYNARMIC_JCC(jb) DYNARMIC_JCC(jbe) DYNARMIC_JCC(jc) DYNARMIC_JCC(je)
+    DYNARMIC_JCC(jg) DYNARMIC_JCC(jge) DYNARMIC_JCC(jl) DYNARMIC_JCC(jle) DYNARMIC_JCC(jna) DYNARMIC_JCC(jnae)
+    DYNARMIC_JCC(jnb) DYNARMIC_JCC(jnbe) DYNARMIC_JCC(jnc) DYNARMIC_JCC(jne) DYNARMIC_JCC(jng) DYNARMIC_JCC(jnge)
+    DYNARMIC_JCC(jnl) DYNARMIC_JCC(jnle) DYNARMIC_JCC(jno) DYNARMIC_JCC(jnp) DYNARMIC_JCC(jns) DYNARMIC_JCC(jnz)
+    DYNARMIC_JCC(jo) DYNARMIC_JCC(jp) DYNARMIC_JCC(jpe) DYNARMIC_JCC(jpo) DYNARMIC_JCC(js) DYNARMIC_JCC(jz)
+#undef DYNARMIC_JCC
+
     /// Allocate memory of `size` bytes from the same block of memory the code is in.
     /// This is useful for objects that need to be placed close to or within code.
     /// The lifetime of this memory is the same as the code around it.
+    /// The returned pointer is writable. It may be referred to by rip-relative addressing in emitted code.
     void* AllocateFromCodeSpace(size_t size);
 
     void SetCodePtr(CodePtr code_ptr);
@@ -142,15 +273,55 @@ public:
     bool DoesCpuSupport(Xbyak::util::Cpu::Type type) const;
 
     JitStateInfo GetJitStateInfo() const { return jsi; }
+    /// If false, blocks do not count cycles and execution only returns once halt is requested.
+    bool TicksEnabled() const { return cb.enable_ticks; }
 
 private:
     RunCodeCallbacks cb;
     JitStateInfo jsi;
+    LocationDescriptorCalculator ldc;
+    BlockLookupTable block_lookup_table;
 
     bool prelude_complete = false;
+    size_t writing_depth = 0;
     CodePtr near_code_begin;
     CodePtr far_code_begin;
 
+    CodeCacheConfig ccc;
+    std::ptrdiff_t exec_offset;
+    PageBacking page_backing;
+    size_t committed_size;
+    /// Memory is committed in multiples of this size.
+    size_t CommitGranularity() const;
+
+    const u8* ToWritable(const void* ptr) const {
+        return reinterpret_cast<const u8*>(reinterpret_cast<std::uintptr_t>(ptr) - exec_offset);
+    }
+
+    struct Region {
+        const u8* near_begin;
+        const u8* near_end;
+        const u8* far_begin;
+        const u8* far_end;
+        size_t live_bytes = 0;
+        /// Set by MarkRegionAccessed, and cleared whenever a region is reused.
+        bool accessed = false;
+    };
+    std::vector<Region> regions;
+    /// Number of regions the initially committed code cache was actually partitioned into.
+    size_t initial_region_count = 0;
+    size_t current_region = 0;
+    std::optional<size_t> hot_region;
+    struct SavedPosition {
+        size_t region;
+        CodePtr near_code_ptr;
+        CodePtr far_code_ptr;
+    };
+    std::optional<SavedPosition> saved_position;
+    void AddRegion(const u8* near_begin, const u8* far_begin, size_t near_size, size_t far_size);
+    void MoveToRegion(size_t region);
+    std::optional<size_t> RegionOf(CodePtr ptr) const;
+
     ConstantPool constant_pool;
 
     bool in_far_code = false;
@@ -163,6 +334,7 @@ private:
     static constexpr size_t MXCSR_ALREADY_EXITED = 1 << 0;
     static constexpr size_t FORCE_RETURN = 1 << 1;
     std::array<const void*, 4> return_from_run_code;
+    const void* return_from_run_code_to_lookup_callback = nullptr;
     void GenRunCode(std::function<void(BlockOfCode&)> rcp);
 
     Xbyak::util::Cpu cpu_info;
@@ -4,9 +4,9 @@
  * General Public License version 2 or any later version.
  */
 
+#include <algorithm>
 #include <unordered_set>
 
-#include <boost/icl/interval_map.hpp>
 #include <boost/icl/interval_set.hpp>
 
 #include "backend/x64/block_range_information.h"
@@ -16,27 +16,133 @@ namespace Dynarmic::Backend::X64 {
 
 template <typename ProgramCounterType>
 void BlockRangeInformation<ProgramCounterType>::AddRange(boost::icl::discrete_interval<ProgramCounterType> range, IR::LocationDescriptor location) {
-    block_ranges.add(std::make_pair(range, std::set<IR::LocationDescriptor>{location}));
+    if (boost::icl::is_empty(range)) {
+        return;
+    }
+
+    const ProgramCounterType first = boost::icl::first(range);
+    const ProgramCounterType last = boost::icl::last(range);
+
+    auto& ranges = block_ranges[location];
+    if (std::any_of(ranges.begin(), ranges.end(), [&](const Range& r) { return r.first == first && r.last == last; })) {
+        return;
+    }
+    ranges.push_back({first, last});
+
+    for (ProgramCounterType page = first >> page_bits; page <= last >> page_bits; page++) {
+        auto& locations = pages[page];
+        if (std::find(locations.begin(), locations.end(), location) == locations.end()) {
+            locations.push_back(location);
+        }
+    }
 }
 
 template <typename ProgramCounterType>
 void BlockRangeInformation<ProgramCounterType>::ClearCache() {
+    pages.clear();
     block_ranges.clear();
 }
 
+template <typename ProgramCounterType>
+template <typename Fn>
+void BlockRangeInformation<ProgramCounterType>::ForEachOverlappingBlock(ProgramCounterType first, ProgramCounterType last, Fn fn) const {
+    const auto visit_page = [&](const std::vector<IR::LocationDescriptor>& locations) {
+        for (const auto& location : locations) {
+            for (const Range& block_range : block_ranges.at(location)) {
+                if (block_range.first <= last && first <= block_range.last) {
+                    fn(location);
+                    break;
+                }
+            }
+        }
+    };
+
+    const ProgramCounterType first_page = first >> page_bits;
+    const ProgramCounterType last_page = last >> page_bits;
+
+    // Large ranges (such as invalidating an entire address space) touch more pages than are
+    // occupied by code; visit the occupied pages instead.
+    if (last_page - first_page >= pages.size()) {
+        for (const auto& [page, locations] : pages) {
+            if (page >= first_page && page <= last_page) {
+                visit_page(locations);
+            }
+        }
+        return;
+    }
+
+    for (ProgramCounterType page = first_page; ; page++) {
+        if (const auto iter = pages.find(page); iter != pages.end()) {
+            visit_page(iter->second);
+        }
+        if (page == last_page) {
+            break;
+        }
+    }
+}
+
 template <typename ProgramCounterType>
 std::unordered_set<IR::LocationDescriptor> BlockRangeInformation<ProgramCounterType>::InvalidateRanges(const boost::icl::interval_set<ProgramCounterType>& ranges) {
     std::unordered_set<IR::LocationDescriptor> erase_locations;
-    for (auto invalidate_interval : ranges) {
-        auto pair = block_ranges.equal_range(invalidate_interval);
-        for (auto it = pair.first; it != pair.second; ++it) {
-            for (const auto &descriptor : it->second) {
-                erase_locations.insert(descriptor);
+    for (const auto& invalidate_interval : ranges) {
+        ForEachOverlappingBlock(boost::icl::first(invalidate_interval), boost::icl::last(invalidate_interval), [&](IR::LocationDescriptor location) {
+            erase_locations.insert(location);
+        });
+    }
+
+    for (const auto& location : erase_locations) {
+        Forget(location);
+    }
+
+    return erase_locations;
+}
+
+template <typename ProgramCounterType>
+boost::icl::interval_set<ProgramCounterType> BlockRangeInformation<ProgramCounterType>::RemoveBlocks(const std::vector<IR::LocationDescriptor>& locations) {
+    boost::icl::interval_set<ProgramCounterType> removed_ranges;
+    for (const auto& location : locations) {
+        const auto iter = block_ranges.find(location);
+        if (iter == block_ranges.end()) {
+            continue;
+        }
+        for (const Range& block_range : iter->second) {
+            removed_ranges.add(boost::icl::discrete_interval<ProgramCounterType>::closed(block_range.first, block_range.last));
+        }
+        Forget(location);
+    }
+    return removed_ranges;
+}
+
+template <typename ProgramCounterType>
+void BlockRangeInformation<ProgramCounterType>::Forget(IR::LocationDescriptor location) {
+    const auto iter = block_ranges.find(location);
+    for (const Range& block_range : iter->second) {
+        for (ProgramCounterType page = block_range.first >> page_bits; page <= block_range.last >> page_bits; page++) {
+            const auto page_iter = pages.find(page);
+            if (page_iter == pages.end()) {
+                continue;
+            }
+            auto& locations = page_iter->second;
+            locations.erase(std::remove(locations.begin(), locations.end(), location), locations.end());
+            if (locations.empty()) {
+                pages.erase(page_iter);
             }
         }
     }
-    // TODO: EFFICIENCY: Remove ranges that are to be erased.
-    return erase_locations;
+    block_ranges.erase(iter);
+}
+
+template <typename ProgramCounterType>
+bool BlockRangeInformation<ProgramCounterType>::Intersects(boost::icl::discrete_interval<ProgramCounterType> range) const {
+    if (boost::icl::is_empty(range)) {
+        return false;
+    }
+
+    bool result = false;
+    ForEachOverlappingBlock(boost::icl::first(range), boost::icl::last(range), [&](IR::LocationDescriptor) {
+        result = true;
+    });
+    return result;
 }
 
 template class BlockRangeInformation<u32>;
@@ -6,25 +6,50 @@
 
 #pragma once
 
-#include <set>
+#include <unordered_map>
 #include <unordered_set>
+#include <vector>
 
-#include <boost/icl/interval_map.hpp>
 #include <boost/icl/interval_set.hpp>
 
 #include "frontend/ir/location_descriptor.h"
 
 namespace Dynarmic::Backend::X64 {
 
+/**
+ * Records which guest addresses each block was translated from.
+ * Blocks are indexed by guest page, so the cost of an invalidation is proportional to the
+ * number of pages touched and blocks affected rather than to the total number of blocks.
+ */
 template <typename ProgramCounterType>
 class BlockRangeInformation {
 public:
     void AddRange(boost::icl::discrete_interval<ProgramCounterType> range, IR::LocationDescriptor location);
     void ClearCache();
+    /// Returns the locations of all blocks that overlap ranges. These blocks are forgotten.
     std::unordered_set<IR::LocationDescriptor> InvalidateRanges(const boost::icl::interval_set<ProgramCounterType>& ranges);
+    /// Forgets the specified blocks, for example because they have been evicted from the code cache.
+    /// Returns the ranges those blocks were translated from.
+    boost::icl::interval_set<ProgramCounterType> RemoveBlocks(const std::vector<IR::LocationDescriptor>& locations);
+    /// Determines if any block overlaps range.
+    bool Intersects(boost::icl::discrete_interval<ProgramCounterType> range) const;
 
 private:
-    boost::icl::interval_map<ProgramCounterType, std::set<IR::LocationDescriptor>> block_ranges;
+    static constexpr size_t page_bits = 12;
+
+    struct Range {
+        ProgramCounterType first;
+        ProgramCounterType last;
+    };
+
+    template <typename Fn>
+    void ForEachOverlappingBlock(ProgramCounterType first, ProgramCounterType last, Fn fn) const;
+    void Forget(IR::LocationDescriptor location);
+
+    /// Guest page to the blocks that overlap that page.
+    std::unordered_map<ProgramCounterType, std::vector<IR::LocationDescriptor>> pages;
+    /// Block to the guest address ranges it was translated from.
+    std::unordered_map<IR::LocationDescriptor, std::vector<Range>> block_ranges;
 };
 
 } // namespace Dynarmic::Backend::X64
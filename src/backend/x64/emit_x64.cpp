@@ -4,6 +4,7 @@
  * General Public License version 2 or any later version.
  */
 
+#include <algorithm>
 #include <iterator>
 #include <unordered_map>
 #include <unordered_set>
@@ -39,18 +40,14 @@ void EmitContext::EraseInstruction(IR::Inst* inst) {
     inst->ClearArgs();
 }
 
-EmitX64::EmitX64(BlockOfCode& code) : code(code) {
+EmitX64::EmitX64(BlockOfCode& code) : code(code), block_descriptors(code.GetBlockLookupTable()) {
     exception_handler.Register(code);
 }
 
 EmitX64::~EmitX64() = default;
 
 std::optional<EmitX64::BlockDescriptor> EmitX64::GetBasicBlock(IR::LocationDescriptor descriptor) const {
-    const auto iter = block_descriptors.find(descriptor);
-    if (iter == block_descriptors.end()) {
-        return std::nullopt;
-    }
-    return iter->second;
+    return block_descriptors.Find(descriptor.Value());
 }
 
 void EmitX64::EmitVoid(EmitContext&, IR::Inst*) {
@@ -70,9 +67,9 @@ void EmitX64::EmitIdentity(EmitContext& ctx, IR::Inst* inst) {
 void EmitX64::PushRSBHelper(Xbyak::Reg64 loc_desc_reg, Xbyak::Reg64 index_reg, IR::LocationDescriptor target) {
     using namespace Xbyak::util;
 
-    const auto iter = block_descriptors.find(target);
-    CodePtr target_code_ptr = iter != block_descriptors.end()
-                            ? iter->second.entrypoint
+    const auto target_block = block_descriptors.Find(target.Value());
+    CodePtr target_code_ptr = target_block
+                            ? target_block->entrypoint
                             : code.GetReturnFromRunCodeAddress();
 
     code.mov(index_reg.cvt32(), dword[r15 + code.GetJitStateInfo().offsetof_rsb_ptr]);
@@ -172,6 +169,10 @@ void EmitX64::EmitNZCVFromPackedFlags(EmitContext& ctx, IR::Inst* inst) {
 }
 
 void EmitX64::EmitAddCycles(size_t cycles) {
+    if (!code.TicksEnabled()) {
+        return;
+    }
+
     ASSERT(cycles < std::numeric_limits<u32>::max());
     code.sub(qword[r15 + code.GetJitStateInfo().offsetof_cycles_remaining], static_cast<u32>(cycles));
 }
@@ -307,7 +308,8 @@ EmitX64::BlockDescriptor EmitX64::RegisterBlock(const IR::LocationDescriptor& de
     Patch(descriptor, entrypoint);
 
     BlockDescriptor block_desc{entrypoint, size};
-    block_descriptors.emplace(descriptor.Value(), block_desc);
+    block_descriptors.Insert(descriptor.Value(), block_desc);
+    code.AddLiveCode(entrypoint, size);
     return block_desc;
 }
 
@@ -348,8 +350,70 @@ void EmitX64::Unpatch(const IR::LocationDescriptor& target_desc) {
     Patch(target_desc, nullptr);
 }
 
+void EmitX64::InitializeFastDispatchTable(size_t num_entries, size_t num_ways, bool collect_statistics) {
+    ASSERT_MSG(num_ways == 1 || num_ways == 2 || num_ways == 4, "Fast dispatch table must be 1-, 2- or 4-way set associative");
+    ASSERT_MSG(Common::BitCount(num_entries) == 1 && num_entries >= num_ways, "Fast dispatch table size must be a power of two");
+    ASSERT_MSG(num_entries * sizeof(FastDispatchEntry) <= (u64(1) << 32), "Fast dispatch table is too large");
+
+    fast_dispatch_table.resize(num_entries);
+    fast_dispatch_table_ways = num_ways;
+    fast_dispatch_table_mask = static_cast<u32>(num_entries * sizeof(FastDispatchEntry) - num_ways * sizeof(FastDispatchEntry));
+    collect_fast_dispatch_statistics = collect_statistics;
+    fast_dispatch_statistics = {};
+    ClearFastDispatchTable();
+}
+
+void EmitX64::ClearFastDispatchTable() {
+    std::fill(fast_dispatch_table.begin(), fast_dispatch_table.end(), FastDispatchEntry{0xFFFFFFFFFFFFFFFFull, nullptr});
+}
+
+void EmitX64::EmitFastDispatchTableLookup(Xbyak::Label& hit) {
+    ASSERT(!fast_dispatch_table.empty());
+
+    Xbyak::Label found;
+
+    code.mov(r12, reinterpret_cast<u64>(fast_dispatch_table.data()));
+    if (code.DoesCpuSupport(Xbyak::util::Cpu::tSSE42)) {
+        code.crc32(ebp, r12d);
+    }
+    code.and_(ebp, fast_dispatch_table_mask);
+    code.lea(rbp, ptr[r12 + rbp]);
+    for (size_t way = 0; way < fast_dispatch_table_ways; way++) {
+        Xbyak::Label next;
+        code.cmp(rbx, qword[rbp + way * sizeof(FastDispatchEntry) + offsetof(FastDispatchEntry, location_descriptor)]);
+        code.jne(next);
+        code.mov(rax, qword[rbp + way * sizeof(FastDispatchEntry) + offsetof(FastDispatchEntry, code_ptr)]);
+        code.jmp(collect_fast_dispatch_statistics ? found : hit, code.T_NEAR);
+        code.L(next);
+    }
+
+    if (collect_fast_dispatch_statistics) {
+        code.mov(rcx, reinterpret_cast<u64>(&fast_dispatch_statistics.misses));
+        code.inc(qword[rcx]);
+
+        Xbyak::Label end;
+        code.jmp(end, code.T_NEAR);
+        code.L(found);
+        code.mov(rcx, reinterpret_cast<u64>(&fast_dispatch_statistics.hits));
+        code.inc(qword[rcx]);
+        code.jmp(hit, code.T_NEAR);
+        code.L(end);
+    }
+}
+
+void EmitX64::EmitFastDispatchTableInsert() {
+    for (size_t way = fast_dispatch_table_ways - 1; way > 0; way--) {
+        code.mov(rcx, qword[rbp + (way - 1) * sizeof(FastDispatchEntry) + offsetof(FastDispatchEntry, location_descriptor)]);
+        code.mov(rdx, qword[rbp + (way - 1) * sizeof(FastDispatchEntry) + offsetof(FastDispatchEntry, code_ptr)]);
+        code.mov(qword[rbp + way * sizeof(FastDispatchEntry) + offsetof(FastDispatchEntry, location_descriptor)], rcx);
+        code.mov(qword[rbp + way * sizeof(FastDispatchEntry) + offsetof(FastDispatchEntry, code_ptr)], rdx);
+    }
+    code.mov(qword[rbp + offsetof(FastDispatchEntry, location_descriptor)], rbx);
+    code.mov(qword[rbp + offsetof(FastDispatchEntry, code_ptr)], rax);
+}
+
 void EmitX64::ClearCache() {
-    block_descriptors.clear();
+    block_descriptors.Clear();
     patch_information.clear();
 
     PerfMapClear();
@@ -360,16 +424,49 @@ void EmitX64::InvalidateBasicBlocks(const std::unordered_set<IR::LocationDescrip
     SCOPE_EXIT { code.DisableWriting(); };
 
     for (const auto &descriptor : locations) {
-        const auto it = block_descriptors.find(descriptor);
-        if (it == block_descriptors.end()) {
+        const auto block = block_descriptors.Find(descriptor.Value());
+        if (!block) {
             continue;
         }
+        block_descriptors.Erase(descriptor.Value());
+        code.RemoveLiveCode(block->entrypoint, block->size);
+
+        if (patch_information.count(descriptor)) {
+            Unpatch(descriptor);
+        }
+    }
+}
+
+std::vector<IR::LocationDescriptor> EmitX64::EvictCodeRegion(size_t region) {
+    code.EnableWriting();
+    SCOPE_EXIT { code.DisableWriting(); };
+
+    const auto in_region = [&](CodePtr ptr) { return code.IsInRegion(ptr, region); };
+
+    // Patch locations within the region are about to be overwritten; they must never be patched again.
+    for (auto iter = patch_information.begin(); iter != patch_information.end();) {
+        auto& patch_info = iter->second;
+        patch_info.jg.erase(std::remove_if(patch_info.jg.begin(), patch_info.jg.end(), in_region), patch_info.jg.end());
+        patch_info.jmp.erase(std::remove_if(patch_info.jmp.begin(), patch_info.jmp.end(), in_region), patch_info.jmp.end());
+        patch_info.mov_rcx.erase(std::remove_if(patch_info.mov_rcx.begin(), patch_info.mov_rcx.end(), in_region), patch_info.mov_rcx.end());
+
+        if (patch_info.jg.empty() && patch_info.jmp.empty() && patch_info.mov_rcx.empty()) {
+            iter = patch_information.erase(iter);
+        } else {
+            ++iter;
+        }
+    }
 
+    // Blocks in other regions that link to evicted blocks are sent back to the dispatcher.
+    std::vector<IR::LocationDescriptor> evicted;
+    for (const u64 location_descriptor : block_descriptors.EraseIf([&](const BlockDescriptor& block) { return in_region(block.entrypoint); })) {
+        const IR::LocationDescriptor descriptor{location_descriptor};
         if (patch_information.count(descriptor)) {
             Unpatch(descriptor);
         }
-        block_descriptors.erase(it);
+        evicted.emplace_back(descriptor);
     }
+    return evicted;
 }
 
 } // namespace Dynarmic::Backend::X64
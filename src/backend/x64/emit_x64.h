@@ -16,6 +16,7 @@
 
 #include <xbyak_util.h>
 
+#include "backend/x64/block_lookup_table.h"
 #include "backend/x64/exception_handler.h"
 #include "backend/x64/reg_alloc.h"
 #include "common/bit_util.h"
@@ -55,10 +56,7 @@ struct EmitContext {
 
 class EmitX64 {
 public:
-    struct BlockDescriptor {
-        CodePtr entrypoint;  // Entrypoint of emitted code
-        size_t size;         // Length in bytes of emitted code
-    };
+    using BlockDescriptor = BlockLookupTable::BlockDescriptor;
 
     explicit EmitX64(BlockOfCode& code);
     virtual ~EmitX64();
@@ -72,6 +70,19 @@ public:
     /// Invalidates a selection of basic blocks.
     void InvalidateBasicBlocks(const std::unordered_set<IR::LocationDescriptor>& locations);
 
+    /// Forgets all basic blocks emitted into a code region, and unlinks any block that jumps into it.
+    /// This is to be called before that region's space is reused.
+    /// @returns the locations of the blocks that were forgotten.
+    virtual std::vector<IR::LocationDescriptor> EvictCodeRegion(size_t region);
+
+    struct FastDispatchStatistics {
+        u64 hits = 0;
+        u64 misses = 0;
+    };
+
+    /// Hit and miss counts of the fast dispatch table. Only collected if requested when the table was initialized.
+    FastDispatchStatistics GetFastDispatchStatistics() const { return fast_dispatch_statistics; }
+
 protected:
     // Microinstruction emitters
 #define OPCODE(name, type, ...) void Emit##name(EmitContext& ctx, IR::Inst* inst);
@@ -114,10 +125,39 @@ protected:
     virtual void EmitPatchJmp(const IR::LocationDescriptor& target_desc, CodePtr target_code_ptr = nullptr) = 0;
     virtual void EmitPatchMovRcx(CodePtr target_code_ptr = nullptr) = 0;
 
+    // Fast dispatch table
+    struct FastDispatchEntry {
+        u64 location_descriptor;
+        const void* code_ptr;
+    };
+    static_assert(sizeof(FastDispatchEntry) == 0x10);
+    /**
+     * Allocates a table of num_entries entries, arranged in sets of num_ways entries.
+     * This must be called before any fast dispatch code is emitted.
+     */
+    void InitializeFastDispatchTable(size_t num_entries, size_t num_ways, bool collect_statistics);
+    void ClearFastDispatchTable();
+    /**
+     * Looks up the location descriptor in rbx, hashing the PC in rbp.
+     * On a hit, jumps to hit with the code pointer in rax.
+     * On a miss, falls through with rbp pointing to the set the location descriptor belongs to.
+     * Clobbers rcx and r12.
+     */
+    void EmitFastDispatchTableLookup(Xbyak::Label& hit);
+    /// Inserts the location descriptor in rbx with the code pointer in rax into the set pointed to by rbp,
+    /// evicting the oldest entry of that set. Clobbers rcx and rdx.
+    void EmitFastDispatchTableInsert();
+
+    std::vector<FastDispatchEntry> fast_dispatch_table;
+    size_t fast_dispatch_table_ways = 1;
+    u32 fast_dispatch_table_mask = 0;
+    bool collect_fast_dispatch_statistics = false;
+    FastDispatchStatistics fast_dispatch_statistics;
+
     // State
     BlockOfCode& code;
     ExceptionHandler exception_handler;
-    std::unordered_map<IR::LocationDescriptor, BlockDescriptor> block_descriptors;
+    BlockLookupTable& block_descriptors;
     std::unordered_map<IR::LocationDescriptor, PatchInformation> patch_information;
 };
 
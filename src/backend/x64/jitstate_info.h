@@ -24,6 +24,7 @@ struct JitStateInfo {
         , offsetof_cpsr_nzcv(offsetof(JitStateType, cpsr_nzcv))
         , offsetof_fpsr_exc(offsetof(JitStateType, fpsr_exc))
         , offsetof_fpsr_qc(offsetof(JitStateType, fpsr_qc))
+        , offsetof_halt_requested(offsetof(JitStateType, halt_requested))
     {}
 
     const size_t offsetof_cycles_remaining;
@@ -37,6 +38,7 @@ struct JitStateInfo {
     const size_t offsetof_cpsr_nzcv;
     const size_t offsetof_fpsr_exc;
     const size_t offsetof_fpsr_qc;
+    const size_t offsetof_halt_requested;
 };
 
 } // namespace Dynarmic::Backend::X64
@@ -4,6 +4,11 @@
  * General Public License version 2 or any later version.
  */
 
+#include <algorithm>
+#include <optional>
+#include <utility>
+#include <vector>
+
 #include "frontend/A64/decoder/a64.h"
 #include "frontend/A64/location_descriptor.h"
 #include "frontend/A64/translate/impl/impl.h"
@@ -13,14 +18,40 @@
 
 namespace Dynarmic::A64 {
 
+namespace {
+
+/// Determines if translation of a trace can continue past an instruction that ended a basic block
+/// with terminal. If so, returns the location to continue at.
+std::optional<LocationDescriptor> GetTraceContinuation(const IR::Terminal& terminal, LocationDescriptor instruction_location) {
+    std::optional<IR::LocationDescriptor> next;
+    if (const auto term = boost::get<IR::Term::LinkBlock>(&terminal)) {
+        next = term->next;
+    } else if (const auto term = boost::get<IR::Term::LinkBlockFast>(&terminal)) {
+        next = term->next;
+    }
+
+    // Linking to the instruction itself means it has been deferred to the start of a new block.
+    if (!next || *next == IR::LocationDescriptor{instruction_location}) {
+        return std::nullopt;
+    }
+    return LocationDescriptor{*next};
+}
+
+} // anonymous namespace
+
 IR::Block Translate(LocationDescriptor descriptor, MemoryReadCodeFuncType memory_read_code, TranslationOptions options) {
+    const size_t max_blocks_per_trace = options.max_blocks_per_trace;
+
     IR::Block block{descriptor};
     TranslatorVisitor visitor{block, descriptor, std::move(options)};
 
     const bool single_step = descriptor.SingleStepping();
+    std::vector<std::pair<LocationDescriptor, LocationDescriptor>> code_ranges;
+    LocationDescriptor range_start = descriptor;
     bool should_continue = true;
     do {
-        const u64 pc = visitor.ir.current_location->PC();
+        const LocationDescriptor instruction_location = *visitor.ir.current_location;
+        const u64 pc = instruction_location.PC();
         const u32 instruction = memory_read_code(pc);
 
         if (auto decoder = Decode<TranslatorVisitor>(instruction)) {
@@ -31,6 +62,21 @@ IR::Block Translate(LocationDescriptor descriptor, MemoryReadCodeFuncType memory
 
         visitor.ir.current_location = visitor.ir.current_location->AdvancePC(4);
         block.CycleCount()++;
+
+        if (!should_continue && !single_step && code_ranges.size() + 1 < max_blocks_per_trace) {
+            const auto next = GetTraceContinuation(block.GetTerminal(), instruction_location);
+            const auto already_translated = [&](LocationDescriptor location) {
+                return location == range_start || std::any_of(code_ranges.begin(), code_ranges.end(), [&](const auto& range) { return location == range.first; });
+            };
+
+            if (next && !already_translated(*next)) {
+                code_ranges.emplace_back(range_start, *visitor.ir.current_location);
+                block.ReplaceTerminal(IR::Term::Invalid{});
+                visitor.ir.current_location = *next;
+                range_start = *next;
+                should_continue = true;
+            }
+        }
     } while (should_continue && !single_step);
 
     if (single_step && should_continue) {
@@ -39,7 +85,11 @@ IR::Block Translate(LocationDescriptor descriptor, MemoryReadCodeFuncType memory
 
     ASSERT_MSG(block.HasTerminal(), "Terminal has not been set");
 
-    block.SetEndLocation(*visitor.ir.current_location);
+    code_ranges.emplace_back(range_start, *visitor.ir.current_location);
+    block.SetEndLocation(code_ranges.front().second);
+    for (size_t i = 1; i < code_ranges.size(); i++) {
+        block.AddAdditionalCodeRange(code_ranges[i].first, code_ranges[i].second);
+    }
 
     return block;
 }
@@ -5,6 +5,7 @@
  */
 #pragma once
 
+#include <cstddef>
 #include <functional>
 
 #include "common/common_types.h"
@@ -31,6 +32,11 @@ struct TranslationOptions {
     /// If this is false, we treat the instruction as a NOP.
     /// If this is true, we emit an ExceptionRaised instruction.
     bool hook_hint_instructions = true;
+
+    /// This is the maximum number of basic blocks combined into a single block.
+    /// If this is greater than 1, translation continues at the target of unconditional direct
+    /// branches (B and BL) instead of ending the block there.
+    size_t max_blocks_per_trace = 1;
 };
 
 /**
@@ -8,6 +8,7 @@
 #include <initializer_list>
 #include <map>
 #include <string>
+#include <unordered_map>
 
 #include <fmt/format.h>
 #include <fmt/ostream.h>
@@ -32,6 +33,35 @@ Block::Block(Block&&) = default;
 
 Block& Block::operator=(Block&&) = default;
 
+Block Block::Clone() const {
+    Block result{location};
+    result.end_location = end_location;
+    result.additional_code_ranges = additional_code_ranges;
+    result.cond = cond;
+    result.cond_failed = cond_failed;
+    result.cond_failed_cycle_count = cond_failed_cycle_count;
+    result.terminal = terminal;
+    result.cycle_count = cycle_count;
+
+    std::unordered_map<const Inst*, Inst*> inst_map;
+    for (const Inst& inst : instructions) {
+        Inst* new_inst = new(result.instruction_alloc_pool->Alloc()) Inst(inst.GetOpcode());
+
+        for (size_t i = 0; i < inst.NumArgs(); i++) {
+            Value arg = inst.GetArg(i);
+            if (arg.IsIdentity() || !arg.IsImmediate()) {
+                arg = Value(inst_map.at(arg.GetInst()));
+            }
+            new_inst->SetArg(i, arg);
+        }
+
+        result.instructions.push_back(new_inst);
+        inst_map.emplace(&inst, new_inst);
+    }
+
+    return result;
+}
+
 void Block::AppendNewInst(Opcode opcode, std::initializer_list<IR::Value> args) {
     PrependNewInst(end(), opcode, args);
 }
@@ -60,6 +90,14 @@ void Block::SetEndLocation(const LocationDescriptor& descriptor) {
     end_location = descriptor;
 }
 
+const std::vector<std::pair<LocationDescriptor, LocationDescriptor>>& Block::AdditionalCodeRanges() const {
+    return additional_code_ranges;
+}
+
+void Block::AddAdditionalCodeRange(const LocationDescriptor& start, const LocationDescriptor& end) {
+    additional_code_ranges.emplace_back(start, end);
+}
+
 Cond Block::GetCondition() const {
     return cond;
 }
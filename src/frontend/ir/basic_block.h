@@ -10,6 +10,8 @@
 #include <memory>
 #include <optional>
 #include <string>
+#include <utility>
+#include <vector>
 
 #include "common/common_types.h"
 #include "common/intrusive_list.h"
@@ -51,6 +53,9 @@ public:
     Block(Block&&);
     Block& operator=(Block&&);
 
+    /// Creates a deep copy of this basic block.
+    Block Clone() const;
+
     bool                   empty()   const { return instructions.empty();   }
     size_type              size()    const { return instructions.size();    }
 
@@ -103,6 +108,13 @@ public:
     /// Sets the end location for this basic block.
     void SetEndLocation(const LocationDescriptor& descriptor);
 
+    /// Gets the guest code this block was translated from other than that between Location() and
+    /// EndLocation(), as pairs of start and end locations. This is non-empty if translation
+    /// followed branches to combine several basic blocks into this one.
+    const std::vector<std::pair<LocationDescriptor, LocationDescriptor>>& AdditionalCodeRanges() const;
+    /// Records that guest code between start and end was also translated into this block.
+    void AddAdditionalCodeRange(const LocationDescriptor& start, const LocationDescriptor& end);
+
     /// Gets the condition required to pass in order to execute this block.
     Cond GetCondition() const;
     /// Sets the condition required to pass in order to execute this block.
@@ -144,6 +156,8 @@ private:
     LocationDescriptor location;
     /// Description of the end location of this block
     LocationDescriptor end_location;
+    /// Other guest code translated into this block
+    std::vector<std::pair<LocationDescriptor, LocationDescriptor>> additional_code_ranges;
     /// Conditional to pass in order to execute this block
     Cond cond;
     /// Block to execute next if `cond` did not pass.
@@ -71,6 +71,11 @@ bool Inst::IsSharedMemoryRead() const {
     case Opcode::A64ReadMemory32:
     case Opcode::A64ReadMemory64:
     case Opcode::A64ReadMemory128:
+    case Opcode::A64ReadMemoryTranslated8:
+    case Opcode::A64ReadMemoryTranslated16:
+    case Opcode::A64ReadMemoryTranslated32:
+    case Opcode::A64ReadMemoryTranslated64:
+    case Opcode::A64ReadMemoryTranslated128:
         return true;
 
     default:
@@ -89,6 +94,11 @@ bool Inst::IsSharedMemoryWrite() const {
     case Opcode::A64WriteMemory32:
     case Opcode::A64WriteMemory64:
     case Opcode::A64WriteMemory128:
+    case Opcode::A64WriteMemoryTranslated8:
+    case Opcode::A64WriteMemoryTranslated16:
+    case Opcode::A64WriteMemoryTranslated32:
+    case Opcode::A64WriteMemoryTranslated64:
+    case Opcode::A64WriteMemoryTranslated128:
         return true;
 
     default:
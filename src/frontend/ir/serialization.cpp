@@ -0,0 +1,407 @@
+/* This file is part of the dynarmic project.
+ * Copyright (c) 2020 MerryMage
+ * This software may be used and distributed according to the terms of the GNU
+ * General Public License version 2 or any later version.
+ */
+
+#include <array>
+#include <cstring>
+#include <optional>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+#include <boost/mpl/at.hpp>
+#include <boost/mpl/size.hpp>
+#include <fmt/ostream.h>
+
+#include "common/crypto/crc32.h"
+#include "frontend/A32/types.h"
+#include "frontend/A64/types.h"
+#include "frontend/ir/basic_block.h"
+#include "frontend/ir/cond.h"
+#include "frontend/ir/microinstruction.h"
+#include "frontend/ir/opcodes.h"
+#include "frontend/ir/serialization.h"
+#include "frontend/ir/terminal.h"
+#include "frontend/ir/type.h"
+#include "frontend/ir/value.h"
+
+namespace Dynarmic::IR {
+
+namespace {
+
+/// Increment this whenever the serialized format or IR::Terminal changes.
+/// Changes to opcodes are accounted for automatically by SerializationFingerprint.
+constexpr u64 format_version = 3;
+
+/// Terminals nested deeper than this are rejected when deserializing.
+constexpr size_t max_terminal_depth = 64;
+
+template <typename T>
+void Write(std::vector<u8>& out, T value) {
+    static_assert(std::is_trivially_copyable_v<T>);
+    const size_t pos = out.size();
+    out.resize(pos + sizeof(T));
+    std::memcpy(out.data() + pos, &value, sizeof(T));
+}
+
+struct Reader {
+    const std::vector<u8>& data;
+    size_t pos;
+    bool ok = true;
+
+    template <typename T>
+    T Read() {
+        static_assert(std::is_trivially_copyable_v<T>);
+        T value{};
+        if (!ok || pos > data.size() || data.size() - pos < sizeof(T)) {
+            ok = false;
+            return value;
+        }
+        std::memcpy(&value, data.data() + pos, sizeof(T));
+        pos += sizeof(T);
+        return value;
+    }
+};
+
+void WriteValue(std::vector<u8>& out, const Value& value, const std::unordered_map<const Inst*, u32>& inst_indices) {
+    if (value.IsIdentity() || !value.IsImmediate()) {
+        Write<u16>(out, static_cast<u16>(Type::Opaque));
+        Write<u32>(out, inst_indices.at(value.GetInst()));
+        return;
+    }
+
+    const Type type = value.GetType();
+    Write<u16>(out, static_cast<u16>(type));
+    switch (type) {
+    case Type::Void:
+        break;
+    case Type::A32Reg:
+        Write<u8>(out, static_cast<u8>(value.GetA32RegRef()));
+        break;
+    case Type::A32ExtReg:
+        Write<u8>(out, static_cast<u8>(value.GetA32ExtRegRef()));
+        break;
+    case Type::A64Reg:
+        Write<u8>(out, static_cast<u8>(value.GetA64RegRef()));
+        break;
+    case Type::A64Vec:
+        Write<u8>(out, static_cast<u8>(value.GetA64VecRef()));
+        break;
+    case Type::U1:
+        Write<u8>(out, value.GetU1());
+        break;
+    case Type::U8:
+        Write<u8>(out, value.GetU8());
+        break;
+    case Type::U16:
+        Write<u16>(out, value.GetU16());
+        break;
+    case Type::U32:
+        Write<u32>(out, value.GetU32());
+        break;
+    case Type::U64:
+        Write<u64>(out, value.GetU64());
+        break;
+    case Type::CoprocInfo:
+        Write<Value::CoprocessorInfo>(out, value.GetCoprocInfo());
+        break;
+    case Type::Cond:
+        Write<u8>(out, static_cast<u8>(value.GetCond()));
+        break;
+    default:
+        ASSERT_MSG(false, "Cannot serialize immediate of type {}", type);
+    }
+}
+
+std::optional<Value> ReadValue(Reader& reader, const std::vector<Inst*>& insts) {
+    const auto type = static_cast<Type>(reader.Read<u16>());
+    switch (type) {
+    case Type::Void:
+        return Value{};
+    case Type::Opaque: {
+        const u32 index = reader.Read<u32>();
+        if (index >= insts.size()) {
+            return std::nullopt;
+        }
+        return Value{insts[index]};
+    }
+    case Type::A32Reg:
+        return Value{static_cast<A32::Reg>(reader.Read<u8>())};
+    case Type::A32ExtReg:
+        return Value{static_cast<A32::ExtReg>(reader.Read<u8>())};
+    case Type::A64Reg:
+        return Value{static_cast<A64::Reg>(reader.Read<u8>())};
+    case Type::A64Vec:
+        return Value{static_cast<A64::Vec>(reader.Read<u8>())};
+    case Type::U1:
+        return Value{reader.Read<u8>() != 0};
+    case Type::U8:
+        return Value{reader.Read<u8>()};
+    case Type::U16:
+        return Value{reader.Read<u16>()};
+    case Type::U32:
+        return Value{reader.Read<u32>()};
+    case Type::U64:
+        return Value{reader.Read<u64>()};
+    case Type::CoprocInfo:
+        return Value{reader.Read<Value::CoprocessorInfo>()};
+    case Type::Cond:
+        return Value{static_cast<Cond>(reader.Read<u8>())};
+    default:
+        return std::nullopt;
+    }
+}
+
+/// Terminals are tagged with the index of their alternative in IR::Terminal.
+/// Reordering or adding alternatives breaks the static_asserts below; update the tags and
+/// format_version together.
+enum class TerminalTag : u8 {
+    Invalid = 0,
+    Interpret = 1,
+    ReturnToDispatch = 2,
+    LinkBlock = 3,
+    LinkBlockFast = 4,
+    PopRSBHint = 5,
+    FastDispatchHint = 6,
+    If = 7,
+    CheckBit = 8,
+    CheckHalt = 9,
+};
+
+template <TerminalTag tag, typename T>
+constexpr bool is_tag_of = std::is_same_v<typename boost::mpl::at_c<Terminal::types, static_cast<int>(tag)>::type, T>;
+
+static_assert(boost::mpl::size<Terminal::types>::value == 10);
+static_assert(is_tag_of<TerminalTag::Invalid, Term::Invalid>);
+static_assert(is_tag_of<TerminalTag::Interpret, Term::Interpret>);
+static_assert(is_tag_of<TerminalTag::ReturnToDispatch, Term::ReturnToDispatch>);
+static_assert(is_tag_of<TerminalTag::LinkBlock, Term::LinkBlock>);
+static_assert(is_tag_of<TerminalTag::LinkBlockFast, Term::LinkBlockFast>);
+static_assert(is_tag_of<TerminalTag::PopRSBHint, Term::PopRSBHint>);
+static_assert(is_tag_of<TerminalTag::FastDispatchHint, Term::FastDispatchHint>);
+static_assert(is_tag_of<TerminalTag::If, Term::If>);
+static_assert(is_tag_of<TerminalTag::CheckBit, Term::CheckBit>);
+static_assert(is_tag_of<TerminalTag::CheckHalt, Term::CheckHalt>);
+
+void WriteTerminal(std::vector<u8>& out, const Terminal& terminal) {
+    const auto tag = static_cast<TerminalTag>(terminal.which());
+    Write<TerminalTag>(out, tag);
+    switch (tag) {
+    case TerminalTag::Interpret: {
+        const auto& term = boost::get<Term::Interpret>(terminal);
+        Write<u64>(out, term.next.Value());
+        Write<u64>(out, term.num_instructions);
+        break;
+    }
+    case TerminalTag::LinkBlock:
+        Write<u64>(out, boost::get<Term::LinkBlock>(terminal).next.Value());
+        break;
+    case TerminalTag::LinkBlockFast:
+        Write<u64>(out, boost::get<Term::LinkBlockFast>(terminal).next.Value());
+        break;
+    case TerminalTag::If: {
+        const auto& term = boost::get<Term::If>(terminal);
+        Write<u8>(out, static_cast<u8>(term.if_));
+        WriteTerminal(out, term.then_);
+        WriteTerminal(out, term.else_);
+        break;
+    }
+    case TerminalTag::CheckBit: {
+        const auto& term = boost::get<Term::CheckBit>(terminal);
+        WriteTerminal(out, term.then_);
+        WriteTerminal(out, term.else_);
+        break;
+    }
+    case TerminalTag::CheckHalt:
+        WriteTerminal(out, boost::get<Term::CheckHalt>(terminal).else_);
+        break;
+    case TerminalTag::Invalid:
+    case TerminalTag::ReturnToDispatch:
+    case TerminalTag::PopRSBHint:
+    case TerminalTag::FastDispatchHint:
+        break;
+    }
+}
+
+std::optional<Terminal> ReadTerminal(Reader& reader, size_t depth) {
+    if (depth > max_terminal_depth) {
+        return std::nullopt;
+    }
+
+    switch (reader.Read<TerminalTag>()) {
+    case TerminalTag::Invalid:
+        return Term::Invalid{};
+    case TerminalTag::Interpret: {
+        Term::Interpret term{LocationDescriptor{reader.Read<u64>()}};
+        term.num_instructions = static_cast<size_t>(reader.Read<u64>());
+        return term;
+    }
+    case TerminalTag::ReturnToDispatch:
+        return Term::ReturnToDispatch{};
+    case TerminalTag::LinkBlock:
+        return Term::LinkBlock{LocationDescriptor{reader.Read<u64>()}};
+    case TerminalTag::LinkBlockFast:
+        return Term::LinkBlockFast{LocationDescriptor{reader.Read<u64>()}};
+    case TerminalTag::PopRSBHint:
+        return Term::PopRSBHint{};
+    case TerminalTag::FastDispatchHint:
+        return Term::FastDispatchHint{};
+    case TerminalTag::If: {
+        const auto cond = static_cast<Cond>(reader.Read<u8>());
+        auto then_ = ReadTerminal(reader, depth + 1);
+        auto else_ = then_ ? ReadTerminal(reader, depth + 1) : std::nullopt;
+        if (!else_) {
+            return std::nullopt;
+        }
+        return Term::If{cond, std::move(*then_), std::move(*else_)};
+    }
+    case TerminalTag::CheckBit: {
+        auto then_ = ReadTerminal(reader, depth + 1);
+        auto else_ = then_ ? ReadTerminal(reader, depth + 1) : std::nullopt;
+        if (!else_) {
+            return std::nullopt;
+        }
+        return Term::CheckBit{std::move(*then_), std::move(*else_)};
+    }
+    case TerminalTag::CheckHalt: {
+        auto else_ = ReadTerminal(reader, depth + 1);
+        if (!else_) {
+            return std::nullopt;
+        }
+        return Term::CheckHalt{std::move(*else_)};
+    }
+    default:
+        return std::nullopt;
+    }
+}
+
+} // anonymous namespace
+
+u64 SerializationFingerprint() {
+    static const u64 fingerprint = [] {
+        u32 crc_iso = 0;
+        u32 crc_castagnoli = 0;
+        const auto add = [&](u64 value) {
+            crc_iso = Common::Crypto::CRC32::ComputeCRC32ISO(crc_iso, value, 8);
+            crc_castagnoli = Common::Crypto::CRC32::ComputeCRC32Castagnoli(crc_castagnoli, value, 8);
+        };
+
+        add(format_version);
+        for (size_t i = 0; i < OpcodeCount; i++) {
+            const auto op = static_cast<Opcode>(i);
+            for (const char c : GetNameOf(op)) {
+                add(static_cast<u8>(c));
+            }
+            add(static_cast<u64>(GetTypeOf(op)));
+            for (size_t arg = 0; arg < GetNumArgsOf(op); arg++) {
+                add(static_cast<u64>(GetArgTypeOf(op, arg)));
+            }
+        }
+
+        return (u64{crc_iso} << 32) | crc_castagnoli;
+    }();
+    return fingerprint;
+}
+
+void SerializeBlock(const Block& block, std::vector<u8>& out) {
+    Write<u64>(out, block.Location().Value());
+    Write<u64>(out, block.EndLocation().Value());
+    Write<u32>(out, static_cast<u32>(block.AdditionalCodeRanges().size()));
+    for (const auto& [start, end] : block.AdditionalCodeRanges()) {
+        Write<u64>(out, start.Value());
+        Write<u64>(out, end.Value());
+    }
+    Write<u8>(out, static_cast<u8>(block.GetCondition()));
+    Write<u8>(out, block.HasConditionFailedLocation());
+    if (block.HasConditionFailedLocation()) {
+        Write<u64>(out, block.ConditionFailedLocation().Value());
+    }
+    Write<u64>(out, block.ConditionFailedCycleCount());
+    Write<u64>(out, block.CycleCount());
+
+    Write<u32>(out, static_cast<u32>(block.size()));
+    std::unordered_map<const Inst*, u32> inst_indices;
+    for (const Inst& inst : block) {
+        Write<u16>(out, static_cast<u16>(inst.GetOpcode()));
+        for (size_t i = 0; i < inst.NumArgs(); i++) {
+            WriteValue(out, inst.GetArg(i), inst_indices);
+        }
+        inst_indices.emplace(&inst, static_cast<u32>(inst_indices.size()));
+    }
+
+    WriteTerminal(out, block.GetTerminal());
+}
+
+std::optional<Block> DeserializeBlock(const std::vector<u8>& data, size_t& pos) {
+    Reader reader{data, pos};
+
+    Block block{LocationDescriptor{reader.Read<u64>()}};
+    block.SetEndLocation(LocationDescriptor{reader.Read<u64>()});
+    const u32 num_additional_code_ranges = reader.Read<u32>();
+    for (u32 i = 0; i < num_additional_code_ranges && reader.ok; i++) {
+        const LocationDescriptor start{reader.Read<u64>()};
+        const LocationDescriptor end{reader.Read<u64>()};
+        block.AddAdditionalCodeRange(start, end);
+    }
+    block.SetCondition(static_cast<Cond>(reader.Read<u8>()));
+    if (reader.Read<u8>()) {
+        block.SetConditionFailedLocation(LocationDescriptor{reader.Read<u64>()});
+    }
+    block.ConditionFailedCycleCount() = static_cast<size_t>(reader.Read<u64>());
+    block.CycleCount() = static_cast<size_t>(reader.Read<u64>());
+
+    const u32 num_insts = reader.Read<u32>();
+    std::vector<Inst*> insts;
+    for (u32 i = 0; i < num_insts && reader.ok; i++) {
+        const u16 raw_op = reader.Read<u16>();
+        if (raw_op >= OpcodeCount) {
+            return std::nullopt;
+        }
+        const auto op = static_cast<Opcode>(raw_op);
+
+        std::array<Value, max_arg_count> args;
+        const size_t num_args = GetNumArgsOf(op);
+        for (size_t arg = 0; arg < num_args; arg++) {
+            const auto value = ReadValue(reader, insts);
+            if (!reader.ok || !value || !AreTypesCompatible(value->GetType(), GetArgTypeOf(op, arg))) {
+                return std::nullopt;
+            }
+            args[arg] = *value;
+        }
+
+        switch (num_args) {
+        case 0:
+            block.AppendNewInst(op, {});
+            break;
+        case 1:
+            block.AppendNewInst(op, {args[0]});
+            break;
+        case 2:
+            block.AppendNewInst(op, {args[0], args[1]});
+            break;
+        case 3:
+            block.AppendNewInst(op, {args[0], args[1], args[2]});
+            break;
+        case 4:
+            block.AppendNewInst(op, {args[0], args[1], args[2], args[3]});
+            break;
+        default:
+            return std::nullopt;
+        }
+        insts.emplace_back(&block.back());
+    }
+
+    auto terminal = ReadTerminal(reader, 0);
+    if (!reader.ok || !terminal) {
+        return std::nullopt;
+    }
+    block.SetTerminal(std::move(*terminal));
+
+    pos = reader.pos;
+    return block;
+}
+
+} // namespace Dynarmic::IR
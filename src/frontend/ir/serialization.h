@@ -0,0 +1,34 @@
+/* This file is part of the dynarmic project.
+ * Copyright (c) 2020 MerryMage
+ * This software may be used and distributed according to the terms of the GNU
+ * General Public License version 2 or any later version.
+ */
+
+#pragma once
+
+#include <optional>
+#include <vector>
+
+#include "common/common_types.h"
+
+namespace Dynarmic::IR {
+
+class Block;
+
+/**
+ * Identifies the serialization format and the IR definition it depends on.
+ * Data serialized by a build with a different fingerprint must not be deserialized.
+ */
+u64 SerializationFingerprint();
+
+/// Appends a serialized representation of block to out.
+void SerializeBlock(const Block& block, std::vector<u8>& out);
+
+/**
+ * Reconstructs a block serialized by SerializeBlock from data starting at pos.
+ * On success pos is advanced past the block.
+ * @returns std::nullopt if the data is malformed.
+ */
+std::optional<Block> DeserializeBlock(const std::vector<u8>& data, size_t& pos);
+
+} // namespace Dynarmic::IR
@@ -61,6 +61,10 @@ Value::Value(Cond value) : type(Type::Cond) {
     inner.imm_cond = value;
 }
 
+bool Value::IsIdentity() const {
+    return type == Type::Opaque && inner.inst->GetOpcode() == Opcode::Identity;
+}
+
 bool Value::IsImmediate() const {
     if (type == Type::Opaque)
         return inner.inst->GetOpcode() == Opcode::Identity ? inner.inst->GetArg(0).IsImmediate() : false;
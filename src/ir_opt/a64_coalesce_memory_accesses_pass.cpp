@@ -0,0 +1,169 @@
+/* This file is part of the dynarmic project.
+ * Copyright (c) 2020 MerryMage
+ * This software may be used and distributed according to the terms of the GNU
+ * General Public License version 2 or any later version.
+ */
+
+#include <algorithm>
+#include <optional>
+#include <vector>
+
+#include <dynarmic/A64/config.h>
+
+#include "common/common_types.h"
+#include "frontend/ir/basic_block.h"
+#include "frontend/ir/microinstruction.h"
+#include "frontend/ir/opcodes.h"
+#include "ir_opt/passes.h"
+
+namespace Dynarmic::Optimization {
+
+namespace {
+
+/// Accesses are only coalesced if they lie within this many bytes of the first access of their group.
+constexpr u64 max_span = 64;
+
+struct AccessInfo {
+    IR::Opcode translated_opcode;
+    u64 bytes;
+    bool is_write;
+};
+
+std::optional<AccessInfo> GetAccessInfo(IR::Opcode opcode) {
+    switch (opcode) {
+    case IR::Opcode::A64ReadMemory8:
+        return AccessInfo{IR::Opcode::A64ReadMemoryTranslated8, 1, false};
+    case IR::Opcode::A64ReadMemory16:
+        return AccessInfo{IR::Opcode::A64ReadMemoryTranslated16, 2, false};
+    case IR::Opcode::A64ReadMemory32:
+        return AccessInfo{IR::Opcode::A64ReadMemoryTranslated32, 4, false};
+    case IR::Opcode::A64ReadMemory64:
+        return AccessInfo{IR::Opcode::A64ReadMemoryTranslated64, 8, false};
+    case IR::Opcode::A64ReadMemory128:
+        return AccessInfo{IR::Opcode::A64ReadMemoryTranslated128, 16, false};
+    case IR::Opcode::A64WriteMemory8:
+        return AccessInfo{IR::Opcode::A64WriteMemoryTranslated8, 1, true};
+    case IR::Opcode::A64WriteMemory16:
+        return AccessInfo{IR::Opcode::A64WriteMemoryTranslated16, 2, true};
+    case IR::Opcode::A64WriteMemory32:
+        return AccessInfo{IR::Opcode::A64WriteMemoryTranslated32, 4, true};
+    case IR::Opcode::A64WriteMemory64:
+        return AccessInfo{IR::Opcode::A64WriteMemoryTranslated64, 8, true};
+    case IR::Opcode::A64WriteMemory128:
+        return AccessInfo{IR::Opcode::A64WriteMemoryTranslated128, 16, true};
+    default:
+        return std::nullopt;
+    }
+}
+
+struct Address {
+    /// nullptr if the address is a constant.
+    IR::Inst* base;
+    u64 offset;
+};
+
+Address DecomposeAddress(IR::Value value) {
+    if (value.IsImmediate()) {
+        return {nullptr, value.GetImmediateAsU64()};
+    }
+
+    IR::Inst* inst = value.GetInst();
+    if (inst->GetOpcode() == IR::Opcode::Add64 && inst->GetArg(2).IsImmediate() && !inst->GetArg(2).GetU1()) {
+        const Address lhs = DecomposeAddress(inst->GetArg(0));
+        const Address rhs = DecomposeAddress(inst->GetArg(1));
+        if (!lhs.base || !rhs.base) {
+            return {lhs.base ? lhs.base : rhs.base, lhs.offset + rhs.offset};
+        }
+    }
+    return {inst, 0};
+}
+
+/// Determines if the page table may have changed after inst, or if inst accesses memory itself.
+bool EndsGroup(const IR::Inst& inst) {
+    if (inst.IsMemoryReadOrWrite() || inst.GetOpcode() == IR::Opcode::A64GetCNTPCT) {
+        return true;
+    }
+    return inst.MayHaveSideEffects() && !inst.WritesToCoreRegister();
+}
+
+struct Group {
+    IR::Inst* base;
+    u64 first_offset;
+    u64 span;
+    bool has_write;
+    std::vector<IR::Block::iterator> accesses;
+};
+
+void CoalesceGroup(IR::Block& block, const Group& group) {
+    const IR::Value first_vaddr = group.accesses.front()->GetArg(0);
+    const auto translation = block.PrependNewInst(group.accesses.front(), IR::Opcode::A64TranslateMemory,
+                                                  {first_vaddr, IR::Value{static_cast<u8>(group.span)}, IR::Value{group.has_write}});
+    const IR::Value host_address{&*translation};
+
+    for (const auto& iter : group.accesses) {
+        const AccessInfo info = *GetAccessInfo(iter->GetOpcode());
+        const IR::Value vaddr = iter->GetArg(0);
+        const IR::Value offset{static_cast<u8>(DecomposeAddress(vaddr).offset - group.first_offset)};
+
+        if (info.is_write) {
+            block.PrependNewInst(iter, info.translated_opcode, {host_address, vaddr, offset, iter->GetArg(1)});
+            iter->Invalidate();
+        } else {
+            const auto read = block.PrependNewInst(iter, info.translated_opcode, {host_address, vaddr, offset});
+            iter->ReplaceUsesWith(IR::Value{&*read});
+        }
+    }
+}
+
+} // anonymous namespace
+
+void A64CoalesceMemoryAccesses(IR::Block& block, const A64::UserConfig& conf) {
+    // Fastmem accesses need no translation, and misalignment detection must be performed for each access.
+    if (!conf.page_table || conf.fastmem_pointer || conf.detect_misaligned_access_via_page_table != 0) {
+        return;
+    }
+
+    std::vector<Group> groups;
+    std::optional<Group> current;
+
+    const auto finish_group = [&] {
+        if (current && current->accesses.size() > 1) {
+            groups.emplace_back(std::move(*current));
+        }
+        current.reset();
+    };
+
+    for (auto iter = block.begin(); iter != block.end(); ++iter) {
+        const auto info = GetAccessInfo(iter->GetOpcode());
+        if (!info) {
+            if (EndsGroup(*iter)) {
+                finish_group();
+            }
+            continue;
+        }
+
+        const Address address = DecomposeAddress(iter->GetArg(0));
+        // Accesses below the first one of the group wrap around to large distances and are rejected.
+        const bool fits_group = current
+                             && address.base == current->base
+                             && address.offset - current->first_offset + info->bytes <= max_span;
+        if (!fits_group) {
+            finish_group();
+            if (!address.base) {
+                continue;
+            }
+            current = Group{address.base, address.offset, 0, false, {}};
+        }
+
+        current->span = std::max(current->span, address.offset - current->first_offset + info->bytes);
+        current->has_write |= info->is_write;
+        current->accesses.emplace_back(iter);
+    }
+    finish_group();
+
+    for (const auto& group : groups) {
+        CoalesceGroup(block, group);
+    }
+}
+
+} // namespace Dynarmic::Optimization
@@ -0,0 +1,91 @@
+/* This file is part of the dynarmic project.
+ * Copyright (c) 2020 MerryMage
+ * This software may be used and distributed according to the terms of the GNU
+ * General Public License version 2 or any later version.
+ */
+
+#include <optional>
+
+#include <dynarmic/A64/config.h>
+
+#include "frontend/A64/ir_emitter.h"
+#include "frontend/ir/basic_block.h"
+#include "frontend/ir/opcodes.h"
+#include "ir_opt/passes.h"
+
+namespace Dynarmic::Optimization {
+
+namespace {
+
+/// Addresses such as those of ADRP+LDR pairs are an addition of two immediates, which ConstantPropagation does not fold.
+std::optional<u64> GetConstantAddress(const IR::Value& value) {
+    if (value.IsImmediate()) {
+        return value.GetImmediateAsU64();
+    }
+
+    const IR::Inst* inst = value.GetInst();
+    if (inst->GetOpcode() == IR::Opcode::Add64 && inst->GetArg(2).IsImmediate() && !inst->GetArg(2).GetU1()) {
+        const auto lhs = GetConstantAddress(inst->GetArg(0));
+        const auto rhs = GetConstantAddress(inst->GetArg(1));
+        if (lhs && rhs) {
+            return *lhs + *rhs;
+        }
+    }
+    return std::nullopt;
+}
+
+} // anonymous namespace
+
+void A64ConstantMemoryReads(IR::Block& block, A64::UserCallbacks* cb) {
+    for (auto& inst : block) {
+        switch (inst.GetOpcode()) {
+        case IR::Opcode::A64ReadMemory8: {
+            const auto vaddr = GetConstantAddress(inst.GetArg(0));
+            if (vaddr && cb->IsReadOnlyMemory(*vaddr)) {
+                const u8 value_from_memory = cb->MemoryRead8(*vaddr);
+                inst.ReplaceUsesWith(IR::Value{value_from_memory});
+            }
+            break;
+        }
+        case IR::Opcode::A64ReadMemory16: {
+            const auto vaddr = GetConstantAddress(inst.GetArg(0));
+            if (vaddr && cb->IsReadOnlyMemory(*vaddr)) {
+                const u16 value_from_memory = cb->MemoryRead16(*vaddr);
+                inst.ReplaceUsesWith(IR::Value{value_from_memory});
+            }
+            break;
+        }
+        case IR::Opcode::A64ReadMemory32: {
+            const auto vaddr = GetConstantAddress(inst.GetArg(0));
+            if (vaddr && cb->IsReadOnlyMemory(*vaddr)) {
+                const u32 value_from_memory = cb->MemoryRead32(*vaddr);
+                inst.ReplaceUsesWith(IR::Value{value_from_memory});
+            }
+            break;
+        }
+        case IR::Opcode::A64ReadMemory64: {
+            const auto vaddr = GetConstantAddress(inst.GetArg(0));
+            if (vaddr && cb->IsReadOnlyMemory(*vaddr)) {
+                const u64 value_from_memory = cb->MemoryRead64(*vaddr);
+                inst.ReplaceUsesWith(IR::Value{value_from_memory});
+            }
+            break;
+        }
+        case IR::Opcode::A64ReadMemory128: {
+            const auto vaddr = GetConstantAddress(inst.GetArg(0));
+            if (vaddr && cb->IsReadOnlyMemory(*vaddr)) {
+                // There are no 128-bit immediates, so the value is assembled from two 64-bit halves.
+                const A64::Vector value_from_memory = cb->MemoryRead128(*vaddr);
+                A64::IREmitter ir{block};
+                ir.SetInsertionPoint(&inst);
+                inst.ReplaceUsesWith(ir.Pack2x64To1x128(ir.Imm64(value_from_memory[0]), ir.Imm64(value_from_memory[1])));
+            }
+            break;
+        }
+        default:
+            break;
+        }
+    }
+}
+
+} // namespace Dynarmic::Optimization
@@ -4,9 +4,17 @@
  * General Public License version 2 or any later version.
  */
 
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
 #include <catch.hpp>
 
 #include <dynarmic/A64/exclusive_monitor.h>
+#include <dynarmic/A64/translation_cache.h>
 
 #include "common/fp/fpsr.h"
 #include "testenv.h"
@@ -536,3 +544,539 @@ TEST_CASE("A64: SQDMULH.4S (saturate)", "[a64]") {
     REQUIRE(jit.GetVector(0) == Vector{0x7ffffffe7fffffff, 0x8000000180000001});
     REQUIRE(FP::FPSR{jit.GetFpsr()}.QC() == true);
 }
+
+TEST_CASE("A64: Shared translation cache", "[a64]") {
+    Dynarmic::A64::TranslationCache translation_cache;
+
+    A64TestEnv env1;
+    A64TestEnv env2;
+    Dynarmic::A64::UserConfig conf1{&env1};
+    Dynarmic::A64::UserConfig conf2{&env2};
+    conf1.translation_cache = &translation_cache;
+    conf2.translation_cache = &translation_cache;
+    Dynarmic::A64::Jit jit1{conf1};
+    Dynarmic::A64::Jit jit2{conf2};
+
+    // Both Jits see the same guest code.
+    for (A64TestEnv* env : {&env1, &env2}) {
+        env->code_mem.emplace_back(0x91000400); // ADD X0, X0, #1
+        env->code_mem.emplace_back(0x14000000); // B .
+    }
+
+    jit1.SetPC(0);
+    env1.ticks_left = 2;
+    jit1.Run();
+    REQUIRE(jit1.GetRegister(0) == 1);
+
+    // jit2 reuses the translation made by jit1.
+    const auto after_jit1 = translation_cache.GetStatistics();
+    jit2.SetPC(0);
+    env2.ticks_left = 2;
+    jit2.Run();
+    REQUIRE(jit2.GetRegister(0) == 1);
+    REQUIRE(translation_cache.GetStatistics().hits > after_jit1.hits);
+    REQUIRE(translation_cache.GetStatistics().misses == after_jit1.misses);
+
+    // When the guest code changes, every Jit must be told, as each has emitted its own host code.
+    for (A64TestEnv* env : {&env1, &env2}) {
+        env->code_mem[0] = 0x91000800; // ADD X0, X0, #2
+    }
+    jit1.InvalidateCacheRange(0, 4);
+    jit2.InvalidateCacheRange(0, 4);
+
+    jit2.SetPC(0);
+    jit2.SetRegister(0, 0);
+    env2.ticks_left = 2;
+    jit2.Run();
+    REQUIRE(jit2.GetRegister(0) == 2);
+
+    // jit1 now picks up jit2's translation of the new code.
+    const auto after_jit2 = translation_cache.GetStatistics();
+    jit1.SetPC(0);
+    jit1.SetRegister(0, 0);
+    env1.ticks_left = 2;
+    jit1.Run();
+    REQUIRE(jit1.GetRegister(0) == 2);
+    REQUIRE(translation_cache.GetStatistics().hits > after_jit2.hits);
+}
+
+TEST_CASE("A64: Persistent translation cache", "[a64]") {
+    const std::string path = "dynarmic_test_translation_cache.bin";
+
+    const auto run = [](Dynarmic::A64::TranslationCache& translation_cache, u32 cmp_instruction) {
+        A64TestEnv env;
+        Dynarmic::A64::UserConfig conf{&env};
+        conf.translation_cache = &translation_cache;
+        Dynarmic::A64::Jit jit{conf};
+
+        env.code_mem.emplace_back(0x91000400); // ADD X0, X0, #1
+        env.code_mem.emplace_back(cmp_instruction);
+        env.code_mem.emplace_back(0x54FFFFC1); // B.NE .-8
+        env.code_mem.emplace_back(0x14000000); // B .
+
+        jit.SetPC(0);
+        env.ticks_left = 30;
+        jit.Run();
+        REQUIRE(jit.GetPC() == 12);
+        return jit.GetRegister(0);
+    };
+
+    constexpr u32 CMP_X0_3 = 0xF1000C1F; // CMP X0, #3
+    constexpr u32 CMP_X0_5 = 0xF100141F; // CMP X0, #5
+
+    {
+        Dynarmic::A64::TranslationCache translation_cache;
+        REQUIRE(run(translation_cache, CMP_X0_3) == 3);
+        REQUIRE(translation_cache.SaveToFile(path));
+    }
+
+    // Translations are reloaded and used instead of retranslating.
+    {
+        Dynarmic::A64::TranslationCache translation_cache;
+        REQUIRE(translation_cache.LoadFromFile(path));
+        REQUIRE(run(translation_cache, CMP_X0_3) == 3);
+
+        const auto statistics = translation_cache.GetStatistics();
+        REQUIRE(statistics.hits > 0);
+        REQUIRE(statistics.misses == 0);
+        REQUIRE(statistics.discarded == 0);
+    }
+
+    // Translations of guest code that has since changed are not used.
+    {
+        Dynarmic::A64::TranslationCache translation_cache;
+        REQUIRE(translation_cache.LoadFromFile(path));
+        REQUIRE(run(translation_cache, CMP_X0_5) == 5);
+
+        const auto statistics = translation_cache.GetStatistics();
+        REQUIRE(statistics.discarded > 0);
+        REQUIRE(statistics.misses > 0);
+    }
+
+    // Corrupted files are rejected.
+    {
+        std::fstream file{path, std::ios::binary | std::ios::in | std::ios::out};
+        file.seekp(-1, std::ios::end);
+        file.put('\xFF');
+    }
+    {
+        Dynarmic::A64::TranslationCache translation_cache;
+        REQUIRE(!translation_cache.LoadFromFile(path));
+    }
+
+    std::remove(path.c_str());
+}
+
+TEST_CASE("A64: Tiered compilation", "[a64]") {
+    A64TestEnv env;
+    Dynarmic::A64::UserConfig conf{&env};
+    conf.tiered_compilation_threshold = 10;
+    Dynarmic::A64::Jit jit{conf};
+
+    env.code_mem.emplace_back(0x91000400); // ADD X0, X0, #1
+    env.code_mem.emplace_back(0xF10FA01F); // CMP X0, #1000
+    env.code_mem.emplace_back(0x54FFFFC1); // B.NE .-8
+    env.code_mem.emplace_back(0x14000000); // B .
+
+    // The loop body becomes hot part way through and is recompiled.
+    jit.SetPC(0);
+    env.ticks_left = 4000;
+    jit.Run();
+    REQUIRE(jit.GetRegister(0) == 1000);
+    REQUIRE(jit.GetPC() == 12);
+
+    // The recompiled block is invalidated like any other.
+    env.code_mem[0] = 0x91000800; // ADD X0, X0, #2
+    jit.InvalidateCacheRange(0, 4);
+
+    jit.SetPC(0);
+    jit.SetRegister(0, 0);
+    env.ticks_left = 4000;
+    jit.Run();
+    REQUIRE(jit.GetRegister(0) == 1000);
+    REQUIRE(jit.GetPC() == 12);
+}
+
+TEST_CASE("A64: Trace formation", "[a64]") {
+    A64TestEnv env;
+    Dynarmic::A64::UserConfig conf{&env};
+    conf.max_blocks_per_trace = 4;
+    Dynarmic::A64::Jit jit{conf};
+
+    env.code_mem.emplace_back(0x91000400); // ADD X0, X0, #1
+    env.code_mem.emplace_back(0x14000002); // B .+8
+    env.code_mem.emplace_back(0x91019000); // ADD X0, X0, #100
+    env.code_mem.emplace_back(0x94000002); // BL .+8
+    env.code_mem.emplace_back(0x14000000); // B .
+    env.code_mem.emplace_back(0x91000800); // ADD X0, X0, #2
+    env.code_mem.emplace_back(0xD65F03C0); // RET
+
+    jit.SetPC(0);
+    env.ticks_left = 10;
+    jit.Run();
+    REQUIRE(jit.GetRegister(0) == 3);
+    REQUIRE(jit.GetRegister(30) == 16);
+    REQUIRE(jit.GetPC() == 16);
+
+    // Modifying code in a later part of the trace invalidates the whole trace.
+    env.code_mem[5] = 0x91001000; // ADD X0, X0, #4
+    jit.InvalidateCacheRange(20, 4);
+
+    jit.SetPC(0);
+    jit.SetRegister(0, 0);
+    env.ticks_left = 10;
+    jit.Run();
+    REQUIRE(jit.GetRegister(0) == 5);
+    REQUIRE(jit.GetPC() == 16);
+}
+
+TEST_CASE("A64: Loop back-edges", "[a64]") {
+    A64TestEnv env;
+    Dynarmic::A64::Jit jit{Dynarmic::A64::UserConfig{&env}};
+
+    env.code_mem.emplace_back(0x91000400); // ADD X0, X0, #1
+    env.code_mem.emplace_back(0x17FFFFFF); // B .-4
+
+    // The cycle budget is checked on every iteration.
+    jit.SetPC(0);
+    env.ticks_left = 20;
+    jit.Run();
+    REQUIRE(jit.GetRegister(0) == 10);
+    REQUIRE(jit.GetPC() == 0);
+
+    env.ticks_left = 20;
+    jit.Run();
+    REQUIRE(jit.GetRegister(0) == 20);
+    REQUIRE(jit.GetPC() == 0);
+
+    // Modifying the loop body invalidates the loop.
+    env.code_mem[0] = 0x91000800; // ADD X0, X0, #2
+    jit.InvalidateCacheRange(0, 4);
+
+    env.ticks_left = 20;
+    jit.Run();
+    REQUIRE(jit.GetRegister(0) == 40);
+    REQUIRE(jit.GetPC() == 0);
+}
+
+TEST_CASE("A64: Loop regions keep registers in host registers", "[a64]") {
+    class ObservingTestEnv final : public A64TestEnv {
+    public:
+        Dynarmic::A64::Jit* jit = nullptr;
+        std::vector<u64> observed_x0;
+
+        std::uint8_t MemoryRead8(u64 vaddr) override {
+            observed_x0.emplace_back(jit->GetRegister(0));
+            return A64TestEnv::MemoryRead8(vaddr);
+        }
+    };
+
+    ObservingTestEnv env;
+    Dynarmic::A64::UserConfig conf{&env};
+    conf.loop_cached_registers = 4;
+    Dynarmic::A64::Jit jit{conf};
+    env.jit = &jit;
+
+    env.code_mem.emplace_back(0x38401423); // LDRB W3, [X1], #1
+    env.code_mem.emplace_back(0x8B030000); // ADD X0, X0, X3
+    env.code_mem.emplace_back(0xF1000442); // SUBS X2, X2, #1
+    env.code_mem.emplace_back(0x54FFFFA1); // B.NE .-12
+    env.code_mem.emplace_back(0x14000000); // B .
+
+    jit.SetRegister(0, 0);
+    jit.SetRegister(1, 0x1000);
+    jit.SetRegister(2, 100);
+    jit.SetPC(0);
+
+    // The cycle budget runs out part way through the loop. Registers are written back when it exits.
+    env.ticks_left = 40 * 4;
+    jit.Run();
+    REQUIRE(jit.GetRegister(0) == 780);
+    REQUIRE(jit.GetRegister(1) == 0x1000 + 40);
+    REQUIRE(jit.GetRegister(2) == 60);
+    REQUIRE(jit.GetPC() == 0);
+
+    env.ticks_left = 60 * 4 + 1;
+    jit.Run();
+    REQUIRE(jit.GetRegister(0) == 4950);
+    REQUIRE(jit.GetRegister(1) == 0x1000 + 100);
+    REQUIRE(jit.GetRegister(2) == 0);
+    REQUIRE(jit.GetPC() == 16);
+
+    // X0 is only written back to the guest state when the loop exits, not on every iteration.
+    REQUIRE(env.observed_x0.size() == 100);
+    REQUIRE(std::all_of(env.observed_x0.begin(), env.observed_x0.begin() + 40, [](u64 x) { return x == 0; }));
+    REQUIRE(std::all_of(env.observed_x0.begin() + 40, env.observed_x0.end(), [](u64 x) { return x == 780; }));
+}
+
+TEST_CASE("A64: Inline caches", "[a64]") {
+    A64TestEnv env;
+    Dynarmic::A64::UserConfig conf{&env};
+    conf.inline_cache_entries = 2;
+    Dynarmic::A64::Jit jit{conf};
+
+    env.code_mem.emplace_back(0xD61F0020); // BR X1
+    env.code_mem.emplace_back(0x91000400); // ADD X0, X0, #1
+    env.code_mem.emplace_back(0x14000000); // B .
+    env.code_mem.emplace_back(0x91000800); // ADD X0, X0, #2
+    env.code_mem.emplace_back(0x14000000); // B .
+    env.code_mem.emplace_back(0x91001000); // ADD X0, X0, #4
+    env.code_mem.emplace_back(0x14000000); // B .
+
+    // Cycle through more targets than there are inline cache entries.
+    const u64 targets[] = {4, 12, 20, 4, 4, 12, 12, 20, 4, 20};
+    const u64 increments[] = {1, 2, 4, 1, 1, 2, 2, 4, 1, 4};
+    u64 expected = 0;
+    for (size_t i = 0; i < std::size(targets); i++) {
+        expected += increments[i];
+
+        jit.SetPC(0);
+        jit.SetRegister(1, targets[i]);
+        env.ticks_left = 4;
+        jit.Run();
+        REQUIRE(jit.GetRegister(0) == expected);
+        REQUIRE(jit.GetPC() == targets[i] + 4);
+    }
+
+    // Cached targets are invalidated.
+    env.code_mem[1] = 0x91002000; // ADD X0, X0, #8
+    jit.InvalidateCacheRange(4, 4);
+
+    jit.SetPC(0);
+    jit.SetRegister(1, 4);
+    env.ticks_left = 4;
+    jit.Run();
+    REQUIRE(jit.GetRegister(0) == expected + 8);
+    REQUIRE(jit.GetPC() == 8);
+}
+
+namespace {
+
+Dynarmic::A64::Jit::FastDispatchStatistics RunIndirectBranches(size_t table_size, size_t table_ways) {
+    A64TestEnv env;
+    Dynarmic::A64::UserConfig conf{&env};
+    conf.fast_dispatch_table_size = table_size;
+    conf.fast_dispatch_table_ways = table_ways;
+    conf.fast_dispatch_statistics = true;
+    Dynarmic::A64::Jit jit{conf};
+
+    env.code_mem.emplace_back(0xD61F0020); // BR X1
+    env.code_mem.emplace_back(0x91000400); // ADD X0, X0, #1
+    env.code_mem.emplace_back(0x14000000); // B .
+    env.code_mem.emplace_back(0x91000800); // ADD X0, X0, #2
+    env.code_mem.emplace_back(0x14000000); // B .
+    env.code_mem.emplace_back(0x91001000); // ADD X0, X0, #4
+    env.code_mem.emplace_back(0x14000000); // B .
+
+    u64 expected = 0;
+    for (size_t round = 0; round < 4; round++) {
+        for (u64 target : {4, 12, 20}) {
+            expected += 1 << ((target - 4) / 8);
+
+            jit.SetPC(0);
+            jit.SetRegister(1, target);
+            env.ticks_left = 4;
+            jit.Run();
+            REQUIRE(jit.GetRegister(0) == expected);
+            REQUIRE(jit.GetPC() == target + 4);
+        }
+    }
+
+    return jit.GetFastDispatchStatistics();
+}
+
+} // anonymous namespace
+
+TEST_CASE("A64: Fast dispatch table associativity", "[a64]") {
+    // Every target conflicts in a table with a single entry.
+    const auto direct_mapped = RunIndirectBranches(1, 1);
+    REQUIRE(direct_mapped.hits == 0);
+    REQUIRE(direct_mapped.misses == 12);
+
+    // All targets fit in a single four-way set.
+    const auto four_way = RunIndirectBranches(4, 4);
+    REQUIRE(four_way.hits == 9);
+    REQUIRE(four_way.misses == 3);
+
+    // Two ways are not enough to hold three targets that are used round-robin.
+    const auto two_way = RunIndirectBranches(2, 2);
+    REQUIRE(two_way.hits == 0);
+    REQUIRE(two_way.misses == 12);
+}
+
+TEST_CASE("A64: Tick counter and deadline", "[a64]") {
+    A64TestEnv env;
+    u64 tick_counter = 100;
+    u64 tick_deadline = 110;
+
+    Dynarmic::A64::UserConfig conf{&env};
+    conf.tick_counter = &tick_counter;
+    conf.tick_deadline = &tick_deadline;
+    Dynarmic::A64::Jit jit{conf};
+
+    env.code_mem.emplace_back(0x91000400); // ADD X0, X0, #1
+    env.code_mem.emplace_back(0x17FFFFFF); // B .-4
+
+    // The callbacks are not used, so ticks_left stays at zero.
+    jit.SetPC(0);
+    jit.SetRegister(0, 0);
+    jit.Run();
+
+    REQUIRE(tick_counter == 110);
+    REQUIRE(jit.GetRegister(0) == 5);
+    REQUIRE(env.ticks_left == 0);
+
+    // A deadline that has already passed allows a single block to execute.
+    tick_deadline = 50;
+    jit.Run();
+
+    REQUIRE(tick_counter == 112);
+    REQUIRE(jit.GetRegister(0) == 6);
+
+    tick_deadline = 122;
+    jit.Run();
+
+    REQUIRE(tick_counter == 122);
+    REQUIRE(jit.GetRegister(0) == 11);
+}
+
+namespace {
+class HaltOnWriteTestEnv final : public A64TestEnv {
+public:
+    Dynarmic::A64::Jit* jit = nullptr;
+    u64 halt_value = 0;
+
+    void MemoryWrite64(u64 vaddr, std::uint64_t value) override {
+        A64TestEnv::MemoryWrite64(vaddr, value);
+        if (value == halt_value) {
+            jit->HaltExecution();
+        }
+    }
+};
+} // anonymous namespace
+
+TEST_CASE("A64: Execution without ticks", "[a64]") {
+    HaltOnWriteTestEnv env;
+    Dynarmic::A64::UserConfig conf{&env};
+    conf.enable_ticks = false;
+    Dynarmic::A64::Jit jit{conf};
+    env.jit = &jit;
+
+    env.code_mem.emplace_back(0x91000400); // ADD X0, X0, #1
+    env.code_mem.emplace_back(0xF9000020); // STR X0, [X1]
+    env.code_mem.emplace_back(0x17FFFFFE); // B .-8
+
+    // No ticks are available, so only the halt request stops execution.
+    env.halt_value = 1000;
+    jit.SetPC(0);
+    jit.SetRegister(0, 0);
+    jit.SetRegister(1, 0x1000);
+    jit.Run();
+
+    REQUIRE(jit.GetRegister(0) == 1000);
+    REQUIRE(env.ticks_left == 0);
+
+    // Run clears the previous halt request.
+    env.halt_value = 2000;
+    jit.Run();
+
+    REQUIRE(jit.GetRegister(0) == 2000);
+
+    // Single-stepping still executes exactly one instruction.
+    jit.SetPC(0);
+    jit.Step();
+
+    REQUIRE(jit.GetRegister(0) == 2001);
+    REQUIRE(jit.GetPC() == 4);
+}
+
+namespace {
+class ReadOnlyCodeTestEnv final : public A64TestEnv {
+public:
+    u64 read_only_end = 0;
+
+    bool IsReadOnlyMemory(u64 vaddr) override {
+        return vaddr < read_only_end;
+    }
+};
+} // anonymous namespace
+
+TEST_CASE("A64: Constant memory reads", "[a64]") {
+    ReadOnlyCodeTestEnv env;
+    env.read_only_end = 48;
+    Dynarmic::A64::Jit jit{Dynarmic::A64::UserConfig{&env}};
+
+    env.code_mem.emplace_back(0x90000002); // ADRP X2, #0
+    env.code_mem.emplace_back(0xF9401043); // LDR X3, [X2, #32]
+    env.code_mem.emplace_back(0x3DC00845); // LDR Q5, [X2, #32]
+    env.code_mem.emplace_back(0x3DC00C44); // LDR Q4, [X2, #48]
+    env.code_mem.emplace_back(0x14000000); // B .
+    env.code_mem.emplace_back(0x00000000);
+    env.code_mem.emplace_back(0x00000000);
+    env.code_mem.emplace_back(0x00000000);
+    env.code_mem.emplace_back(0x11111111); // Read-only data
+    env.code_mem.emplace_back(0x22222222);
+    env.code_mem.emplace_back(0x77777777);
+    env.code_mem.emplace_back(0x88888888);
+    env.code_mem.emplace_back(0x33333333); // Writable data
+    env.code_mem.emplace_back(0x44444444);
+    env.code_mem.emplace_back(0x55555555);
+    env.code_mem.emplace_back(0x66666666);
+
+    jit.SetPC(0);
+    env.ticks_left = 5;
+    jit.Run();
+
+    REQUIRE(jit.GetRegister(3) == 0x22222222'11111111);
+    REQUIRE(jit.GetVector(5) == Vector{0x22222222'11111111, 0x88888888'77777777});
+    REQUIRE(jit.GetVector(4) == Vector{0x44444444'33333333, 0x66666666'55555555});
+
+    // Read-only values were folded into the block, while writable ones are read every time.
+    env.code_mem[8] = 0;
+    env.code_mem[11] = 0;
+    env.code_mem[12] = 0;
+
+    jit.SetPC(0);
+    env.ticks_left = 5;
+    jit.Run();
+
+    REQUIRE(jit.GetRegister(3) == 0x22222222'11111111);
+    REQUIRE(jit.GetVector(5) == Vector{0x22222222'11111111, 0x88888888'77777777});
+    REQUIRE(jit.GetVector(4) == Vector{0x44444444'00000000, 0x66666666'55555555});
+}
+
+TEST_CASE("A64: Constant memory reads are not shared between Jits", "[a64]") {
+    Dynarmic::A64::TranslationCache translation_cache;
+
+    ReadOnlyCodeTestEnv env1;
+    ReadOnlyCodeTestEnv env2;
+    Dynarmic::A64::UserConfig conf1{&env1};
+    Dynarmic::A64::UserConfig conf2{&env2};
+    conf1.translation_cache = &translation_cache;
+    conf2.translation_cache = &translation_cache;
+    Dynarmic::A64::Jit jit1{conf1};
+    Dynarmic::A64::Jit jit2{conf2};
+
+    for (auto* env : {&env1, &env2}) {
+        env->read_only_end = 24;
+        env->code_mem.emplace_back(0x58000083); // LDR X3, #16
+        env->code_mem.emplace_back(0x14000000); // B .
+        env->code_mem.emplace_back(0x00000000);
+        env->code_mem.emplace_back(0x00000000);
+    }
+    env1.code_mem.emplace_back(0x11111111); // Read-only data
+    env1.code_mem.emplace_back(0x11111111);
+    env2.code_mem.emplace_back(0x22222222);
+    env2.code_mem.emplace_back(0x22222222);
+
+    jit1.SetPC(0);
+    env1.ticks_left = 2;
+    jit1.Run();
+    REQUIRE(jit1.GetRegister(3) == 0x11111111'11111111);
+
+    // jit2 shares jit1's translation, but not the data jit1 read while compiling it.
+    jit2.SetPC(0);
+    env2.ticks_left = 2;
+    jit2.Run();
+    REQUIRE(jit2.GetRegister(3) == 0x22222222'22222222);
+}
@@ -0,0 +1,100 @@
+/* This file is part of the dynarmic project.
+ * Copyright (c) 2020 MerryMage
+ * This software may be used and distributed according to the terms of the GNU
+ * General Public License version 2 or any later version.
+ */
+
+#include <chrono>
+#include <thread>
+
+#include <catch.hpp>
+
+#include <dynarmic/A64/a64.h>
+
+#include "testenv.h"
+
+namespace {
+
+constexpr u32 ADD_X0_X0_1 = 0x91000400;     // ADD X0, X0, #1
+constexpr u32 CMP_X0_1000 = 0xF10FA01F;     // CMP X0, #1000
+constexpr u32 B_NE_MINUS_8 = 0x54FFFFC1;    // B.NE .-8
+constexpr u32 B_SELF = 0x14000000;          // B .
+
+// Interprets just enough of A64 to run the test program.
+class InterpretingTestEnv final : public A64TestEnv {
+public:
+    Dynarmic::A64::Jit* jit = nullptr;
+    size_t interpreted_instructions = 0;
+
+    void InterpreterFallback(u64 pc, size_t num_instructions) override {
+        for (size_t i = 0; i < num_instructions; i++) {
+            switch (MemoryReadCode(pc)) {
+            case ADD_X0_X0_1:
+                jit->SetRegister(0, jit->GetRegister(0) + 1);
+                pc += 4;
+                break;
+            case CMP_X0_1000:
+                jit->SetPstate(jit->GetRegister(0) == 1000 ? 0x60000000 : 0);
+                pc += 4;
+                break;
+            case B_NE_MINUS_8:
+                pc = (jit->GetPstate() & 0x40000000) ? pc + 4 : pc - 8;
+                break;
+            case B_SELF:
+                break;
+            default:
+                ASSERT_MSG(false, "Unexpected instruction at {:016x}", pc);
+            }
+        }
+        jit->SetPC(pc);
+        interpreted_instructions += num_instructions;
+    }
+};
+
+void RunToCompletion(InterpretingTestEnv& env, Dynarmic::A64::Jit& jit) {
+    jit.SetPC(0);
+    jit.SetRegister(0, 0);
+    while (jit.GetPC() != 12) {
+        env.ticks_left = 100;
+        jit.Run();
+    }
+}
+
+} // anonymous namespace
+
+TEST_CASE("A64: Background compilation", "[a64]") {
+    InterpretingTestEnv env;
+    Dynarmic::A64::UserConfig conf{&env};
+    conf.background_compilation_threads = 2;
+    Dynarmic::A64::Jit jit{conf};
+    env.jit = &jit;
+
+    env.code_mem.emplace_back(ADD_X0_X0_1);
+    env.code_mem.emplace_back(CMP_X0_1000);
+    env.code_mem.emplace_back(B_NE_MINUS_8);
+    env.code_mem.emplace_back(B_SELF);
+
+    // Nothing has been compiled yet, so execution must begin in the interpreter.
+    RunToCompletion(env, jit);
+    REQUIRE(jit.GetRegister(0) == 1000);
+    REQUIRE(env.interpreted_instructions > 0);
+
+    // Eventually all blocks are compiled and the interpreter is no longer used.
+    for (size_t attempt = 0; attempt < 1000 && env.interpreted_instructions != 0; attempt++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        env.interpreted_instructions = 0;
+        RunToCompletion(env, jit);
+        REQUIRE(jit.GetRegister(0) == 1000);
+    }
+    REQUIRE(env.interpreted_instructions == 0);
+
+    // Modified code is recompiled.
+    env.code_mem[0] = B_SELF;
+    jit.InvalidateCacheRange(0, 4);
+    env.interpreted_instructions = 0;
+    jit.SetPC(0);
+    env.ticks_left = 10;
+    jit.Run();
+    REQUIRE(jit.GetPC() == 0);
+    REQUIRE(env.interpreted_instructions > 0);
+}
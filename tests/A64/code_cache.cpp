@@ -0,0 +1,256 @@
+/* This file is part of the dynarmic project.
+ * Copyright (c) 2020 MerryMage
+ * This software may be used and distributed according to the terms of the GNU
+ * General Public License version 2 or any later version.
+ */
+
+#include <catch.hpp>
+
+#include <dynarmic/A64/a64.h>
+
+#include "testenv.h"
+
+namespace {
+
+// Each block consists of an increment followed by a branch to the next block.
+// The final block branches back to the first, so the second pass over the code
+// exercises links into blocks that may have since been evicted.
+Dynarmic::A64::Jit::CodeCacheStatistics RunManyBlocks(Dynarmic::A64::UserConfig conf, size_t num_blocks) {
+    A64TestEnv env;
+    conf.callbacks = &env;
+    Dynarmic::A64::Jit jit{conf};
+
+    for (size_t i = 0; i < num_blocks; i++) {
+        env.code_mem.emplace_back(0x91000400); // ADD X0, X0, #1
+        env.code_mem.emplace_back(0x14000001); // B .+4
+    }
+    env.code_mem.emplace_back(0x14000000 | ((0 - num_blocks * 2) & 0x3FFFFFF)); // B <start>
+
+    jit.SetPC(0);
+    jit.SetRegister(0, 0);
+
+    env.ticks_left = 2 * (num_blocks * 2 + 1);
+    jit.Run();
+
+    REQUIRE(jit.GetRegister(0) == num_blocks * 2);
+    REQUIRE(jit.GetPC() == 0);
+
+    return jit.GetCodeCacheStatistics();
+}
+
+} // anonymous namespace
+
+TEST_CASE("A64: Code cache evicts regions when full", "[a64]") {
+    Dynarmic::A64::UserConfig conf{nullptr};
+    conf.code_cache_size = 12 * 1024 * 1024;
+    conf.far_code_offset = 6 * 1024 * 1024;
+    conf.constant_pool_size = 512 * 1024;
+    conf.code_cache_regions = 2;
+
+    // Each region holds far fewer than 70000 blocks, so regions holding live blocks are reused.
+    const auto statistics = RunManyBlocks(conf, 70000);
+    REQUIRE(statistics.region_evictions > 0);
+    REQUIRE(statistics.grows == 0);
+    REQUIRE(statistics.flushes == 0);
+}
+
+TEST_CASE("A64: Code cache grows on demand", "[a64]") {
+    Dynarmic::A64::UserConfig conf{nullptr};
+    conf.code_cache_size = 12 * 1024 * 1024;
+    conf.far_code_offset = 6 * 1024 * 1024;
+    conf.constant_pool_size = 512 * 1024;
+    conf.code_cache_regions = 2;
+    conf.code_cache_max_size = 24 * 1024 * 1024;
+
+    // Both initial regions fill up before the cache is grown.
+    const auto statistics = RunManyBlocks(conf, 70000);
+    REQUIRE(statistics.grows > 0);
+    REQUIRE(statistics.flushes == 0);
+}
+
+TEST_CASE("A64: Code cache does not evict regions with recently run code", "[a64]") {
+    class CountingTestEnv final : public A64TestEnv {
+    public:
+        size_t subroutine_reads = 0;
+
+        std::uint32_t MemoryReadCode(u64 vaddr) override {
+            if (vaddr == 0) {
+                subroutine_reads++;
+            }
+            return A64TestEnv::MemoryReadCode(vaddr);
+        }
+    };
+
+    CountingTestEnv env;
+    Dynarmic::A64::UserConfig conf{&env};
+    conf.code_cache_size = 20 * 1024 * 1024;
+    conf.far_code_offset = 10 * 1024 * 1024;
+    conf.constant_pool_size = 512 * 1024;
+    conf.code_cache_regions = 4;
+    Dynarmic::A64::Jit jit{conf};
+
+    // A subroutine that is called between every other block, so the region it is in is always in use.
+    env.code_mem.emplace_back(0x91000421); // ADD X1, X1, #1
+    env.code_mem.emplace_back(0xd65f03c0); // RET
+
+    constexpr size_t num_calls = 60000;
+    for (size_t i = 0; i < num_calls; i++) {
+        const u32 offset = static_cast<u32>(-static_cast<s64>(env.code_mem.size() + 1)) & 0x3FFFFFF;
+        env.code_mem.emplace_back(0x91000400); // ADD X0, X0, #1
+        env.code_mem.emplace_back(0x94000000 | offset); // BL <subroutine>
+    }
+    env.code_mem.emplace_back(0x14000000); // B .
+
+    jit.SetPC(8);
+    jit.SetRegister(0, 0);
+    jit.SetRegister(1, 0);
+    env.ticks_left = num_calls * 4;
+    jit.Run();
+
+    REQUIRE(jit.GetRegister(0) == num_calls);
+    REQUIRE(jit.GetRegister(1) == num_calls);
+    REQUIRE(jit.GetPC() == 8 + num_calls * 8);
+    REQUIRE(jit.GetCodeCacheStatistics().region_evictions > 0);
+    REQUIRE(env.subroutine_reads == 1);
+}
+
+TEST_CASE("A64: Code cache uses fewer regions when small", "[a64]") {
+    Dynarmic::A64::UserConfig conf{nullptr};
+    conf.code_cache_size = 8 * 1024 * 1024;
+    conf.far_code_offset = 4 * 1024 * 1024;
+    conf.constant_pool_size = 512 * 1024;
+    conf.code_cache_regions = 8;
+
+    // There is only room for one region, so the whole cache is flushed when it fills up.
+    const auto statistics = RunManyBlocks(conf, 70000);
+    REQUIRE(statistics.flushes > 0);
+    REQUIRE(statistics.region_evictions == 0);
+}
+
+TEST_CASE("A64: Code cache can be flushed while recompiling hot blocks", "[a64]") {
+    Dynarmic::A64::UserConfig conf{nullptr};
+    conf.code_cache_size = 8 * 1024 * 1024;
+    conf.far_code_offset = 4 * 1024 * 1024;
+    conf.constant_pool_size = 512 * 1024;
+    conf.code_cache_regions = 1;
+    conf.tiered_compilation_threshold = 2;
+
+    // Every block is recompiled on the second pass, and some of those recompilations flush the
+    // code cache, including the code of the block being recompiled.
+    const auto statistics = RunManyBlocks(conf, 70000);
+    REQUIRE(statistics.flushes > 1);
+}
+
+TEST_CASE("A64: Code cache reuses space freed by invalidation", "[a64]") {
+    A64TestEnv env;
+    Dynarmic::A64::UserConfig conf{&env};
+    conf.code_cache_size = 32 * 1024 * 1024;
+    conf.far_code_offset = 16 * 1024 * 1024;
+    conf.constant_pool_size = 512 * 1024;
+    conf.code_cache_regions = 4;
+    Dynarmic::A64::Jit jit{conf};
+
+    constexpr size_t num_blocks = 5000;
+    for (size_t i = 0; i < num_blocks; i++) {
+        env.code_mem.emplace_back(0x91000400); // ADD X0, X0, #1
+        env.code_mem.emplace_back(0x14000001); // B .+4
+    }
+    env.code_mem.emplace_back(0x14000000); // B .
+
+    // Every pass recompiles all blocks, so the cache fills up several times over. Regions whose
+    // blocks have all been invalidated are reused in preference to the region holding the
+    // final block, which is never invalidated.
+    for (size_t pass = 0; pass < 36; pass++) {
+        jit.SetPC(0);
+        jit.SetRegister(0, 0);
+        env.ticks_left = num_blocks * 2 + 1;
+        jit.Run();
+
+        REQUIRE(jit.GetRegister(0) == num_blocks);
+        REQUIRE(jit.GetPC() == num_blocks * 8);
+
+        jit.InvalidateCacheRange(0, num_blocks * 8);
+    }
+}
+
+TEST_CASE("A64: Code cache can be backed by huge pages", "[a64]") {
+    Dynarmic::A64::UserConfig conf{nullptr};
+    conf.code_cache_size = 16 * 1024 * 1024;
+    conf.far_code_offset = 8 * 1024 * 1024;
+    conf.constant_pool_size = 512 * 1024;
+    conf.code_cache_regions = 2;
+    conf.code_cache_max_size = 32 * 1024 * 1024;
+    conf.code_cache_huge_pages = true;
+
+    // Huge pages may be unavailable on the host, in which case ordinary pages are used.
+    RunManyBlocks(conf, 70000);
+}
+
+TEST_CASE("A64: Code cache uses ordinary pages by default", "[a64]") {
+    A64TestEnv env;
+    Dynarmic::A64::UserConfig conf{&env};
+    Dynarmic::A64::Jit jit{conf};
+
+    REQUIRE(jit.GetCodeCachePageBacking() == Dynarmic::A64::Jit::CodeCachePageBacking::Normal);
+}
+
+TEST_CASE("A64: Code layout optimization moves hot blocks", "[a64]") {
+    A64TestEnv env;
+    Dynarmic::A64::UserConfig conf{&env};
+    conf.code_cache_size = 32 * 1024 * 1024;
+    conf.far_code_offset = 16 * 1024 * 1024;
+    conf.constant_pool_size = 512 * 1024;
+    conf.code_cache_regions = 2;
+    conf.hot_code_size = 8 * 1024 * 1024;
+    Dynarmic::A64::Jit jit{conf};
+
+    constexpr size_t num_blocks = 100;
+    for (size_t i = 0; i < num_blocks; i++) {
+        env.code_mem.emplace_back(0x91000400); // ADD X0, X0, #1
+        env.code_mem.emplace_back(0x14000001); // B .+4
+    }
+    env.code_mem.emplace_back(0x14000000); // B .
+
+    // Later passes run code from the hot region, which is replaced every pass, and links into it.
+    for (size_t pass = 0; pass < 4; pass++) {
+        jit.SetPC(0);
+        jit.SetRegister(0, 0);
+        env.ticks_left = num_blocks * 2 + 1;
+        jit.Run();
+
+        REQUIRE(jit.GetRegister(0) == num_blocks);
+        REQUIRE(jit.GetPC() == num_blocks * 8);
+
+        jit.OptimizeCodeLayout();
+    }
+}
+
+TEST_CASE("A64: Code layout optimization can be periodic", "[a64]") {
+    A64TestEnv env;
+    Dynarmic::A64::UserConfig conf{&env};
+    conf.code_cache_size = 32 * 1024 * 1024;
+    conf.far_code_offset = 16 * 1024 * 1024;
+    conf.constant_pool_size = 512 * 1024;
+    conf.code_cache_regions = 2;
+    conf.hot_code_size = 8 * 1024 * 1024;
+    conf.code_layout_interval = 1000;
+    Dynarmic::A64::Jit jit{conf};
+
+    constexpr size_t num_blocks = 5000;
+    for (size_t i = 0; i < num_blocks; i++) {
+        env.code_mem.emplace_back(0x91000400); // ADD X0, X0, #1
+        env.code_mem.emplace_back(0x14000001); // B .+4
+    }
+    env.code_mem.emplace_back(0x14000000); // B .
+
+    // The code layout is optimized when the first pass returns, as far more than 1000 blocks are compiled.
+    for (size_t pass = 0; pass < 3; pass++) {
+        jit.SetPC(0);
+        jit.SetRegister(0, 0);
+        env.ticks_left = num_blocks * 2 + 1;
+        jit.Run();
+
+        REQUIRE(jit.GetRegister(0) == num_blocks);
+        REQUIRE(jit.GetPC() == num_blocks * 8);
+    }
+}
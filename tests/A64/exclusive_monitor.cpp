@@ -0,0 +1,192 @@
+/* This file is part of the dynarmic project.
+ * Copyright (c) 2020 MerryMage
+ * This software may be used and distributed according to the terms of the GNU
+ * General Public License version 2 or any later version.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include <catch.hpp>
+#include <fmt/format.h>
+
+#include <dynarmic/A64/exclusive_monitor.h>
+
+#include "common/common_types.h"
+
+using Dynarmic::A64::ExclusiveMonitor;
+using Dynarmic::A64::VAddr;
+
+TEST_CASE("A64: ExclusiveMonitor clears other reservations", "[a64]") {
+    ExclusiveMonitor monitor{3};
+    bool written = false;
+
+    monitor.Mark(0, 0x1000, 8);
+    monitor.Mark(1, 0x1008, 8);
+    monitor.Mark(2, 0x2000, 8);
+
+    REQUIRE(monitor.DoExclusiveOperation(0, 0x1000, 8, [&]{ written = true; }));
+    REQUIRE(written);
+
+    // Processor 1 held a reservation on the same granule and so loses it.
+    REQUIRE(!monitor.DoExclusiveOperation(1, 0x1008, 8, []{}));
+    // Processor 0's reservation was consumed by its own exclusive store.
+    REQUIRE(!monitor.DoExclusiveOperation(0, 0x1000, 8, []{}));
+    // Reservations on unrelated granules are untouched.
+    REQUIRE(monitor.DoExclusiveOperation(2, 0x2000, 8, []{}));
+
+    monitor.Mark(1, 0x3000, 4);
+    monitor.Clear();
+    REQUIRE(!monitor.DoExclusiveOperation(1, 0x3000, 4, []{}));
+}
+
+namespace {
+
+/// The previous implementation: a single global lock and unpadded reservations.
+class SingleLockExclusiveMonitor {
+public:
+    explicit SingleLockExclusiveMonitor(size_t processor_count) : exclusive_addresses(processor_count, INVALID_EXCLUSIVE_ADDRESS) {}
+
+    size_t GetProcessorCount() const {
+        return exclusive_addresses.size();
+    }
+
+    void Mark(size_t processor_id, VAddr address, size_t) {
+        Lock();
+        exclusive_addresses[processor_id] = address & RESERVATION_GRANULE_MASK;
+        Unlock();
+    }
+
+    template <typename Function>
+    bool DoExclusiveOperation(size_t processor_id, VAddr address, size_t, Function op) {
+        const VAddr masked_address = address & RESERVATION_GRANULE_MASK;
+
+        Lock();
+        if (exclusive_addresses[processor_id] != masked_address) {
+            Unlock();
+            return false;
+        }
+        for (VAddr& other_address : exclusive_addresses) {
+            if (other_address == masked_address) {
+                other_address = INVALID_EXCLUSIVE_ADDRESS;
+            }
+        }
+        op();
+        Unlock();
+        return true;
+    }
+
+private:
+    void Lock() {
+        while (is_locked.test_and_set(std::memory_order_acquire)) {}
+    }
+
+    void Unlock() {
+        is_locked.clear(std::memory_order_release);
+    }
+
+    static constexpr VAddr RESERVATION_GRANULE_MASK = 0xFFFF'FFFF'FFFF'FFF0ull;
+    static constexpr VAddr INVALID_EXCLUSIVE_ADDRESS = 0xDEAD'DEAD'DEAD'DEADull;
+    std::atomic_flag is_locked = ATOMIC_FLAG_INIT;
+    std::vector<VAddr> exclusive_addresses;
+};
+
+/// Each thread performs an emulated LDXR/ADD/STXR loop on its counters. Memory is modelled
+/// with relaxed atomics, so a lost update indicates a failure of the exclusive monitor.
+/// Returns the sum of all counters afterwards.
+template <typename Monitor>
+u64 RunContention(Monitor& monitor, size_t counter_count, size_t stride, size_t window, size_t iterations) {
+    const size_t thread_count = monitor.GetProcessorCount();
+    std::vector<std::atomic<u64>> counters(counter_count);
+    for (auto& counter : counters) {
+        counter.store(0);
+    }
+
+    std::atomic<bool> start{false};
+    std::vector<std::thread> threads;
+
+    for (size_t processor_id = 0; processor_id < thread_count; processor_id++) {
+        threads.emplace_back([&, processor_id] {
+            while (!start.load()) {}
+
+            for (size_t i = 0; i < iterations; i++) {
+                const size_t index = (processor_id * stride + i % window) % counters.size();
+                const VAddr vaddr = 0x10000 + index * 16;
+                while (true) {
+                    monitor.Mark(processor_id, vaddr, 8);
+                    const u64 value = counters[index].load(std::memory_order_relaxed);
+                    const bool success = monitor.DoExclusiveOperation(processor_id, vaddr, 8, [&]{
+                        counters[index].store(value + 1, std::memory_order_relaxed);
+                    });
+                    if (success) {
+                        break;
+                    }
+                }
+            }
+        });
+    }
+
+    start.store(true);
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    u64 total = 0;
+    for (const auto& counter : counters) {
+        total += counter.load();
+    }
+    return total;
+}
+
+struct ContentionWorkload {
+    const char* name;
+    size_t counter_count;
+    size_t stride;
+    size_t window;
+};
+
+constexpr ContentionWorkload contention_workloads[] = {
+    {"shared address", 1, 0, 1},
+    {"distinct addresses", 8 * 64, 64, 64},
+    {"overlapping addresses", 16, 1, 16},
+};
+
+template <typename Monitor>
+double TimeContention(const ContentionWorkload& workload, size_t thread_count, size_t iterations) {
+    Monitor monitor{thread_count};
+
+    const auto start_time = std::chrono::steady_clock::now();
+    const u64 total = RunContention(monitor, workload.counter_count, workload.stride, workload.window, iterations);
+    const auto end_time = std::chrono::steady_clock::now();
+
+    REQUIRE(total == thread_count * iterations);
+    return std::chrono::duration<double, std::milli>(end_time - start_time).count();
+}
+
+} // anonymous namespace
+
+TEST_CASE("A64: ExclusiveMonitor has no lost updates", "[a64]") {
+    constexpr size_t thread_count = 4;
+    constexpr size_t iterations = 2000;
+
+    for (const auto& workload : contention_workloads) {
+        ExclusiveMonitor monitor{thread_count};
+        REQUIRE(RunContention(monitor, workload.counter_count, workload.stride, workload.window, iterations) == thread_count * iterations);
+    }
+}
+
+TEST_CASE("A64: ExclusiveMonitor benchmark against single lock", "[.][benchmark]") {
+    const size_t thread_count = std::max<size_t>(2, std::thread::hardware_concurrency());
+    constexpr size_t iterations = 200000;
+
+    for (const auto& workload : contention_workloads) {
+        const double sharded_ms = TimeContention<ExclusiveMonitor>(workload, thread_count, iterations);
+        const double single_lock_ms = TimeContention<SingleLockExclusiveMonitor>(workload, thread_count, iterations);
+
+        fmt::print("ExclusiveMonitor ({}, {} threads): sharded {:.1f} ms, single lock {:.1f} ms\n",
+                   workload.name, thread_count, sharded_ms, single_lock_ms);
+    }
+}
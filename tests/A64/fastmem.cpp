@@ -0,0 +1,84 @@
+/* This file is part of the dynarmic project.
+ * Copyright (c) 2020 MerryMage
+ * This software may be used and distributed according to the terms of the GNU
+ * General Public License version 2 or any later version.
+ */
+
+#include <array>
+#include <cstring>
+
+#include <catch.hpp>
+
+#include <dynarmic/A64/a64.h>
+
+#include "testenv.h"
+
+TEST_CASE("A64: Fastmem loads and stores", "[a64]") {
+    alignas(16) std::array<u8, 4096 + 16> arena{};
+
+    A64TestEnv env;
+    Dynarmic::A64::UserConfig conf{&env};
+    conf.fastmem_pointer = arena.data();
+    conf.fastmem_address_space_bits = 12;
+    conf.silently_mirror_fastmem = false;
+    Dynarmic::A64::Jit jit{conf};
+
+    const u64 value = 0x1122334455667788;
+    std::memcpy(&arena[0x100], &value, sizeof(value));
+
+    env.code_mem.emplace_back(0xf9400020); // LDR X0, [X1]
+    env.code_mem.emplace_back(0xf9000040); // STR X0, [X2]
+    env.code_mem.emplace_back(0xf9400083); // LDR X3, [X4]
+    env.code_mem.emplace_back(0x3dc00025); // LDR Q5, [X1]
+    env.code_mem.emplace_back(0x14000000); // B .
+
+    jit.SetPC(0);
+    jit.SetRegister(1, 0x100);
+    jit.SetRegister(2, 0x200);
+    jit.SetRegister(4, 0x10000);
+
+    env.ticks_left = 5;
+    jit.Run();
+
+    u64 stored;
+    std::memcpy(&stored, &arena[0x200], sizeof(stored));
+
+    REQUIRE(jit.GetRegister(0) == value);
+    REQUIRE(stored == value);
+    // Out of range of the fastmem arena, so this must go through the callbacks.
+    REQUIRE(jit.GetRegister(3) == 0x0706050403020100);
+    REQUIRE(jit.GetVector(5) == Vector{value, 0});
+    REQUIRE(env.modified_memory.empty());
+}
+
+TEST_CASE("A64: Fastmem silently mirrors address space", "[a64]") {
+    alignas(16) std::array<u8, 4096 + 16> arena{};
+
+    A64TestEnv env;
+    Dynarmic::A64::UserConfig conf{&env};
+    conf.fastmem_pointer = arena.data();
+    conf.fastmem_address_space_bits = 12;
+    conf.silently_mirror_fastmem = true;
+    Dynarmic::A64::Jit jit{conf};
+
+    const u64 value = 0x1122334455667788;
+    std::memcpy(&arena[0x100], &value, sizeof(value));
+
+    env.code_mem.emplace_back(0xf9400020); // LDR X0, [X1]
+    env.code_mem.emplace_back(0xf9000040); // STR X0, [X2]
+    env.code_mem.emplace_back(0x14000000); // B .
+
+    jit.SetPC(0);
+    jit.SetRegister(1, 0x12345100);
+    jit.SetRegister(2, 0xFFFFFFFF00000200);
+
+    env.ticks_left = 3;
+    jit.Run();
+
+    u64 stored;
+    std::memcpy(&stored, &arena[0x200], sizeof(stored));
+
+    REQUIRE(jit.GetRegister(0) == value);
+    REQUIRE(stored == value);
+    REQUIRE(env.modified_memory.empty());
+}
@@ -0,0 +1,201 @@
+/* This file is part of the dynarmic project.
+ * Copyright (c) 2020 MerryMage
+ * This software may be used and distributed according to the terms of the GNU
+ * General Public License version 2 or any later version.
+ */
+
+#include <array>
+
+#include <catch.hpp>
+
+#include <dynarmic/A64/a64.h>
+#include <dynarmic/A64/translation_cache.h>
+
+#include "common/common_types.h"
+#include "testenv.h"
+
+TEST_CASE("A64: Multi-level page table", "[a64]") {
+    using Table = std::array<void*, 512>;
+
+    constexpr u64 vaddr = 0x0000'7FFF'1234'5000;
+
+    std::array<u64, 512> page{};
+    page[0] = 0x0123'4567'89AB'CDEF;
+
+    Table level0{}, level1{}, level2{}, level3{};
+    level0[(vaddr >> 39) & 511] = level1.data();
+    level1[(vaddr >> 30) & 511] = level2.data();
+    level2[(vaddr >> 21) & 511] = level3.data();
+    level3[(vaddr >> 12) & 511] = page.data();
+
+    A64TestEnv env;
+    Dynarmic::A64::UserConfig conf{&env};
+    conf.page_table = level0.data();
+    conf.page_table_address_space_bits = 48;
+    conf.page_table_level_bits = {9, 9, 9, 9};
+    conf.silently_mirror_page_table = false;
+    Dynarmic::A64::Jit jit{conf};
+
+    env.code_mem.emplace_back(0xF9400001); // LDR X1, [X0]
+    env.code_mem.emplace_back(0xF9000402); // STR X2, [X0, #8]
+    env.code_mem.emplace_back(0xF9400083); // LDR X3, [X4]
+    env.code_mem.emplace_back(0x14000000); // B .
+
+    jit.SetPC(0);
+    jit.SetRegister(0, vaddr);
+    jit.SetRegister(2, 0xFEDC'BA98'7654'3210);
+    // Shares all but the last level with the mapped page.
+    jit.SetRegister(4, vaddr + 0x1000);
+
+    env.ticks_left = 4;
+    jit.Run();
+
+    REQUIRE(jit.GetRegister(1) == 0x0123'4567'89AB'CDEF);
+    REQUIRE(page[1] == 0xFEDC'BA98'7654'3210);
+    REQUIRE(env.modified_memory.empty());
+    // Unmapped pages fall back to the memory callbacks.
+    REQUIRE(jit.GetRegister(3) == 0x0706'0504'0302'0100);
+}
+
+TEST_CASE("A64: Page table TLB", "[a64]") {
+    std::array<u64, 512> page_a{};
+    std::array<u64, 512> page_b{};
+    page_a[0] = 0xAAAA'AAAA'AAAA'AAAA;
+    page_b[0] = 0xBBBB'BBBB'BBBB'BBBB;
+
+    std::array<void*, 256> page_table{};
+    page_table[1] = page_a.data();
+
+    A64TestEnv env;
+    Dynarmic::A64::UserConfig conf{&env};
+    conf.page_table = page_table.data();
+    conf.page_table_address_space_bits = 20;
+    conf.enable_page_table_tlb = true;
+    Dynarmic::A64::Jit jit{conf};
+
+    env.code_mem.emplace_back(0xF9400001); // LDR X1, [X0]
+    env.code_mem.emplace_back(0xF9000402); // STR X2, [X0, #8]
+    env.code_mem.emplace_back(0x14000000); // B .
+
+    const auto run = [&](u64 value) {
+        jit.SetPC(0);
+        jit.SetRegister(0, 0x1000);
+        jit.SetRegister(2, value);
+        env.ticks_left = 3;
+        jit.Run();
+    };
+
+    run(1);
+    REQUIRE(jit.GetRegister(1) == 0xAAAA'AAAA'AAAA'AAAA);
+    REQUIRE(page_a[1] == 1);
+
+    // Cached translations survive changes to the page table until they are invalidated.
+    page_table[1] = page_b.data();
+    run(2);
+    REQUIRE(jit.GetRegister(1) == 0xAAAA'AAAA'AAAA'AAAA);
+    REQUIRE(page_a[1] == 2);
+
+    jit.InvalidateTLBRange(0x1FFF, 1);
+    run(3);
+    REQUIRE(jit.GetRegister(1) == 0xBBBB'BBBB'BBBB'BBBB);
+    REQUIRE(page_b[1] == 3);
+
+    // Removed pages fall back to the memory callbacks once invalidated.
+    page_table[1] = nullptr;
+    jit.ClearTLB();
+    run(4);
+    REQUIRE(jit.GetRegister(1) == 0x0706'0504'0302'0100);
+    REQUIRE(env.modified_memory.size() == 8);
+    REQUIRE(page_b[1] == 3);
+}
+
+TEST_CASE("A64: Coalesced page table accesses", "[a64]") {
+    std::array<u64, 512> page_a{};
+    std::array<u64, 512> page_b{};
+    for (size_t i = 0; i < page_a.size(); i++) {
+        page_a[i] = 0xAAAA'0000'0000'0000 | i;
+        page_b[i] = 0xBBBB'0000'0000'0000 | i;
+    }
+
+    std::array<void*, 256> page_table{};
+    page_table[1] = page_a.data();
+    page_table[2] = page_b.data();
+
+    A64TestEnv env;
+    Dynarmic::A64::UserConfig conf{&env};
+    conf.page_table = page_table.data();
+    conf.page_table_address_space_bits = 20;
+    Dynarmic::A64::Jit jit{conf};
+
+    env.code_mem.emplace_back(0xA9400801); // LDP X1, X2, [X0]
+    env.code_mem.emplace_back(0xA9011003); // STP X3, X4, [X0, #16]
+    env.code_mem.emplace_back(0xA94018E5); // LDP X5, X6, [X7]
+    env.code_mem.emplace_back(0xA9402548); // LDP X8, X9, [X10]
+    env.code_mem.emplace_back(0x4C40A000); // LD1 {V0.16B, V1.16B}, [X0]
+    env.code_mem.emplace_back(0x14000000); // B .
+
+    jit.SetPC(0);
+    jit.SetRegister(0, 0x1000);
+    jit.SetRegister(3, 0x3333'3333'3333'3333);
+    jit.SetRegister(4, 0x4444'4444'4444'4444);
+    jit.SetRegister(7, 0x1FF8);  // Straddles two mapped pages
+    jit.SetRegister(10, 0x3000); // Unmapped
+
+    env.ticks_left = 10;
+    jit.Run();
+
+    REQUIRE(jit.GetRegister(1) == 0xAAAA'0000'0000'0000);
+    REQUIRE(jit.GetRegister(2) == 0xAAAA'0000'0000'0001);
+    REQUIRE(page_a[2] == 0x3333'3333'3333'3333);
+    REQUIRE(page_a[3] == 0x4444'4444'4444'4444);
+    REQUIRE(jit.GetRegister(5) == 0xAAAA'0000'0000'01FF);
+    REQUIRE(jit.GetRegister(6) == 0xBBBB'0000'0000'0000);
+    REQUIRE(jit.GetRegister(8) == 0x0706'0504'0302'0100);
+    REQUIRE(jit.GetRegister(9) == 0x0F0E'0D0C'0B0A'0908);
+    REQUIRE(jit.GetVector(0) == Vector{0xAAAA'0000'0000'0000, 0xAAAA'0000'0000'0001});
+    REQUIRE(jit.GetVector(1) == Vector{0x3333'3333'3333'3333, 0x4444'4444'4444'4444});
+    REQUIRE(env.modified_memory.empty());
+}
+
+TEST_CASE("A64: Coalesced accesses are not shared with Jits without a page table", "[a64]") {
+    std::array<u64, 512> page{};
+    page[0] = 0x1111'1111'1111'1111;
+    page[1] = 0x2222'2222'2222'2222;
+
+    std::array<void*, 256> page_table{};
+    page_table[1] = page.data();
+
+    Dynarmic::A64::TranslationCache translation_cache;
+
+    A64TestEnv env1;
+    Dynarmic::A64::UserConfig conf1{&env1};
+    conf1.page_table = page_table.data();
+    conf1.page_table_address_space_bits = 20;
+    conf1.translation_cache = &translation_cache;
+    Dynarmic::A64::Jit jit1{conf1};
+
+    A64TestEnv env2;
+    Dynarmic::A64::UserConfig conf2{&env2};
+    conf2.translation_cache = &translation_cache;
+    Dynarmic::A64::Jit jit2{conf2};
+
+    for (auto* env : {&env1, &env2}) {
+        env->code_mem.emplace_back(0xA9400801); // LDP X1, X2, [X0]
+        env->code_mem.emplace_back(0x14000000); // B .
+    }
+
+    jit1.SetPC(0);
+    jit1.SetRegister(0, 0x1000);
+    env1.ticks_left = 2;
+    jit1.Run();
+    REQUIRE(jit1.GetRegister(1) == 0x1111'1111'1111'1111);
+    REQUIRE(jit1.GetRegister(2) == 0x2222'2222'2222'2222);
+
+    // jit2 reuses jit1's translation, but accesses memory through callbacks.
+    jit2.SetPC(0);
+    jit2.SetRegister(0, 0x1000);
+    env2.ticks_left = 2;
+    jit2.Run();
+    REQUIRE(jit2.GetRegister(1) == 0x0706'0504'0302'0100);
+    REQUIRE(jit2.GetRegister(2) == 0x0F0E'0D0C'0B0A'0908);
+}
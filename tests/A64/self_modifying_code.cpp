@@ -0,0 +1,163 @@
+/* This file is part of the dynarmic project.
+ * Copyright (c) 2020 MerryMage
+ * This software may be used and distributed according to the terms of the GNU
+ * General Public License version 2 or any later version.
+ */
+
+#include <array>
+#include <cstring>
+#include <vector>
+
+#include <catch.hpp>
+
+#include <dynarmic/A64/a64.h>
+
+#include "testenv.h"
+
+namespace {
+
+constexpr u32 MOV_X2_1 = 0xD2800022;    // MOV X2, #1
+constexpr u32 MOV_X2_2 = 0xD2800042;    // MOV X2, #2
+constexpr u32 STR_W1_X0 = 0xB9000001;   // STR W1, [X0]
+constexpr u32 B_SELF = 0x14000000;      // B .
+
+// Guest code is fetched from the same memory that the guest stores to.
+class ArenaTestEnv final : public A64TestEnv {
+public:
+    alignas(4096) std::array<u8, 4096 + 16> arena{};
+
+    void Write(u64 vaddr, u32 instruction) {
+        std::memcpy(&arena[vaddr], &instruction, sizeof(instruction));
+    }
+
+    std::uint32_t MemoryReadCode(u64 vaddr) override {
+        u32 instruction;
+        std::memcpy(&instruction, &arena[vaddr], sizeof(instruction));
+        return instruction;
+    }
+};
+
+void RunModifyingProgram(ArenaTestEnv& env, Dynarmic::A64::Jit& jit) {
+    env.Write(0x000, MOV_X2_1);
+    env.Write(0x004, B_SELF);
+    env.Write(0x100, STR_W1_X0);
+    env.Write(0x104, B_SELF);
+
+    jit.SetPC(0);
+    env.ticks_left = 2;
+    jit.Run();
+    REQUIRE(jit.GetRegister(2) == 1);
+
+    // Replace the first instruction of the block we've just executed.
+    jit.SetPC(0x100);
+    jit.SetRegister(0, 0);
+    jit.SetRegister(1, MOV_X2_2);
+    env.ticks_left = 2;
+    jit.Run();
+    REQUIRE(env.MemoryReadCode(0) == MOV_X2_2);
+
+    jit.SetPC(0);
+    env.ticks_left = 2;
+    jit.Run();
+    REQUIRE(jit.GetRegister(2) == 2);
+}
+
+} // anonymous namespace
+
+TEST_CASE("A64: Self-modifying code detection with page table", "[a64]") {
+    ArenaTestEnv env;
+    std::vector<void*> page_table(1 << 8, nullptr);
+    page_table[0] = env.arena.data();
+
+    Dynarmic::A64::UserConfig conf{&env};
+    conf.page_table = page_table.data();
+    conf.page_table_address_space_bits = 20;
+    conf.detect_self_modifying_code = true;
+    Dynarmic::A64::Jit jit{conf};
+
+    RunModifyingProgram(env, jit);
+}
+
+TEST_CASE("A64: Self-modifying code detection with fastmem", "[a64]") {
+    ArenaTestEnv env;
+
+    Dynarmic::A64::UserConfig conf{&env};
+    conf.fastmem_pointer = env.arena.data();
+    conf.fastmem_address_space_bits = 12;
+    conf.detect_self_modifying_code = true;
+    Dynarmic::A64::Jit jit{conf};
+
+    RunModifyingProgram(env, jit);
+}
+
+TEST_CASE("A64: Self-modifying code detection with 48-bit page table", "[a64]") {
+    using Table = std::array<void*, 512>;
+
+    ArenaTestEnv env;
+    Table level0{}, level1{}, level2{}, level3{};
+    level0[0] = level1.data();
+    level1[0] = level2.data();
+    level2[0] = level3.data();
+    level3[0] = env.arena.data();
+
+    Dynarmic::A64::UserConfig conf{&env};
+    conf.page_table = level0.data();
+    conf.page_table_address_space_bits = 48;
+    conf.page_table_level_bits = {9, 9, 9, 9};
+    conf.detect_self_modifying_code = true;
+    Dynarmic::A64::Jit jit{conf};
+
+    RunModifyingProgram(env, jit);
+}
+
+TEST_CASE("A64: Self-modifying code detection with 64-bit fastmem", "[a64]") {
+    ArenaTestEnv env;
+
+    Dynarmic::A64::UserConfig conf{&env};
+    conf.fastmem_pointer = env.arena.data();
+    conf.fastmem_address_space_bits = 64;
+    conf.detect_self_modifying_code = true;
+    Dynarmic::A64::Jit jit{conf};
+
+    RunModifyingProgram(env, jit);
+}
+
+TEST_CASE("A64: Self-modifying code detection in loop regions with coalesced stores", "[a64]") {
+    constexpr u32 ADD_X3_1 = 0x91000463;    // ADD X3, X3, #1
+    constexpr u32 ADD_X3_2 = 0x91000863;    // ADD X3, X3, #2
+    constexpr u32 STP_W1_W2_X0 = 0x29000801; // STP W1, W2, [X0]
+
+    ArenaTestEnv env;
+    std::vector<void*> page_table(1 << 8, nullptr);
+    page_table[0] = env.arena.data();
+
+    Dynarmic::A64::UserConfig conf{&env};
+    conf.page_table = page_table.data();
+    conf.page_table_address_space_bits = 20;
+    conf.detect_self_modifying_code = true;
+    conf.loop_cached_registers = 4;
+    Dynarmic::A64::Jit jit{conf};
+
+    // The paired store is coalesced, and replaces the loop's own ADD on the first iteration.
+    env.Write(0x000, ADD_X3_1);
+    env.Write(0x004, STP_W1_W2_X0);
+    env.Write(0x008, 0xF1000484); // SUBS X4, X4, #1
+    env.Write(0x00C, 0x54FFFFA1); // B.NE .-12
+    env.Write(0x010, B_SELF);
+
+    jit.SetRegister(0, 0);
+    jit.SetRegister(1, ADD_X3_2);
+    jit.SetRegister(2, STP_W1_W2_X0);
+    jit.SetRegister(3, 0);
+    jit.SetRegister(4, 3);
+    jit.SetPC(0);
+
+    env.ticks_left = 100;
+    for (size_t i = 0; i < 10 && env.ticks_left > 0; i++) {
+        jit.Run();
+    }
+    REQUIRE(env.MemoryReadCode(0) == ADD_X3_2);
+    REQUIRE(jit.GetRegister(3) == 5);
+    REQUIRE(jit.GetRegister(4) == 0);
+    REQUIRE(jit.GetPC() == 0x10);
+}
@@ -16,7 +16,7 @@
 
 using Vector = Dynarmic::A64::Vector;
 
-class A64TestEnv final : public Dynarmic::A64::UserCallbacks {
+class A64TestEnv : public Dynarmic::A64::UserCallbacks {
 public:
     u64 ticks_left = 0;
 
@@ -0,0 +1,57 @@
+/* This file is part of the dynarmic project.
+ * Copyright (c) 2020 MerryMage
+ * This software may be used and distributed according to the terms of the GNU
+ * General Public License version 2 or any later version.
+ */
+
+#include <unordered_map>
+
+#include <catch.hpp>
+
+#include "backend/x64/block_lookup_table.h"
+#include "common/common_types.h"
+#include "rand_int.h"
+
+using namespace Dynarmic::Backend::X64;
+
+TEST_CASE("BlockLookupTable: Matches reference under random operations", "[x64]") {
+    BlockLookupTable table;
+    std::unordered_map<u64, size_t> reference;
+
+    // A small key space produces long probe sequences and many deletions from their middle.
+    for (size_t i = 0; i < 100000; i++) {
+        const u64 key = RandInt<u64>(0, 4000) * 4;
+        const size_t size = RandInt<size_t>(1, 1000);
+
+        switch (RandInt<int>(0, 2)) {
+        case 0:
+            table.Insert(key, {reinterpret_cast<CodePtr>(key + 1), size});
+            reference.emplace(key, size);
+            break;
+        case 1:
+            REQUIRE(table.Erase(key) == (reference.erase(key) != 0));
+            break;
+        case 2: {
+            const auto block = table.Find(key);
+            const auto iter = reference.find(key);
+            REQUIRE(block.has_value() == (iter != reference.end()));
+            if (block) {
+                REQUIRE(block->entrypoint == reinterpret_cast<CodePtr>(key + 1));
+                REQUIRE(block->size == iter->second);
+            }
+            break;
+        }
+        }
+        REQUIRE(table.Size() == reference.size());
+    }
+
+    const auto erased = table.EraseIf([](const BlockLookupTable::BlockDescriptor& block) { return block.size % 2 == 0; });
+    for (const u64 key : erased) {
+        REQUIRE(reference.at(key) % 2 == 0);
+        reference.erase(key);
+    }
+    REQUIRE(table.Size() == reference.size());
+    for (const auto& [key, size] : reference) {
+        REQUIRE(table.Find(key)->size == size);
+    }
+}
@@ -0,0 +1,146 @@
+/* This file is part of the dynarmic project.
+ * Copyright (c) 2020 MerryMage
+ * This software may be used and distributed according to the terms of the GNU
+ * General Public License version 2 or any later version.
+ */
+
+#include <chrono>
+#include <set>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include <boost/icl/interval_map.hpp>
+#include <boost/icl/interval_set.hpp>
+#include <catch.hpp>
+#include <fmt/format.h>
+
+#include "backend/x64/block_range_information.h"
+#include "common/common_types.h"
+#include "rand_int.h"
+
+using namespace Dynarmic;
+using namespace Dynarmic::Backend::X64;
+
+namespace {
+
+using Interval = boost::icl::discrete_interval<u64>;
+
+// The interval map based implementation that BlockRangeInformation used to have.
+class IntervalMapBlockRangeInformation {
+public:
+    void AddRange(Interval range, IR::LocationDescriptor location) {
+        block_ranges.add(std::make_pair(range, std::set<IR::LocationDescriptor>{location}));
+        location_ranges[location].add(range);
+    }
+
+    std::unordered_set<IR::LocationDescriptor> InvalidateRanges(const boost::icl::interval_set<u64>& ranges) {
+        std::unordered_set<IR::LocationDescriptor> erase_locations;
+        for (auto invalidate_interval : ranges) {
+            auto pair = block_ranges.equal_range(invalidate_interval);
+            for (auto it = pair.first; it != pair.second; ++it) {
+                for (const auto& descriptor : it->second) {
+                    erase_locations.insert(descriptor);
+                }
+            }
+        }
+        for (const auto& location : erase_locations) {
+            for (const auto& range : location_ranges[location]) {
+                block_ranges.subtract(std::make_pair(range, std::set<IR::LocationDescriptor>{location}));
+            }
+            location_ranges.erase(location);
+        }
+        return erase_locations;
+    }
+
+    bool Intersects(Interval range) const {
+        return boost::icl::intersects(block_ranges, range);
+    }
+
+private:
+    boost::icl::interval_map<u64, std::set<IR::LocationDescriptor>> block_ranges;
+    std::unordered_map<IR::LocationDescriptor, boost::icl::interval_set<u64>> location_ranges;
+};
+
+Interval RandomRange(u64 address_space_size, u64 max_size) {
+    const u64 start = RandInt<u64>(0, address_space_size - 1);
+    return Interval::closed(start, start + RandInt<u64>(0, max_size - 1));
+}
+
+template <typename T>
+double TimeWorkload(T& info, const std::vector<std::pair<Interval, IR::LocationDescriptor>>& blocks, const std::vector<Interval>& invalidations) {
+    const auto start = std::chrono::steady_clock::now();
+    for (const auto& [range, location] : blocks) {
+        info.AddRange(range, location);
+    }
+    size_t invalidated = 0;
+    for (const auto& range : invalidations) {
+        invalidated += info.InvalidateRanges(boost::icl::interval_set<u64>{range}).size();
+    }
+    const auto end = std::chrono::steady_clock::now();
+    REQUIRE(invalidated > 0);
+    return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+} // anonymous namespace
+
+TEST_CASE("BlockRangeInformation: Matches reference under random operations", "[x64]") {
+    BlockRangeInformation<u64> info;
+    IntervalMapBlockRangeInformation reference;
+
+    constexpr u64 address_space_size = 0x10000;
+
+    for (size_t i = 0; i < 20000; i++) {
+        switch (RandInt<int>(0, 3)) {
+        case 0:
+        case 1: {
+            // Blocks may have several ranges, and may be added again with the same range.
+            const IR::LocationDescriptor location{RandInt<u64>(0, 2000)};
+            const Interval range = RandomRange(address_space_size, 0x200);
+            info.AddRange(range, location);
+            reference.AddRange(range, location);
+            break;
+        }
+        case 2: {
+            boost::icl::interval_set<u64> ranges;
+            ranges.add(RandomRange(address_space_size, RandInt<int>(0, 7) == 0 ? 0x4000 : 0x10));
+            ranges.add(RandomRange(address_space_size, 0x10));
+            REQUIRE(info.InvalidateRanges(ranges) == reference.InvalidateRanges(ranges));
+            break;
+        }
+        case 3: {
+            const Interval range = RandomRange(address_space_size, 0x1000);
+            REQUIRE(info.Intersects(range) == reference.Intersects(range));
+            break;
+        }
+        }
+    }
+
+    // Invalidating everything leaves nothing behind.
+    const auto everything = Interval::closed(0, ~u64(0));
+    REQUIRE(info.InvalidateRanges(boost::icl::interval_set<u64>{everything}) == reference.InvalidateRanges(boost::icl::interval_set<u64>{everything}));
+    REQUIRE(!info.Intersects(everything));
+}
+
+TEST_CASE("BlockRangeInformation: Benchmark against interval map", "[.][benchmark]") {
+    constexpr u64 address_space_size = 0x10000000;
+    constexpr size_t block_count = 100000;
+    constexpr size_t invalidation_count = 20000;
+
+    std::vector<std::pair<Interval, IR::LocationDescriptor>> blocks;
+    for (size_t i = 0; i < block_count; i++) {
+        const u64 pc = RandInt<u64>(0, address_space_size / 4 - 1) * 4;
+        blocks.emplace_back(Interval::closed(pc, pc + RandInt<u64>(1, 64) * 4 - 1), IR::LocationDescriptor{pc});
+    }
+    std::vector<Interval> invalidations;
+    for (size_t i = 0; i < invalidation_count; i++) {
+        invalidations.emplace_back(RandomRange(address_space_size, 0x4000));
+    }
+
+    BlockRangeInformation<u64> info;
+    IntervalMapBlockRangeInformation reference;
+    const double page_indexed_ms = TimeWorkload(info, blocks, invalidations);
+    const double interval_map_ms = TimeWorkload(reference, blocks, invalidations);
+
+    fmt::print("BlockRangeInformation: page indexed {:.1f} ms, interval map {:.1f} ms\n", page_indexed_ms, interval_map_ms);
+}